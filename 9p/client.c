@@ -14,11 +14,13 @@ get_user_name(Arena *arena)
 internal Client9P *
 client9p_init(Arena *arena, u64 fd)
 {
-  Client9P *client = push_array(arena, Client9P, 1);
-  client->fd       = fd;
-  client->next_tag = 1;
-  client->next_fid = 1;
-  if(!client9p_version(arena, client, P9_IOUNIT_DEFAULT))
+  Client9P *client        = push_array(arena, Client9P, 1);
+  client->fd              = fd;
+  client->next_tag        = 1;
+  client->next_fid        = 1;
+  client->reader.buffer   = push_array_no_zero(arena, u8, P9_READER_BUFFER_SIZE);
+  client->reader.capacity = P9_READER_BUFFER_SIZE;
+  if(!client9p_version(arena, client, P9_MESSAGE_SIZE_CEILING))
   {
     client9p_unmount(arena, client);
     return 0;
@@ -180,8 +182,12 @@ client9p_mount(Arena *arena, u64 fd, String8 auth_daemon, String8 auth_id, Strin
 internal void
 client9p_unmount(Arena *arena, Client9P *client)
 {
-  client9p_fid_close(arena, client->root);
-  client->root = 0;
+  // A client that failed Tversion or Tattach has no root to clunk
+  if(client->root != 0)
+  {
+    client9p_fid_close(arena, client->root);
+    client->root = 0;
+  }
   if(client->auth_fid != 0)
   {
     client9p_fid_close(arena, client->auth_fid);
@@ -200,7 +206,7 @@ client9p_next_tag(Client9P *client)
     u32 current_tag = ins_atomic_u32_eval(&client->next_tag);
     u32 next_tag    = current_tag + 1;
     if(next_tag == P9_TAG_NONE) { next_tag = 1; }
-    if(ins_atomic_u32_eval_cond_assign(&client->next_tag, current_tag, next_tag))
+    if(ins_atomic_u32_eval_cond_assign(&client->next_tag, next_tag, current_tag) == current_tag)
     {
       tag = current_tag;
       break;
@@ -217,19 +223,20 @@ client9p_send(Arena *arena, Client9P *client, Message9P tx)
   log_infof("9P <- %S\n", str8_from_msg9p__fmt(scratch.arena, tx));
   scratch_end(scratch);
 #endif
-  String8 tx_msg = str8_from_msg9p(arena, tx);
-  if(tx_msg.size == 0) { return 0; }
-  ssize_t bytes_written = write(client->fd, tx_msg.str, tx_msg.size);
-  return bytes_written > 0 && (u64)bytes_written == tx_msg.size;
+  // A Twrite payload is sent straight from the caller's buffer
+  String8 payload = str8_zero();
+  String8 header  = str8_from_msg9p_header(arena, tx, &payload);
+  if(header.size == 0) { return 0; }
+  return msg9p_write(client->fd, header, payload) == header.size + payload.size;
 }
 
 internal Message9P
 client9p_receive(Arena *arena, Client9P *client)
 {
   Message9P result = msg9p_zero();
-  String8 rx_msg   = read_9p_msg(arena, client->fd);
+  String8 rx_msg   = msg9p_reader_read(arena, &client->reader, client->fd);
   if(rx_msg.size == 0) { return result; }
-  result = msg9p_from_str8(arena, rx_msg);
+  result = msg9p_view_from_str8(rx_msg);
 #if BUILD_DEBUG
   Temp scratch = scratch_begin(&arena, 1);
   log_infof("9P -> %S\n", str8_from_msg9p__fmt(scratch.arena, result));
@@ -443,6 +450,16 @@ client9p_open(Arena *arena, Client9P *client, String8 name, u32 mode)
   return fid;
 }
 
+internal u64
+client9p_tag_index(u32 *tags, u64 count, u32 tag)
+{
+  for(u64 i = 0; i < count; i += 1)
+  {
+    if(tags[i] == tag) { return i; }
+  }
+  return count;
+}
+
 internal s64
 client9p_fid_pread(Arena *arena, ClientFid9P *fid, void *buf, u64 n, s64 offset)
 {
@@ -478,28 +495,29 @@ client9p_fid_pread(Arena *arena, ClientFid9P *fid, void *buf, u64 n, s64 offset)
       }
     }
 
+    // Servers may answer a window out of order; match replies to chunks by tag
+    u64 *read_sizes = push_array(arena, u64, window_size);
+    b32 failed      = 0;
     for(u64 i = 0; i < window_size; i += 1)
     {
       Message9P rx = client9p_receive(arena, fid->client);
-      if(rx.type != Msg9P_Rread || rx.tag != tags[i])
-      {
-        for(u64 j = i + 1; j < window_size; j += 1) { client9p_receive(arena, fid->client); }
-        return total_num_bytes_read == 0 ? -1 : total_num_bytes_read;
-      }
+      u64 idx      = client9p_tag_index(tags, window_size, rx.tag);
+      if(rx.type != Msg9P_Rread || idx == window_size) { failed = 1; continue; }
 
-      u64 chunk_idx     = window_start + i;
+      u64 chunk_idx     = window_start + idx;
       u64 expected_size = Min(n - chunk_idx * max_message_size, max_message_size);
-      u64 read_size     = rx.payload_data.size;
-      MemoryCopy((u8 *)buf + chunk_idx * max_message_size, rx.payload_data.str, Min(read_size, expected_size));
-      total_num_bytes_read += Min(read_size, expected_size);
+      read_sizes[idx]   = Min(rx.payload_data.size, expected_size);
+      MemoryCopy((u8 *)buf + chunk_idx * max_message_size, rx.payload_data.str, read_sizes[idx]);
+    }
 
-      if(read_size < expected_size)
-      {
-        for(u64 j = i + 1; j < window_size; j += 1) { client9p_receive(arena, fid->client); }
-        early_exit = 1;
-        break;
-      }
+    for(u64 i = 0; i < window_size && !early_exit; i += 1)
+    {
+      u64 chunk_idx     = window_start + i;
+      u64 expected_size = Min(n - chunk_idx * max_message_size, max_message_size);
+      total_num_bytes_read += read_sizes[i];
+      if(read_sizes[i] < expected_size) { early_exit = 1; }
     }
+    if(failed) { return total_num_bytes_read == 0 ? -1 : total_num_bytes_read; }
   }
 
   if(offset == -1) { fid->offset += total_num_bytes_read; }
@@ -543,27 +561,25 @@ client9p_fid_pwrite(Arena *arena, ClientFid9P *fid, void *buf, u64 n, s64 offset
       }
     }
 
+    // Servers may answer a window out of order; match replies to chunks by tag
+    u64 *write_sizes = push_array(arena, u64, window_size);
+    b32 failed       = 0;
     for(u64 i = 0; i < window_size; i += 1)
     {
       Message9P rx = client9p_receive(arena, fid->client);
-      if(rx.type != Msg9P_Rwrite || rx.tag != tags[i])
-      {
-        for(u64 j = i + 1; j < window_size; j += 1) { client9p_receive(arena, fid->client); }
-        return total_num_bytes_written == 0 ? -1 : total_num_bytes_written;
-      }
+      u64 idx      = client9p_tag_index(tags, window_size, rx.tag);
+      if(rx.type != Msg9P_Rwrite || idx == window_size) { failed = 1; continue; }
+      write_sizes[idx] = rx.byte_count;
+    }
 
+    for(u64 i = 0; i < window_size && !early_exit; i += 1)
+    {
       u64 chunk_idx     = window_start + i;
       u64 expected_size = Min(n - chunk_idx * max_message_size, max_message_size);
-      u32 write_result  = rx.byte_count;
-      total_num_bytes_written += write_result;
-
-      if(write_result < expected_size)
-      {
-        for(u64 j = i + 1; j < window_size; j += 1) { client9p_receive(arena, fid->client); }
-        early_exit = 1;
-        break;
-      }
+      total_num_bytes_written += write_sizes[i];
+      if(write_sizes[i] < expected_size) { early_exit = 1; }
     }
+    if(failed) { return total_num_bytes_written == 0 ? -1 : total_num_bytes_written; }
   }
 
   if(offset == -1) { fid->offset += total_num_bytes_written; }
@@ -28,6 +28,7 @@ struct Client9P
   u32 next_fid;
   struct ClientFid9P *root;
   struct ClientFid9P *auth_fid;
+  MsgReader9P reader;
 };
 
 typedef struct ClientFid9P ClientFid9P;
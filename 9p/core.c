@@ -58,7 +58,14 @@ decode_str8(Arena *arena, u8 *ptr, u8 *end, String8 *out_string)
 
   if(ptr + size > end) { return 0; }
 
-  if(size > 0)
+  // Without an arena the string is a view into the encoded bytes
+  if(size > 0 && arena == 0)
+  {
+    out_string->str  = ptr;
+    out_string->size = size;
+    ptr             += size;
+  }
+  else if(size > 0)
   {
     u8 *buffer       = push_array(arena, u8, size + 1);
     MemoryCopy(buffer, ptr, size);
@@ -390,6 +397,24 @@ str8_from_msg9p(Arena *arena, Message9P msg)
   return result;
 }
 
+internal String8
+str8_from_msg9p_header(Arena *arena, Message9P msg, String8 *out_payload)
+{
+  *out_payload = str8_zero();
+  if(msg.type != Msg9P_Twrite && msg.type != Msg9P_Rread) { return str8_from_msg9p(arena, msg); }
+
+  // Both messages end in count[4] data[count]; the size and count fields
+  // are patched to cover the payload left out of the encoding
+  String8 payload  = msg.payload_data;
+  msg.payload_data = str8_zero();
+  String8 result   = str8_from_msg9p(arena, msg);
+  if(result.size == 0) { return result; }
+  write_u32(result.str, from_le_u32((u32)(result.size + payload.size)));
+  write_u32(result.str + result.size - 4, from_le_u32((u32)payload.size));
+  *out_payload = payload;
+  return result;
+}
+
 internal Message9P
 msg9p_from_str8(Arena *arena, String8 data)
 {
@@ -665,6 +690,12 @@ msg9p_from_str8(Arena *arena, String8 data)
   return result;
 }
 
+internal Message9P
+msg9p_view_from_str8(String8 data)
+{
+  return msg9p_from_str8(0, data);
+}
+
 ////////////////////////////////
 //~ Message Formatting
 
@@ -868,6 +899,12 @@ dir9p_from_str8(Arena *arena, String8 data)
   return result;
 }
 
+internal Dir9P
+dir9p_view_from_str8(String8 data)
+{
+  return dir9p_from_str8(0, data);
+}
+
 ////////////////////////////////
 //~ Directory List Operations
 
@@ -885,48 +922,116 @@ dir9p_list_push(Arena *arena, DirList9P *list, Dir9P dir)
 ////////////////////////////////
 //~ Message I/O
 
-internal String8
-read_9p_msg(Arena *arena, u64 fd)
+internal u64
+msg9p_writev(u64 fd, String8 *parts, u64 part_count)
 {
-  u8  len_buf[4];
-  u32 total_num_bytes_to_read      = 4;
-  u32 total_num_bytes_read         = 0;
-  u32 total_num_bytes_left_to_read = total_num_bytes_to_read;
+  // One writev per attempt; a short write resumes wherever it stopped
+  u64 total_size = 0;
+  for(u64 i = 0; i < part_count; i += 1) { total_size += parts[i].size; }
 
-  for(; total_num_bytes_left_to_read > 0;)
+  u64 total_num_bytes_written = 0;
+  for(; total_num_bytes_written < total_size;)
   {
-    ssize_t read_result = read(fd, len_buf + total_num_bytes_read, total_num_bytes_left_to_read);
-    if(read_result > 0)
+    struct iovec iov[4];
+    int iov_count = 0;
+    u64 skip      = total_num_bytes_written;
+    for(u64 i = 0; i < part_count && iov_count < (int)ArrayCount(iov); i += 1)
     {
-      total_num_bytes_read += read_result;
-      total_num_bytes_left_to_read -= read_result;
+      if(skip >= parts[i].size) { skip -= parts[i].size; continue; }
+      iov[iov_count].iov_base  = parts[i].str + skip;
+      iov[iov_count].iov_len   = parts[i].size - skip;
+      iov_count               += 1;
+      skip                     = 0;
     }
-    else if(errno == EINTR) { continue; }
-    else                    { return str8_zero(); }
+
+    ssize_t write_result = writev(fd, iov, iov_count);
+    if(write_result > 0)                        { total_num_bytes_written += write_result; }
+    else if(write_result < 0 && errno == EINTR) { continue; }
+    else                                        { break; }
   }
+  return total_num_bytes_written;
+}
 
-  u32     msg_size = (u32)from_le_u32(read_u32(len_buf));
-  String8 msg      = str8_zero();
-  msg.str  = push_array_no_zero(arena, u8, msg_size);
-  msg.size = msg_size;
+internal u64
+msg9p_write(u64 fd, String8 header, String8 payload)
+{
+  String8 parts[2] = {header, payload};
+  return msg9p_writev(fd, parts, ArrayCount(parts));
+}
 
-  MemoryCopy(msg.str, len_buf, sizeof len_buf);
+internal u64
+msg9p_reader_buffered(MsgReader9P *reader)
+{
+  return reader->end - reader->start;
+}
 
-  total_num_bytes_to_read      = msg.size - 4;
-  total_num_bytes_read         = 0;
-  total_num_bytes_left_to_read = total_num_bytes_to_read;
+internal u32
+msg9p_reader_next_size(MsgReader9P *reader)
+{
+  if(msg9p_reader_buffered(reader) < P9_MESSAGE_SIZE_FIELD_SIZE) { return 0; }
+  return from_le_u32(read_u32(reader->buffer + reader->start));
+}
+
+internal String8
+msg9p_reader_take(MsgReader9P *reader, u64 size)
+{
+  u64 take_size  = Min(size, msg9p_reader_buffered(reader));
+  String8 result = str8(reader->buffer + reader->start, take_size);
+  reader->start += take_size;
+  if(reader->start == reader->end) { reader->start = reader->end = 0; }
+  return result;
+}
 
-  for(; total_num_bytes_left_to_read > 0;)
+internal s64
+msg9p_reader_fill(MsgReader9P *reader, u64 fd, b32 nonblocking)
+{
+  // Unconsumed bytes move to the front so the whole tail is free
+  if(reader->start > 0)
   {
-    ssize_t read_result = read(fd, msg.str + 4 + total_num_bytes_read, total_num_bytes_left_to_read);
-    if(read_result > 0)
-    {
-      total_num_bytes_read += read_result;
-      total_num_bytes_left_to_read -= read_result;
-    }
-    else if(errno == EINTR) { continue; }
-    else                    { return str8_zero(); }
+    MemoryCopy(reader->buffer, reader->buffer + reader->start, msg9p_reader_buffered(reader));
+    reader->end   -= reader->start;
+    reader->start  = 0;
+  }
+  if(reader->end == reader->capacity) { errno = ENOBUFS; return -1; }
+
+  for(;;)
+  {
+    ssize_t result = 0;
+    if(nonblocking) { result = recv(fd, reader->buffer + reader->end, reader->capacity - reader->end, MSG_DONTWAIT); }
+    else            { result = read(fd, reader->buffer + reader->end, reader->capacity - reader->end); }
+    if(result < 0 && errno == EINTR) { continue; }
+    reader->recv_count += 1;
+    if(result > 0) { reader->end += result; }
+    return result;
+  }
+}
+
+internal String8
+msg9p_reader_read(Arena *arena, MsgReader9P *reader, u64 fd)
+{
+  for(; msg9p_reader_buffered(reader) < P9_MESSAGE_SIZE_FIELD_SIZE;)
+  {
+    if(msg9p_reader_fill(reader, fd, 0) <= 0) { return str8_zero(); }
+  }
+  u32 msg_size = msg9p_reader_next_size(reader);
+  if(msg_size < P9_MESSAGE_MINIMUM_SIZE || msg_size > P9_MESSAGE_SIZE_MAX) { return str8_zero(); }
+
+  // Messages that fit are gathered in the buffer; larger ones have their
+  // tail read straight into place
+  for(; msg_size <= reader->capacity && msg9p_reader_buffered(reader) < msg_size;)
+  {
+    if(msg9p_reader_fill(reader, fd, 0) <= 0) { return str8_zero(); }
   }
 
+  String8 msg  = str8(push_array_no_zero(arena, u8, msg_size), msg_size);
+  String8 head = msg9p_reader_take(reader, msg_size);
+  MemoryCopy(msg.str, head.str, head.size);
+  for(u64 pos = head.size; pos < msg_size;)
+  {
+    ssize_t read_result = read(fd, msg.str + pos, msg_size - pos);
+    if(read_result > 0)                        { pos += read_result; reader->recv_count += 1; }
+    else if(read_result < 0 && errno == EINTR) { continue; }
+    else                                       { return str8_zero(); }
+  }
   return msg;
 }
@@ -26,8 +26,13 @@ read_only global String8 version_9p = str8_lit_comp("9P2000");
 #define P9_OPEN_MODE_NONE               max_u32
 #define P9_MESSAGE_HEADER_SIZE          24
 #define P9_IOUNIT_DEFAULT               MB(1)
+#define P9_MESSAGE_SIZE_MIN             KB(4)
+#define P9_MESSAGE_SIZE_DEFAULT         (P9_IOUNIT_DEFAULT + P9_MESSAGE_HEADER_SIZE)
+#define P9_MESSAGE_SIZE_CEILING         (MB(8) + P9_MESSAGE_HEADER_SIZE)
+#define P9_MESSAGE_SIZE_MAX             (MB(16) + P9_MESSAGE_HEADER_SIZE)
 #define P9_DIR_ENTRY_MAX                MB(1)
 #define P9_DIR_BUFFER_MAX               (P9_DIR_ENTRY_MAX * 16)
+#define P9_READER_BUFFER_SIZE           KB(64)
 
 ////////////////////////////////
 //~ Protocol Message Types
@@ -101,6 +106,19 @@ struct DirList9P
   DirNode9P *last;
 };
 
+// Receive buffer that pulls as many bytes as the descriptor has ready and
+// hands out framed messages from them, so pipelined traffic costs far
+// fewer than one syscall per message
+typedef struct MsgReader9P MsgReader9P;
+struct MsgReader9P
+{
+  u8 *buffer;
+  u64 capacity;
+  u64 start;
+  u64 end;
+  u64 recv_count;
+};
+
 ////////////////////////////////
 //~ Message Type Codes
 
@@ -203,6 +221,14 @@ internal u32 msg9p_size(Message9P msg);
 internal String8 str8_from_msg9p(Arena *arena, Message9P msg);
 internal Message9P msg9p_from_str8(Arena *arena, String8 data);
 
+// Encodes all of msg except a Twrite or Rread payload, which is returned in
+// out_payload to be sent from the caller's memory right after the header.
+internal String8 str8_from_msg9p_header(Arena *arena, Message9P msg, String8 *out_payload);
+
+// Views decode without allocating: every String8 in the result points into
+// data, is not null-terminated, and is valid only as long as data is.
+internal Message9P msg9p_view_from_str8(String8 data);
+
 ////////////////////////////////
 //~ Message Formatting
 
@@ -214,6 +240,7 @@ internal String8 str8_from_msg9p__fmt(Arena *arena, Message9P msg);
 internal u32 dir9p_size(Dir9P dir);
 internal String8 str8_from_dir9p(Arena *arena, Dir9P dir);
 internal Dir9P dir9p_from_str8(Arena *arena, String8 data);
+internal Dir9P dir9p_view_from_str8(String8 data);
 
 ////////////////////////////////
 //~ Directory List Operations
@@ -223,6 +250,13 @@ internal void dir9p_list_push(Arena *arena, DirList9P *list, Dir9P dir);
 ////////////////////////////////
 //~ Message I/O
 
-internal String8 read_9p_msg(Arena *arena, u64 fd);
+internal u64 msg9p_writev(u64 fd, String8 *parts, u64 part_count);
+internal u64 msg9p_write(u64 fd, String8 header, String8 payload);
+internal u64 msg9p_reader_buffered(MsgReader9P *reader);
+internal u32 msg9p_reader_next_size(MsgReader9P *reader);
+// Views returned by take are valid until the next fill.
+internal String8 msg9p_reader_take(MsgReader9P *reader, u64 size);
+internal s64 msg9p_reader_fill(MsgReader9P *reader, u64 fd, b32 nonblocking);
+internal String8 msg9p_reader_read(Arena *arena, MsgReader9P *reader, u64 fd);
 
 #endif // _9P_CORE_H
@@ -118,6 +118,18 @@ dial9p_connect(Arena *scratch, String8 dial_string, String8 default_protocol, St
 
 internal OS_Handle
 dial9p_listen(String8 dial_string, String8 default_protocol, String8 default_port)
+{
+  return dial9p_listen__opts(dial_string, default_protocol, default_port, 0);
+}
+
+internal OS_Handle
+dial9p_listen_reuseport(String8 dial_string, String8 default_protocol, String8 default_port)
+{
+  return dial9p_listen__opts(dial_string, default_protocol, default_port, 1);
+}
+
+internal OS_Handle
+dial9p_listen__opts(String8 dial_string, String8 default_protocol, String8 default_port, b32 reuse_port)
 {
   Temp          scratch = scratch_begin(0, 0);
   Dial9PAddress address = dial9p_parse(scratch.arena, dial_string, default_protocol, default_port);
@@ -130,7 +142,7 @@ dial9p_listen(String8 dial_string, String8 default_protocol, String8 default_por
   }
 
   if(address.protocol == Dial9PProtocol_Unix)     { result = os_socket_listen_unix(address.host); }
-  else if(address.protocol == Dial9PProtocol_TCP) { result = os_socket_listen_tcp(address.port); }
+  else if(address.protocol == Dial9PProtocol_TCP) { result = os_socket_listen_tcp__opts(address.port, reuse_port); }
 
   scratch_end(scratch);
   return result;
@@ -33,5 +33,7 @@ internal Dial9PAddress dial9p_parse(Arena *arena, String8 dial_string, String8 d
 
 internal OS_Handle dial9p_connect(Arena *scratch, String8 dial_string, String8 default_protocol, String8 default_port);
 internal OS_Handle dial9p_listen(String8 dial_string, String8 default_protocol, String8 default_port);
+internal OS_Handle dial9p_listen_reuseport(String8 dial_string, String8 default_protocol, String8 default_port);
+internal OS_Handle dial9p_listen__opts(String8 dial_string, String8 default_protocol, String8 default_port, b32 reuse_port);
 
 #endif // _9P_DIAL_H
@@ -4,16 +4,50 @@
 internal FsContext9P *
 fs9p_context_alloc(Arena *arena, String8 root_path, String8 tmp_path, b32 readonly, StorageBackend9P backend)
 {
-  FsContext9P *ctx    = push_array(arena, FsContext9P, 1);
-  ctx->root_path      = str8_copy(arena, root_path);
-  ctx->root_canonical = os_full_path_from_path(arena, root_path);
-  ctx->tmp_path       = str8_copy(arena, tmp_path);
-  ctx->tmp_mutex      = mutex_alloc();
-  ctx->tmp_arena      = arena_alloc();
-  ctx->tmp_root       = temp9p_node_create(ctx->tmp_arena, ctx, str8_lit("."), str8_lit("."), 1, 0755);
-  ctx->tmp_qid_count  = 1;
-  ctx->readonly       = readonly;
-  ctx->backend        = backend;
+  FsContext9P *ctx      = push_array(arena, FsContext9P, 1);
+  ctx->root_path        = str8_copy(arena, root_path);
+  ctx->root_canonical   = os_full_path_from_path(arena, root_path);
+  ctx->root_fd          = -1;
+  ctx->tmp_path         = str8_copy(arena, tmp_path);
+  ctx->readonly         = readonly;
+  ctx->backend          = backend;
+  ctx->stat_batch_mutex = mutex_alloc();
+  ctx->stat_batch_arena = arena_alloc();
+  ctx->id_map_mutex     = mutex_alloc();
+  ctx->read_ahead_max   = READ_AHEAD_WINDOW_DEFAULT;
+
+  // The in-memory tree locks its namespace as a whole and file contents per
+  // node stripe, so I/O on different files never contends
+  if(backend == StorageBackend9P_ArenaTemp)
+  {
+    ctx->tmp_tree_mutex  = rw_mutex_alloc();
+    ctx->tmp_alloc_mutex = mutex_alloc();
+    for(u64 i = 0; i < TEMP_NODE_STRIPE_COUNT; i += 1) { ctx->tmp_node_mutexes[i] = mutex_alloc(); }
+    ctx->tmp_arena       = arena_alloc();
+    ctx->tmp_root        = temp9p_node_alloc(ctx, str8_lit("."), 1, 0755);
+  }
+
+  // Disk walks resolve beneath this directory; kernels without openat2 keep
+  // the realpath-based checks
+  if(backend == StorageBackend9P_Disk)
+  {
+    String8 root_cstr = str8_copy(arena, root_path);
+    int root_fd       = open((char *)root_cstr.str, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(root_fd >= 0)
+    {
+      int probe_fd = fs9p_openat_beneath(root_fd, str8_lit("."), O_PATH);
+      if(probe_fd >= 0) { close(probe_fd); ctx->root_fd = root_fd; }
+      else              { close(root_fd); }
+    }
+
+    // Owner names are preloaded and refreshed in the background so stats
+    // never wait on NSS for a known id
+    ctx->id_map          = fs9p_id_map_alloc();
+    ctx->id_lookup_mutex = rw_mutex_alloc();
+    ctx->id_lookup_arena = arena_alloc();
+    Thread thread        = thread_launch(fs9p_id_map_thread_entry_point, ctx);
+    thread_detach(thread);
+  }
 
   return ctx;
 }
@@ -159,6 +193,14 @@ fs9p_resolve_path(Arena *arena, FsContext9P *ctx, String8 base_path, String8 nam
   }
 
   String8 joined    = fs9p_path_join(arena, base_path, name);
+  if(ctx->backend == StorageBackend9P_ArenaTemp)
+  {
+    // The in-memory tree has no links, so a safe name cannot leave it
+    result.absolute_path = joined;
+    result.valid         = 1;
+    return result;
+  }
+
   String8 os_path   = os_path_from_fs9p_path(arena, ctx, joined);
   String8 canonical = os_full_path_from_path(arena, os_path);
   b32 canonicalized = (canonical.size > 0 && str8_match(canonical, os_path, 0) == 0);
@@ -333,6 +375,67 @@ os_path_from_fs9p_path(Arena *arena, FsContext9P *ctx, String8 relative_path)
   return fs9p_path_join(arena, ctx->root_path, relative_path);
 }
 
+internal int
+fs9p_openat_beneath(int dir_fd, String8 path, int flags)
+{
+  Temp scratch        = scratch_begin(0, 0);
+  String8 path_cstr   = str8_copy(scratch.arena, path.size > 0 ? path : str8_lit("."));
+  struct open_how how = {0};
+  how.flags           = (u64)(flags | O_CLOEXEC);
+  how.resolve         = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+  // EAGAIN means a concurrent rename raced the lookup; it is safe to retry
+  long fd = -1;
+  for(u64 attempt = 0; attempt < 8; attempt += 1)
+  {
+    fd = syscall(SYS_openat2, dir_fd, (char *)path_cstr.str, &how, sizeof(how));
+    if(fd >= 0 || (errno != EINTR && errno != EAGAIN)) { break; }
+  }
+  scratch_end(scratch);
+  return (int)fd;
+}
+
+internal PathResolution9P
+fs9p_walk(Arena *arena, FsContext9P *ctx, int dir_fd, String8 dir_path, String8 name)
+{
+  PathResolution9P result = {0};
+  result.fd               = -1;
+
+  if(!fs9p_path_is_safe(name) || str8_find_needle(name, 0, str8_lit("/"), 0) < name.size)
+  {
+    result.error = str8_lit("unsafe path");
+    return result;
+  }
+
+  // One element beneath the fid's directory is the common case; a symlink
+  // that leaves that directory is re-resolved beneath the export root
+  String8 joined = fs9p_path_join(arena, dir_path, name);
+  int fd         = -1;
+  if(dir_fd >= 0)                              { fd = fs9p_openat_beneath(dir_fd, name, O_PATH); }
+  if(dir_fd < 0 || (fd < 0 && errno == EXDEV)) { fd = fs9p_openat_beneath(ctx->root_fd, joined, O_PATH); }
+  if(fd < 0)
+  {
+    result.error = (errno == EXDEV || errno == ELOOP) ? str8_lit("path escapes root") : str8_lit("file not found");
+    return result;
+  }
+
+  struct stat st = {0};
+  if(fstat(fd, &st) != 0)
+  {
+    close(fd);
+    result.error = str8_lit("file not found");
+    return result;
+  }
+
+  result.fd            = fd;
+  result.valid         = 1;
+  result.absolute_path = joined;
+  result.qid.path      = st.st_ino;
+  result.qid.version   = st.st_mtime;
+  result.qid.type      = S_ISDIR(st.st_mode) ? QidTypeFlag_Directory : QidTypeFlag_File;
+  return result;
+}
+
 ////////////////////////////////
 //~ File Operations
 
@@ -346,27 +449,27 @@ fs9p_open(Arena *arena, FsContext9P *ctx, String8 path, u32 mode)
 
   if(ctx->backend == StorageBackend9P_ArenaTemp)
   {
-    MutexScope(ctx->tmp_mutex)
-    {
-      TempNode9P *node       = temp9p_open(ctx, path);
-      if(node != 0)
-      {
-        handle->tmp_node     = node;
-        handle->is_directory = node->is_directory;
-
-        if(mode & P9_OpenFlag_Truncate && !node->is_directory)
-        {
-          node->content.size = 0;
-        }
-      }
-    }
+    handle->tmp_node     = temp9p_open(ctx, path, (mode & P9_OpenFlag_Truncate) != 0);
+    handle->is_directory = handle->tmp_node != 0 && handle->tmp_node->is_directory;
     return handle;
   }
 
   String8     os_path = os_path_from_fs9p_path(arena, ctx, path);
   struct stat st      = {0};
+  b32         stat_ok = 0;
+
+  // With a root fd the file is looked up beneath the root, so an entry
+  // swapped for an escaping symlink after the walk fails to open
+  if(ctx->root_fd >= 0)
+  {
+    int probe_fd = fs9p_openat_beneath(ctx->root_fd, path, O_PATH);
+    if(probe_fd < 0) { return handle; }
+    stat_ok = fstat(probe_fd, &st) == 0;
+    close(probe_fd);
+  }
+  else { stat_ok = stat((char *)os_path.str, &st) == 0; }
 
-  if(stat((char *)os_path.str, &st) == 0 && S_ISDIR(st.st_mode))
+  if(stat_ok && S_ISDIR(st.st_mode))
   {
     handle->is_directory = 1;
     return handle;
@@ -380,20 +483,68 @@ fs9p_open(Arena *arena, FsContext9P *ctx, String8 path, u32 mode)
   else if(access_mode == P9_OpenFlag_ReadWrite) { flags  = O_RDWR; }
   if(mode & P9_OpenFlag_Truncate)               { flags |= O_TRUNC; }
 
-  int fd = open((char *)os_path.str, flags);
+  // Read-only opens of regular files share descriptors through the cache;
+  // reads are positional, so one fd can serve every fid on the file
+  b32 shareable            = flags == O_RDONLY && (mode & ~3) == 0 && S_ISREG(st.st_mode);
+  FdCacheEntry9P *fd_entry = (shareable && ctx->fd_cache != 0) ? fs9p_fd_cache_acquire(ctx->fd_cache, &st, flags) : 0;
+  int fd                   = -1;
+  if(fd_entry != 0)          { fd = fd_entry->fd; }
+  else if(ctx->root_fd >= 0) { fd = fs9p_openat_beneath(ctx->root_fd, path, flags); }
+  else                       { fd = open((char *)os_path.str, flags); }
   if(fd < 0)
   {
     handle->fd = -1;
     return handle;
   }
 
-  handle->fd = fd;
+  // The handle describes the file actually opened, not the one looked up
+  if(fd_entry == 0 && fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return handle;
+  }
+  shareable = shareable && S_ISREG(st.st_mode);
+
+  handle->fd         = fd;
+  handle->is_regular = S_ISREG(st.st_mode);
+  handle->dev        = st.st_dev;
+  handle->ino        = st.st_ino;
+  if(fd_entry != 0)                        { handle->fd_cache_entry = fd_entry; }
+  else if(shareable && ctx->fd_cache != 0) { handle->fd_cache_entry = fs9p_fd_cache_insert(ctx->fd_cache, fd, flags); }
+  if(flags & O_TRUNC)
+  {
+    fs9p_meta_cache_invalidate(ctx->meta_cache, path);
+    fs9p_content_cache_invalidate(ctx->content_cache, handle->dev, handle->ino);
+  }
+
+  // Small files are then read from memory, filled here if hot enough
+  if(shareable && ctx->content_cache != 0 && (u64)st.st_size <= CONTENT_CACHE_FILE_MAX)
+  {
+    handle->content_entry = fs9p_content_cache_acquire(ctx->content_cache, &st);
+    if(handle->content_entry == 0) { handle->content_entry = fs9p_content_cache_fill(ctx->content_cache, fd, &st); }
+  }
   return handle;
 }
 
 internal void
 fs9p_close(FsHandle9P *handle)
 {
+  if(handle->tmp_node != 0)
+  {
+    temp9p_close(handle->ctx, handle->tmp_node);
+    handle->tmp_node = 0;
+  }
+  if(handle->content_entry != 0)
+  {
+    fs9p_content_cache_release(handle->ctx->content_cache, handle->content_entry);
+    handle->content_entry = 0;
+  }
+  if(handle->fd_cache_entry != 0)
+  {
+    fs9p_fd_cache_release(handle->ctx->fd_cache, handle->fd_cache_entry);
+    handle->fd_cache_entry = 0;
+    handle->fd             = -1;
+  }
   if(handle->fd >= 0)
   {
     close(handle->fd);
@@ -406,53 +557,252 @@ fs9p_close(FsHandle9P *handle)
   }
 }
 
+internal b32
+fs9p_content_entry_fresh(FsHandle9P *handle)
+{
+  // Invalidations only reach entries still in the cache and never see other
+  // processes' writes, so each read checks the file against the copy again
+  ContentCacheEntry9P *entry = handle->content_entry;
+  if(entry == 0 || ins_atomic_u32_eval(&entry->stale)) { return 0; }
+
+  struct stat st = {0};
+  b32 fresh      = fstat(handle->fd, &st) == 0 && entry->size == (u64)st.st_size &&
+                   entry->mtime.tv_sec == st.st_mtim.tv_sec && entry->mtime.tv_nsec == st.st_mtim.tv_nsec;
+  if(!fresh) { ins_atomic_u32_eval_assign(&entry->stale, 1); }
+  return fresh;
+}
+
 internal String8
 fs9p_read(Arena *arena, FsHandle9P *handle, u64 offset, u64 count)
 {
-  if(handle->tmp_node != 0)
+  if(handle->tmp_node != 0) { return temp9p_read(arena, handle->ctx, handle->tmp_node, offset, count); }
+  if(handle->fd < 0) { return str8_zero(); }
+
+  // Cached contents stay pinned by the handle, so the reply can point into them
+  ContentCacheEntry9P *entry = handle->content_entry;
+  if(fs9p_content_entry_fresh(handle))
   {
-    String8 result = str8_zero();
-    MutexScope(handle->ctx->tmp_mutex) { result = temp9p_read(arena, handle->tmp_node, offset, count); }
-    return result;
+    u64 min = Min(offset, entry->size);
+    u64 max = min + Min(count, entry->size - min);
+    ins_atomic_u64_inc_eval(&handle->ctx->content_cache->read_count);
+    return str8(entry->data + min, max - min);
   }
-  if(handle->fd < 0)                                       { return str8_zero(); }
-  if(lseek(handle->fd, offset, SEEK_SET) != (off_t)offset) { return str8_zero(); }
 
-  u8      *buffer     = push_array(arena, u8, count);
-  ssize_t  bytes_read = read(handle->fd, buffer, count);
+  u8      *buffer     = push_array_no_zero(arena, u8, count);
+  ssize_t  bytes_read = pread(handle->fd, buffer, count, offset);
   if(bytes_read < 0) { return str8_zero(); }
 
   return str8(buffer, bytes_read);
 }
 
-internal u64
-fs9p_write(FsHandle9P *handle, u64 offset, String8 data)
+internal b32
+fs9p_read_range(FsHandle9P *handle, u64 offset, u64 count, Rng1U64 *range_out)
+{
+  // Only disk-backed regular files can be handed to sendfile; the range is
+  // clamped to the current size so the Rread header announces the real count
+  if(handle->tmp_node != 0 || handle->fd < 0 || handle->is_directory) { return 0; }
+  if(handle->content_entry != 0 && !ins_atomic_u32_eval(&handle->content_entry->stale)) { return 0; }
+
+  struct stat st = {0};
+  if(fstat(handle->fd, &st) != 0 || !S_ISREG(st.st_mode)) { return 0; }
+
+  u64 file_size = (u64)st.st_size;
+  u64 min       = Min(offset, file_size);
+  u64 max       = min + Min(count, file_size - min);
+  *range_out    = rng_1u64(min, max);
+  return 1;
+}
+
+// Caller serialises calls for one fid. Pipelined Treads can be handled out
+// of order, so once a stream is detected any read inside the window around
+// the expected offset still counts as sequential.
+internal Rng1U64
+fs9p_read_ahead_plan(FsContext9P *ctx, ReadAhead9P *read_ahead, u64 offset, u64 count)
 {
-  if(handle->tmp_node != 0 && handle->ctx != 0)
+  Rng1U64 result = {0};
+  if(ctx->read_ahead_max == 0 || count == 0) { return result; }
+
+  u64 end        = offset + count;
+  u64 slack      = read_ahead->window;
+  b32 sequential = (offset == read_ahead->next_offset) ||
+                   (slack > 0 && offset + slack >= read_ahead->next_offset && offset <= read_ahead->next_offset + slack);
+  if(!sequential)
   {
-    u64 result = 0;
-    MutexScope(handle->ctx->tmp_mutex) { result = temp9p_write(handle->ctx->tmp_arena, handle->tmp_node, offset, data); }
+    read_ahead->sequential_count = 0;
+    read_ahead->window           = 0;
+    read_ahead->advised_end      = 0;
+    read_ahead->next_offset      = end;
     return result;
   }
-  if(handle->fd < 0)                                       { return 0; }
-  if(lseek(handle->fd, offset, SEEK_SET) != (off_t)offset) { return 0; }
 
-  ssize_t bytes_written = write(handle->fd, data.str, data.size);
+  if(read_ahead->window > 0)
+  {
+    b32 hit = end <= read_ahead->advised_end;
+    if(hit) { ins_atomic_u64_inc_eval(&read_ahead->hit_count);  ins_atomic_u64_inc_eval(&ctx->read_ahead_hit_count); }
+    else    { ins_atomic_u64_inc_eval(&read_ahead->miss_count); ins_atomic_u64_inc_eval(&ctx->read_ahead_miss_count); }
+  }
+  read_ahead->sequential_count += 1;
+  read_ahead->next_offset       = Max(read_ahead->next_offset, end);
+
+  // A stream starts at the second consecutive read with a window of a few
+  // reads, doubling on every refill up to the configured maximum
+  if(read_ahead->sequential_count >= 2 && read_ahead->advised_end < end + read_ahead->window / 2)
+  {
+    u64 window_max = ctx->read_ahead_max;
+    if(read_ahead->window == 0) { read_ahead->window = Clamp(Min(READ_AHEAD_WINDOW_MIN, window_max), count * 4, window_max); }
+    else                        { read_ahead->window = Min(read_ahead->window * 2, window_max); }
+
+    result                  = rng_1u64(Max(read_ahead->advised_end, end), end + read_ahead->window);
+    read_ahead->advised_end = result.max;
+    ins_atomic_u64_add_eval(&read_ahead->advised_bytes, dim_1u64(result));
+    ins_atomic_u64_add_eval(&ctx->read_ahead_bytes, dim_1u64(result));
+  }
+  return result;
+}
+
+internal void
+fs9p_read_ahead_issue(FsHandle9P *handle, Rng1U64 range, b32 first)
+{
+  if(handle->tmp_node != 0 || handle->fd < 0 || dim_1u64(range) == 0) { return; }
+
+  // WILLNEED queues the reads and returns; SEQUENTIAL also widens the
+  // kernel's own read-ahead for the rest of the stream
+  if(first) { posix_fadvise(handle->fd, 0, 0, POSIX_FADV_SEQUENTIAL); }
+  posix_fadvise(handle->fd, range.min, dim_1u64(range), POSIX_FADV_WILLNEED);
+}
+
+internal s64
+fs9p_write_fd(FsHandle9P *handle)
+{
+  // Spliced writes land at an explicit offset, so append-only and non-regular
+  // files keep the buffered path
+  if(handle->tmp_node != 0 || handle->fd < 0 || handle->is_directory) { return -1; }
+
+  int flags = fcntl(handle->fd, F_GETFL);
+  if(flags < 0 || (flags & O_ACCMODE) == O_RDONLY || (flags & O_APPEND)) { return -1; }
+
+  struct stat st = {0};
+  if(fstat(handle->fd, &st) != 0 || !S_ISREG(st.st_mode)) { return -1; }
+  return handle->fd;
+}
+
+internal u64
+fs9p_write(FsHandle9P *handle, u64 offset, String8 data)
+{
+  if(handle->tmp_node != 0 && handle->ctx != 0) { return temp9p_write(handle->ctx, handle->tmp_node, offset, data); }
+  if(handle->fd < 0) { return 0; }
+
+  ssize_t bytes_written = pwrite(handle->fd, data.str, data.size, offset);
   if(bytes_written < 0) { return 0; }
+  fs9p_meta_cache_invalidate(handle->ctx->meta_cache, handle->path);
+  fs9p_content_cache_invalidate(handle->ctx->content_cache, handle->dev, handle->ino);
 
   return bytes_written;
 }
 
+// Caller serialises calls for one buffer. Small writes that continue the
+// buffered run are appended; anything else flushes it first. Under
+// SyncPolicy9P_Always every write goes straight to the file and is synced.
+internal u64
+fs9p_write_buffered(FsHandle9P *handle, WriteBuffer9P *buffer, u64 offset, String8 data)
+{
+  b32 coalesce = handle->tmp_node == 0 && handle->fd >= 0 && handle->is_regular &&
+                 handle->ctx->sync_policy != SyncPolicy9P_Always && data.size < buffer->capacity;
+  b32 contiguous = buffer->size > 0 && offset == buffer->offset + buffer->size && buffer->size + data.size <= buffer->capacity;
+  if(buffer->size > 0 && (!coalesce || !contiguous))
+  {
+    // A deferred write that fails is reported on the write that flushes it
+    if(!fs9p_write_flush(handle, buffer)) { return 0; }
+  }
+
+  if(!coalesce && handle->ctx->sync_policy == SyncPolicy9P_Always) { return fs9p_write_sync(handle, offset, data); }
+  if(!coalesce)
+  {
+    u64 bytes_written = fs9p_write(handle, offset, data);
+    if(bytes_written > 0) { buffer->dirty = 1; }
+    return bytes_written;
+  }
+
+  if(buffer->size == 0) { buffer->offset = offset; }
+  MemoryCopy(buffer->data + buffer->size, data.str, data.size);
+  buffer->size  += data.size;
+  buffer->dirty  = 1;
+  if(buffer->size == buffer->capacity && !fs9p_write_flush(handle, buffer)) { return 0; }
+  return data.size;
+}
+
 internal b32
-fs9p_create(FsContext9P *ctx, String8 path, u32 permissions, u32 mode)
+fs9p_write_flush(FsHandle9P *handle, WriteBuffer9P *buffer)
 {
-  if(ctx->backend == StorageBackend9P_ArenaTemp)
+  b32 result = 1;
+  for(u64 written = 0; written < buffer->size;)
   {
-    b32 result = 0;
-    MutexScope(ctx->tmp_mutex) { result = temp9p_create(ctx->tmp_arena, ctx, path, permissions); }
-    return result;
+    u64 n = fs9p_write(handle, buffer->offset + written, str8(buffer->data + written, buffer->size - written));
+    if(n == 0) { result = 0; break; }
+    written += n;
+  }
+  buffer->size = 0;
+  return result;
+}
+
+internal b32
+fs9p_sync(FsHandle9P *handle)
+{
+  if(handle->tmp_node != 0 || handle->fd < 0 || !handle->is_regular) { return 1; }
+  return fdatasync(handle->fd) == 0;
+}
+
+// Writes and syncs; returns 0 if either fails.
+internal u64
+fs9p_write_sync(FsHandle9P *handle, u64 offset, String8 data)
+{
+  IO_Ring *ring = io_ring_from_thread();
+  b32 queued    = ring != 0 && handle->tmp_node == 0 && handle->fd >= 0 && handle->is_regular && data.size <= max_u32 &&
+                  io_ring_push_write(ring, handle->fd, data.str, data.size, offset, 0);
+  if(!queued)
+  {
+    u64 bytes_written = fs9p_write(handle, offset, data);
+    if(bytes_written > 0 && !fs9p_sync(handle)) { return 0; }
+    return bytes_written;
   }
 
+  // The fdatasync is linked behind the write so both go down in one
+  // io_uring_enter; a short write cancels it and is synced separately
+  IO_Completion completions[2] = {0};
+  io_ring_link_last(ring);
+  u32 pushed_count             = io_ring_push_fdatasync(ring, handle->fd, 1) ? 2 : 1;
+  u32 reaped_count             = io_ring_wait(ring, completions, pushed_count);
+  s32 write_result             = -ECANCELED;
+  s32 sync_result              = -ECANCELED;
+  for(u32 i = 0; i < reaped_count; i += 1)
+  {
+    if(completions[i].user_data == 0) { write_result = completions[i].result; }
+    else                              { sync_result  = completions[i].result; }
+  }
+
+  // Kernels without these opcodes reject them at submission, and a refused
+  // io_uring_enter never started the write, so both go through syscalls
+  b32 unsupported = write_result == -EINVAL || write_result == -EOPNOTSUPP;
+  if(unsupported || reaped_count == 0)
+  {
+    u64 bytes_written = fs9p_write(handle, offset, data);
+    if(bytes_written > 0 && !fs9p_sync(handle)) { return 0; }
+    return bytes_written;
+  }
+  if(write_result <= 0) { return 0; }
+  fs9p_meta_cache_invalidate(handle->ctx->meta_cache, handle->path);
+  fs9p_content_cache_invalidate(handle->ctx->content_cache, handle->dev, handle->ino);
+  b32 sync_fallback = sync_result == -ECANCELED || sync_result == -EINVAL || sync_result == -EOPNOTSUPP;
+  if(sync_fallback && !fs9p_sync(handle)) { return 0; }
+  if(sync_result < 0 && !sync_fallback)   { return 0; }
+  return (u64)write_result;
+}
+
+internal b32
+fs9p_create(FsContext9P *ctx, String8 path, u32 permissions, u32 mode)
+{
+  if(ctx->backend == StorageBackend9P_ArenaTemp) { return temp9p_create(ctx, path, permissions); }
+
   Temp scratch    = scratch_begin(0, 0);
   String8 os_path = os_path_from_fs9p_path(scratch.arena, ctx, path);
   b32 result      = 0;
@@ -476,6 +826,7 @@ fs9p_create(FsContext9P *ctx, String8 path, u32 permissions, u32 mode)
       result = 1;
     }
   }
+  if(result) { fs9p_meta_cache_invalidate(ctx->meta_cache, path); }
 
   scratch_end(scratch);
   return result;
@@ -486,14 +837,23 @@ fs9p_remove(FsContext9P *ctx, String8 path)
 {
   if(ctx->backend == StorageBackend9P_ArenaTemp)
   {
-    MutexScope(ctx->tmp_mutex) { temp9p_remove(ctx, path); }
+    temp9p_remove(ctx, path);
     return;
   }
 
   Temp scratch    = scratch_begin(0, 0);
   String8 os_path = os_path_from_fs9p_path(scratch.arena, ctx, path);
 
+  // Idle cached descriptors would otherwise keep the unlinked file's blocks
+  struct stat st = {0};
+  if((ctx->fd_cache != 0 || ctx->content_cache != 0) && stat((char *)os_path.str, &st) == 0)
+  {
+    if(ctx->fd_cache != 0) { fs9p_fd_cache_forget(ctx->fd_cache, &st); }
+    fs9p_content_cache_invalidate(ctx->content_cache, st.st_dev, st.st_ino);
+  }
+
   if(unlink((char *)os_path.str) != 0) { rmdir((char *)os_path.str); }
+  fs9p_meta_cache_invalidate(ctx->meta_cache, path);
   scratch_end(scratch);
 }
 
@@ -503,22 +863,30 @@ fs9p_remove(FsContext9P *ctx, String8 path)
 internal Dir9P
 fs9p_stat(Arena *arena, FsContext9P *ctx, String8 path)
 {
-  if(ctx->backend == StorageBackend9P_ArenaTemp)
-  {
-    Dir9P result = {0};
-    MutexScope(ctx->tmp_mutex)
-    {
-      TempNode9P *node = temp9p_node_lookup(ctx->tmp_root, path);
-      result = temp9p_stat(arena, node);
-    }
-    return result;
-  }
+  if(ctx->backend == StorageBackend9P_ArenaTemp) { return temp9p_stat(arena, ctx, path); }
+
+  // Cached entries are encoded Rstat payloads, invalidated by inotify and local writes
+  MetaCache9P *cache = ctx->meta_cache;
+  String8 cached     = str8_zero();
+  if(cache != 0 && fs9p_meta_cache_lookup(cache, arena, path, &cached)) { return dir9p_from_str8(arena, cached); }
+  u64 generation     = (cache != 0) ? fs9p_meta_cache_prepare(cache, path) : 0;
 
   Dir9P       dir     = dir9p_zero();
   String8     os_path = os_path_from_fs9p_path(arena, ctx, path);
   struct stat st      = {0};
 
   if(stat((char *)os_path.str, &st) != 0) { return dir; }
+
+  // A directory's own mtime moves with entries its parent's watch never
+  // sees, so it is also watched itself; a new watch may have missed a change
+  // made before it existed, which the second stat picks up
+  if(cache != 0 && path.size > 0 && S_ISDIR(st.st_mode))
+  {
+    b32 added          = 0;
+    u64 dir_generation = fs9p_meta_cache_watch(cache, path, &added);
+    if(dir_generation == max_u64)                    { generation = max_u64; }
+    if(added && stat((char *)os_path.str, &st) != 0) { return dir; }
+  }
   dir.length         = st.st_size;
   dir.qid.path       = st.st_ino;
   dir.qid.version    = st.st_mtime;
@@ -530,21 +898,20 @@ fs9p_stat(Arena *arena, FsContext9P *ctx, String8 path)
   dir.group_id       = str8_from_gid(arena, ctx, st.st_gid);
   dir.modify_user_id = dir.user_id;
   dir.name           = fs9p_basename(arena, path);
+
+  if(cache != 0)
+  {
+    Temp scratch = scratch_begin(&arena, 1);
+    fs9p_meta_cache_store(cache, path, str8_from_dir9p(scratch.arena, dir), generation);
+    scratch_end(scratch);
+  }
   return dir;
 }
 
 internal b32
 fs9p_wstat(FsContext9P *ctx, String8 path, Dir9P *dir)
 {
-  if(ctx->backend == StorageBackend9P_ArenaTemp)
-  {
-    MutexScope(ctx->tmp_mutex)
-    {
-      TempNode9P *node = temp9p_node_lookup(ctx->tmp_root, path);
-      temp9p_wstat(ctx->tmp_arena, node, dir);
-    }
-    return 1;
-  }
+  if(ctx->backend == StorageBackend9P_ArenaTemp) { return temp9p_wstat(ctx, path, dir); }
 
   Temp scratch    = scratch_begin(0, 0);
   String8 os_path = os_path_from_fs9p_path(scratch.arena, ctx, path);
@@ -559,6 +926,10 @@ fs9p_wstat(FsContext9P *ctx, String8 path, Dir9P *dir)
   if(dir->length != max_u64)
   {
     if(truncate((char *)os_path.str, (off_t)dir->length) != 0) { success = 0; }
+
+    // Fids reading a cached copy of the file fall back to it at once
+    struct stat st = {0};
+    if(ctx->content_cache != 0 && stat((char *)os_path.str, &st) == 0) { fs9p_content_cache_invalidate(ctx->content_cache, st.st_dev, st.st_ino); }
   }
 
   if(dir->name.size > 0)
@@ -570,7 +941,7 @@ fs9p_wstat(FsContext9P *ctx, String8 path, Dir9P *dir)
       String8 new_relative_path = fs9p_path_join(scratch.arena, parent_path, dir->name);
       String8 new_os_path       = os_path_from_fs9p_path(scratch.arena, ctx, new_relative_path);
       if(rename((char *)os_path.str, (char *)new_os_path.str) != 0) { success = 0; }
-      else                                                          { os_path = new_os_path; }
+      else                                                          { os_path = new_os_path; fs9p_meta_cache_clear(ctx->meta_cache); }
     }
   }
 
@@ -669,6 +1040,7 @@ fs9p_wstat(FsContext9P *ctx, String8 path, Dir9P *dir)
   {
     if(chown((char *)os_path.str, uid, gid) != 0) { success = 0; }
   }
+  fs9p_meta_cache_invalidate(ctx->meta_cache, path);
 
   scratch_end(scratch);
   return success;
@@ -677,283 +1049,1245 @@ fs9p_wstat(FsContext9P *ctx, String8 path, Dir9P *dir)
 ////////////////////////////////
 //~ Directory Operations
 
+// The iterator refers to path rather than copying it, so the caller keeps
+// path alive until fs9p_closedir.
 internal b32
 fs9p_opendir(FsContext9P *ctx, String8 path, DirIterator9P *iter)
 {
-  Assert(path.size <= sizeof(iter->path_buffer));
-  MemoryCopy(iter->path_buffer, path.str, path.size);
-  iter->path_len = path.size;
+  iter->path       = path;
+  iter->position   = 0;
+  iter->cookie     = 0;
+  iter->tmp_cursor = 0;
 
   if(ctx->backend == StorageBackend9P_ArenaTemp)
   {
-    MutexScope(ctx->tmp_mutex)
+    iter->ctx      = ctx;
+    iter->tmp_node = temp9p_open(ctx, path, 0);
+    if(iter->tmp_node != 0 && !iter->tmp_node->is_directory)
     {
-      TempNode9P *node    = temp9p_node_lookup(ctx->tmp_root, path);
-      if(node != 0 && node->is_directory)
-      {
-        iter->tmp_node    = node;
-        iter->tmp_current = node->first_child;
-      }
+      temp9p_close(ctx, iter->tmp_node);
+      iter->tmp_node = 0;
     }
-    return 1;
+    return iter->tmp_node != 0;
   }
 
-  Temp    scratch  = scratch_begin(0, 0);
-  String8 os_path  = os_path_from_fs9p_path(scratch.arena, ctx, path);
-  DIR *dir         = opendir((char *)os_path.str);
+  // Opened beneath the root so a directory swapped for a symlink after the
+  // walk is refused rather than followed out of the export
+  DIR *dir = 0;
+  if(ctx->root_fd >= 0)
+  {
+    int dir_fd = fs9p_openat_beneath(ctx->root_fd, path, O_RDONLY | O_DIRECTORY);
+    if(dir_fd >= 0)
+    {
+      dir = fdopendir(dir_fd);
+      if(dir == 0) { close(dir_fd); }
+    }
+  }
+  else
+  {
+    Temp    scratch = scratch_begin(0, 0);
+    String8 os_path = os_path_from_fs9p_path(scratch.arena, ctx, path);
+    dir             = opendir((char *)os_path.str);
+    scratch_end(scratch);
+  }
   iter->dir_handle = dir;
-
-  scratch_end(scratch);
   return dir != 0;
 }
 
-internal String8
-fs9p_readdir(Arena *result_arena, Arena *cache_arena, FsContext9P *ctx, DirIterator9P *iter, String8 *cache, u64 offset,
-             u64 count)
+internal void
+fs9p_stat_batch_run(DirStatBatch9P *batch)
 {
-  if(iter->tmp_node != 0)
+  for(;;)
   {
-    String8 result = str8_zero();
-    MutexScope(ctx->tmp_mutex) { result = temp9p_readdir(result_arena, iter->tmp_node, &iter->tmp_current, offset, count); }
-    return result;
+    u64 idx = ins_atomic_u64_inc_eval(&batch->next_idx) - 1;
+    if(idx >= batch->entry_count) { break; }
+
+    DirStatEntry9P *entry = &batch->entries[idx];
+    if(!entry->skip && entry->encoded.size == 0)
+    {
+      entry->stat_ok = statx(batch->dir_fd, (char *)entry->name.str, AT_STATX_DONT_SYNC, DIR_STAT_MASK, &entry->st) == 0;
+    }
+    // Only pooled batches have a waiter; in-place ones carry no context
+    if(ins_atomic_u64_inc_eval(&batch->done_count) == batch->entry_count && batch->ctx != 0)
+    {
+      MutexScope(batch->mutex) { cond_var_broadcast(batch->done_cond); }
+    }
   }
-  if(iter->dir_handle == 0) { return str8_zero(); }
+}
 
-  if(cache->size == 0)
+internal void
+fs9p_stat_batch_release(DirStatBatch9P *batch)
+{
+  if(ins_atomic_u64_dec_eval(&batch->ref_count) == 0)
   {
-    Temp scratch = scratch_begin(&cache_arena, 1);
-    DIR *dir     = iter->dir_handle;
-    int dir_fd   = dirfd(dir);
-    rewinddir(dir);
+    FsContext9P *ctx = batch->ctx;
+    MutexScope(ctx->stat_batch_mutex) { SLLStackPush_N(ctx->stat_batch_free_list, batch, free_next); }
+  }
+}
 
-    u64 encode_buffer_cap  = P9_DIR_ENTRY_MAX;
-    u8 *encode_buffer      = push_array(scratch.arena, u8, encode_buffer_cap);
-    u64 encode_buffer_size = 0;
+internal void
+fs9p_stat_batch_task(void *params)
+{
+  DirStatBatch9P *batch = *(DirStatBatch9P **)params;
+  fs9p_stat_batch_run(batch);
+  fs9p_stat_batch_release(batch);
+}
 
-    u8 dents_buffer[KB(32)];
-    for(;;)
+internal b32
+fs9p_stat_entries_ring(IO_Ring *ring, int dir_fd, DirStatEntry9P *entries, u64 entry_count)
+{
+  // Entries go in slices no longer than the ring so completions never overflow
+  Temp scratch               = scratch_begin(0, 0);
+  IO_Completion *completions = push_array_no_zero(scratch.arena, IO_Completion, IO_RING_ENTRY_COUNT);
+  b32 result                 = 1;
+  for(u64 first = 0; first < entry_count && result;)
+  {
+    u64 last         = Min(entry_count, first + Min(ring->sq_entry_count, IO_RING_ENTRY_COUNT));
+    u32 pushed_count = 0;
+    for(u64 idx = first; idx < last; idx += 1)
     {
-      long nread = syscall(SYS_getdents64, dir_fd, dents_buffer, sizeof(dents_buffer));
-      if(nread <= 0) { break; }
-
-      for(u64 pos = 0; pos < (u64)nread;)
+      DirStatEntry9P *entry = &entries[idx];
+      if(entry->skip || entry->encoded.size != 0) { continue; }
+      if(!io_ring_push_statx(ring, dir_fd, (char *)entry->name.str, AT_STATX_DONT_SYNC, DIR_STAT_MASK, &entry->st, idx))
       {
-        LinuxDirEnt64 *entry = (LinuxDirEnt64 *)(dents_buffer + pos);
-        pos += entry->d_reclen;
-
-        String8 entry_name = str8_cstring(entry->d_name);
-        if(str8_match(entry_name, str8_lit("."), 0) || str8_match(entry_name, str8_lit(".."), 0)) { continue; }
-
-        struct stat entry_stat = {0};
-        b32 stat_success       = 0;
-        b32 d_type_valid       = (entry->d_type != DT_UNKNOWN);
-        b32 is_directory       = (entry->d_type == DT_DIR);
-        u64 entry_ino          = entry->d_ino;
-
-        if(dir_fd >= 0)
-        {
-          if(fstatat(dir_fd, (char *)entry_name.str, &entry_stat, 0) == 0) { stat_success = 1; }
-        }
-
-        if(!stat_success)
-        {
-          String8 entry_path    = fs9p_path_join(scratch.arena, str8(iter->path_buffer, iter->path_len), entry_name);
-          String8 entry_os_path = os_path_from_fs9p_path(scratch.arena, ctx, entry_path);
-          if(stat((char *)entry_os_path.str, &entry_stat) == 0) { stat_success = 1; }
-        }
-        if(!stat_success) { continue; }
-
-        b32 is_dir               = d_type_valid ? is_directory : S_ISDIR(entry_stat.st_mode);
-        Dir9P entry_dir          = dir9p_zero();
-        entry_dir.length         = entry_stat.st_size;
-        entry_dir.qid.path       = entry_ino;
-        entry_dir.qid.version    = entry_stat.st_mtime;
-        entry_dir.qid.type       = is_dir ? QidTypeFlag_Directory : QidTypeFlag_File;
-        entry_dir.mode           = (entry_stat.st_mode & 0777) | (is_dir ? P9_ModeFlag_Directory : 0);
-        entry_dir.access_time    = entry_stat.st_atime;
-        entry_dir.modify_time    = entry_stat.st_mtime;
-        entry_dir.user_id        = str8_from_uid(scratch.arena, ctx, entry_stat.st_uid);
-        entry_dir.group_id       = str8_from_gid(scratch.arena, ctx, entry_stat.st_gid);
-        entry_dir.modify_user_id = entry_dir.user_id;
-        entry_dir.name           = entry_name;
-
-        String8 encoded_entry   = str8_from_dir9p(scratch.arena, entry_dir);
-        if(encode_buffer_size + encoded_entry.size > encode_buffer_cap)
-        {
-          u64 new_encode_cap    = encode_buffer_cap * 2;
-          for(; encode_buffer_size + encoded_entry.size > new_encode_cap; new_encode_cap *= 2);
-          u8 *new_encode_buffer = push_array(scratch.arena, u8, new_encode_cap);
-          MemoryCopy(new_encode_buffer, encode_buffer, encode_buffer_size);
-          encode_buffer         = new_encode_buffer;
-          encode_buffer_cap     = new_encode_cap;
-        }
-
-        MemoryCopy(encode_buffer + encode_buffer_size, encoded_entry.str, encoded_entry.size);
-        encode_buffer_size     += encoded_entry.size;
+        result = 0;
+        break;
       }
+      pushed_count += 1;
     }
 
-    *cache = str8_copy(cache_arena, str8(encode_buffer, encode_buffer_size));
-    scratch_end(scratch);
+    // Whatever was queued has completed or been withdrawn once this returns;
+    // kernels without statx in io_uring reject every entry, and those are
+    // restatted through syscalls rather than reported missing
+    u32 reaped_count = io_ring_wait(ring, completions, pushed_count);
+    for(u32 i = 0; i < reaped_count; i += 1)
+    {
+      s32 stat_result = completions[i].result;
+      if(stat_result == -EINVAL || stat_result == -EOPNOTSUPP) { result = 0; }
+      entries[completions[i].user_data].stat_ok = stat_result == 0;
+    }
+    if(reaped_count != pushed_count) { result = 0; }
+    first = last;
   }
-
-  if(offset >= cache->size) { return str8_zero(); }
-  u64 bytes_available = cache->size - offset;
-  u64 bytes_to_read   = Min(bytes_available, count);
-  return str8_copy(result_arena, str8(cache->str + offset, bytes_to_read));
+  scratch_end(scratch);
+  return result;
 }
 
 internal void
-fs9p_closedir(DirIterator9P *iter)
+fs9p_stat_entries(FsContext9P *ctx, int dir_fd, DirStatEntry9P *entries, u64 entry_count)
 {
-  if(iter->dir_handle != 0)
+  u64 helper_count = 0;
+  if(ctx->stat_pool != 0 && ctx->stat_parallel_min > 0)
   {
-    closedir(iter->dir_handle);
-    iter->dir_handle = 0;
+    helper_count = Min(ctx->stat_pool->worker_count, entry_count / ctx->stat_parallel_min);
   }
-}
 
-////////////////////////////////
-//~ Temporary Storage Helpers
-
-internal TempNode9P *
-temp9p_node_lookup(TempNode9P *root, String8 path)
-{
-  if(path.size == 0 || str8_match(path, str8_lit("."), 0)) { return root; }
-
-  TempNode9P *node = root;
-  for(u64 path_pos = 0; path_pos < path.size && node != 0;)
+  DirStatBatch9P *batch = 0;
+  if(helper_count > 0)
   {
-    u64 component_end = path_pos;
-    for(; component_end < path.size && path.str[component_end] != '/'; component_end += 1);
-
-    String8 component = str8(path.str + path_pos, component_end - path_pos);
-    b32     found     = 0;
-
-    for(TempNode9P *child = node->first_child; child != 0; child = child->next_sibling)
+    MutexScope(ctx->stat_batch_mutex)
     {
-      if(str8_match(child->name, component, 0))
+      batch = ctx->stat_batch_free_list;
+      if(batch != 0) { SLLStackPop_N(ctx->stat_batch_free_list, free_next); }
+      else
       {
-        node  = child;
-        found = 1;
-        break;
+        batch            = push_array(ctx->stat_batch_arena, DirStatBatch9P, 1);
+        batch->ctx       = ctx;
+        batch->mutex     = mutex_alloc();
+        batch->done_cond = cond_var_alloc();
       }
     }
+  }
 
-    if(!found) { return 0; }
-    path_pos = component_end;
-    if(path_pos < path.size && path.str[path_pos] == '/') { path_pos += 1; }
+  // Small batches and servers without a pool stat in place, through the
+  // thread's ring when there is one so a batch costs one io_uring_enter
+  if(batch == 0)
+  {
+    IO_Ring *ring = io_ring_from_thread();
+    if(ring != 0 && fs9p_stat_entries_ring(ring, dir_fd, entries, entry_count)) { return; }
+
+    DirStatBatch9P local = {0};
+    local.dir_fd         = dir_fd;
+    local.entries        = entries;
+    local.entry_count    = entry_count;
+    fs9p_stat_batch_run(&local);
+    return;
   }
 
-  return node;
+  // The caller claims entries alongside its helpers, so a saturated pool only
+  // costs parallelism; helpers that start late find nothing left and just drop
+  // their reference, which is why the batch header outlives this call
+  batch->dir_fd      = dir_fd;
+  batch->entries     = entries;
+  batch->entry_count = entry_count;
+  batch->next_idx    = 0;
+  batch->done_count  = 0;
+  batch->ref_count   = helper_count + 1;
+  for(u64 i = 0; i < helper_count; i += 1)
+  {
+    wp_submit(ctx->stat_pool, fs9p_stat_batch_task, &batch, sizeof(batch));
+  }
+  fs9p_stat_batch_run(batch);
+  MutexScope(batch->mutex)
+  {
+    for(; ins_atomic_u64_eval(&batch->done_count) < entry_count;) { cond_var_wait(batch->done_cond, batch->mutex); }
+  }
+  fs9p_stat_batch_release(batch);
 }
 
-internal TempNode9P *
-temp9p_node_create(Arena *arena, FsContext9P *ctx, String8 path, String8 name, b32 is_dir, u32 mode)
-{
-  TempNode9P *node    = push_array(arena, TempNode9P, 1);
-  node->path          = str8_copy(arena, path);
-  node->name          = str8_copy(arena, name);
-  node->content       = str8_zero();
-  node->user_id       = str8_lit("nobody");
-  node->group_id      = str8_lit("nobody");
-  node->qid.path      = ctx->tmp_qid_count;
-  ctx->tmp_qid_count += 1;
-  node->qid.type      = is_dir ? QidTypeFlag_Directory : QidTypeFlag_File;
-  node->mode          = mode;
-  node->access_time   = os_now_unix();
-  node->modify_time   = node->access_time;
-  node->is_directory  = is_dir;
+internal String8
+fs9p_readdir(Arena *arena, FsContext9P *ctx, DirIterator9P *iter, u64 offset, u64 count)
+{
+  if(iter->tmp_node != 0) { return temp9p_readdir(arena, ctx, iter, offset, count); }
+  if(iter->dir_handle == 0) { return str8_zero(); }
 
-  return node;
+  // Sequential reads resume at the saved getdents cookie; any other offset
+  // replays the listing from the start
+  int dir_fd = dirfd(iter->dir_handle);
+  if(offset == 0 || offset < iter->position)
+  {
+    iter->position = 0;
+    iter->cookie   = 0;
+  }
+
+  MetaCache9P *meta_cache = ctx->meta_cache;
+  String8 dir_path        = iter->path;
+  u8 *result_buffer       = push_array_no_zero(arena, u8, count);
+  u64 result_size         = 0;
+  b32 done                = 0;
+  Temp scratch            = scratch_begin(&arena, 1);
+  u8 dents_buffer[KB(32)];
+  for(; !done;)
+  {
+    temp_end(scratch);
+    if(lseek(dir_fd, iter->cookie, SEEK_SET) < 0) { break; }
+    long nread = syscall(SYS_getdents64, dir_fd, dents_buffer, sizeof(dents_buffer));
+    if(nread <= 0) { break; }
+
+    //- collect as many entries as could possibly fit in the reply
+    u64 room                = (offset > iter->position ? offset - iter->position : 0) + (count - result_size);
+    u64 estimate            = 0;
+    u64 entry_cap           = (u64)nread / (sizeof(LinuxDirEnt64) + 1) + 1;
+    u64 entry_count         = 0;
+    DirStatEntry9P *entries = push_array(scratch.arena, DirStatEntry9P, entry_cap);
+    for(u64 pos = 0; pos < (u64)nread && entry_count < entry_cap;)
+    {
+      LinuxDirEnt64 *dirent = (LinuxDirEnt64 *)(dents_buffer + pos);
+      pos += dirent->d_reclen;
+
+      DirStatEntry9P *entry = &entries[entry_count];
+      entry->name           = str8_cstring(dirent->d_name);
+      entry->next_cookie    = dirent->d_off;
+      entry->skip           = str8_match(entry->name, str8_lit("."), 0) || str8_match(entry->name, str8_lit(".."), 0);
+      if(!entry->skip)
+      {
+        estimate += P9_STAT_DATA_FIXED_SIZE + 4 * P9_STRING8_SIZE_FIELD_SIZE + entry->name.size;
+        if(estimate > room && entry_count > 0) { break; }
+      }
+      entry_count += 1;
+    }
+
+    //- reuse cached Rstat payloads, stat the rest
+    u64 generation = 0;
+    if(meta_cache != 0)
+    {
+      // Every entry is watched through this directory, so one prepare covers the batch
+      generation = fs9p_meta_cache_prepare(meta_cache, fs9p_path_join(scratch.arena, dir_path, str8_lit(".")));
+      for(u64 i = 0; i < entry_count; i += 1)
+      {
+        if(entries[i].skip) { continue; }
+        String8 entry_path = fs9p_path_join(scratch.arena, dir_path, entries[i].name);
+        fs9p_meta_cache_lookup(meta_cache, scratch.arena, entry_path, &entries[i].encoded);
+      }
+    }
+    fs9p_stat_entries(ctx, dir_fd, entries, entry_count);
+
+    //- encode in order until the reply is full
+    for(u64 i = 0; i < entry_count; i += 1)
+    {
+      DirStatEntry9P *entry = &entries[i];
+      if(!entry->skip && entry->encoded.size == 0 && entry->stat_ok)
+      {
+        // Typed from the followed statx like fs9p_stat, since the encoding is
+        // cached under the entry's path; d_type would call a symlink a file
+        b32 is_dir               = S_ISDIR(entry->st.stx_mode);
+        Dir9P entry_dir          = dir9p_zero();
+        entry_dir.length         = entry->st.stx_size;
+        entry_dir.qid.path       = entry->st.stx_ino;
+        entry_dir.qid.version    = entry->st.stx_mtime.tv_sec;
+        entry_dir.qid.type       = is_dir ? QidTypeFlag_Directory : QidTypeFlag_File;
+        entry_dir.mode           = (entry->st.stx_mode & 0777) | (is_dir ? P9_ModeFlag_Directory : 0);
+        entry_dir.access_time    = entry->st.stx_atime.tv_sec;
+        entry_dir.modify_time    = entry->st.stx_mtime.tv_sec;
+        entry_dir.user_id        = str8_from_uid(scratch.arena, ctx, entry->st.stx_uid);
+        entry_dir.group_id       = str8_from_gid(scratch.arena, ctx, entry->st.stx_gid);
+        entry_dir.modify_user_id = entry_dir.user_id;
+        entry_dir.name           = entry->name;
+        entry->encoded           = str8_from_dir9p(scratch.arena, entry_dir);
+        // Subdirectories are cached by fs9p_stat, which also watches them
+        if(meta_cache != 0 && !is_dir)
+        {
+          String8 entry_path = fs9p_path_join(scratch.arena, dir_path, entry->name);
+          fs9p_meta_cache_store(meta_cache, entry_path, entry->encoded, generation);
+        }
+      }
+
+      if(entry->encoded.size > 0)
+      {
+        if(iter->position + entry->encoded.size <= offset)
+        {
+          iter->position += entry->encoded.size;
+        }
+        else if(result_size + entry->encoded.size > count)
+        {
+          done = 1;
+          break;
+        }
+        else
+        {
+          MemoryCopy(result_buffer + result_size, entry->encoded.str, entry->encoded.size);
+          result_size    += entry->encoded.size;
+          iter->position += entry->encoded.size;
+        }
+      }
+      iter->cookie = entry->next_cookie;
+    }
+  }
+  scratch_end(scratch);
+
+  return str8(result_buffer, result_size);
+}
+
+internal void
+fs9p_closedir(DirIterator9P *iter)
+{
+  if(iter->tmp_cursor != 0)
+  {
+    temp9p_node_release(iter->ctx, iter->tmp_cursor);
+    iter->tmp_cursor = 0;
+  }
+  if(iter->tmp_node != 0)
+  {
+    temp9p_close(iter->ctx, iter->tmp_node);
+    iter->tmp_node = 0;
+  }
+  if(iter->dir_handle != 0)
+  {
+    closedir(iter->dir_handle);
+    iter->dir_handle = 0;
+  }
+}
+
+////////////////////////////////
+//~ Metadata Cache
+
+internal String8
+fs9p_meta_cache_parent(String8 path)
+{
+  u64 slash = str8_find_needle_reverse(path, 0, str8_lit("/"), 0);
+  return slash > 0 ? str8_prefix(path, slash - 1) : str8_zero();
+}
+
+internal MetaCacheEntry9P **
+fs9p_meta_cache_slot__locked(MetaCache9P *cache, String8 path)
+{
+  MetaCacheEntry9P **slot = &cache->slots[u64_hash_from_str8(path) % META_CACHE_SLOT_COUNT];
+  for(; *slot != 0 && !str8_match((*slot)->path, path, 0); slot = &(*slot)->hash_next) {}
+  return slot;
+}
+
+internal MetaCacheWatch9P *
+fs9p_meta_cache_watch_from_path__locked(MetaCache9P *cache, String8 path)
+{
+  MetaCacheWatch9P *watch = cache->watch_path_slots[u64_hash_from_str8(path) % META_CACHE_WATCH_SLOT_COUNT];
+  for(; watch != 0 && !str8_match(watch->path, path, 0); watch = watch->path_next) {}
+  return watch;
+}
+
+internal MetaCacheWatch9P *
+fs9p_meta_cache_watch_from_descriptor__locked(MetaCache9P *cache, int watch_descriptor)
+{
+  MetaCacheWatch9P *watch = cache->watch_slots[(u64)watch_descriptor % META_CACHE_WATCH_SLOT_COUNT];
+  for(; watch != 0 && watch->watch_descriptor != watch_descriptor; watch = watch->hash_next) {}
+  return watch;
+}
+
+internal void
+fs9p_meta_cache_reset__locked(MetaCache9P *cache)
+{
+  arena_clear(cache->arena);
+  cache->slots        = push_array(cache->arena, MetaCacheEntry9P *, META_CACHE_SLOT_COUNT);
+  cache->entry_count  = 0;
+  cache->generation  += 1;
+  cache->clear_count += 1;
+}
+
+internal void
+fs9p_meta_cache_reset_watches__locked(MetaCache9P *cache)
+{
+  for(u64 i = 0; cache->watch_slots != 0 && i < META_CACHE_WATCH_SLOT_COUNT; i += 1)
+  {
+    for(MetaCacheWatch9P *watch = cache->watch_slots[i]; watch != 0; watch = watch->hash_next)
+    {
+      inotify_rm_watch(cache->inotify_fd, watch->watch_descriptor);
+    }
+  }
+  arena_clear(cache->watch_arena);
+  cache->watch_slots      = push_array(cache->watch_arena, MetaCacheWatch9P *, META_CACHE_WATCH_SLOT_COUNT);
+  cache->watch_path_slots = push_array(cache->watch_arena, MetaCacheWatch9P *, META_CACHE_WATCH_SLOT_COUNT);
+}
+
+internal void
+fs9p_meta_cache_invalidate__locked(MetaCache9P *cache, String8 path)
+{
+  // A child's change also moves its directory's mtime
+  String8 paths[2] = {path, fs9p_meta_cache_parent(path)};
+  u64 path_count   = path.size > 0 ? 2 : 1;
+  for(u64 i = 0; i < path_count; i += 1)
+  {
+    MetaCacheEntry9P **slot = fs9p_meta_cache_slot__locked(cache, paths[i]);
+    if(*slot != 0)
+    {
+      *slot               = (*slot)->hash_next;
+      cache->entry_count -= 1;
+    }
+  }
+  cache->generation         += 1;
+  cache->invalidation_count += 1;
+}
+
+internal void
+fs9p_meta_cache_thread_entry_point(void *ptr)
+{
+  MetaCache9P *cache = (MetaCache9P *)ptr;
+  u8 buffer[KB(16)] __attribute__((aligned(__alignof__(struct inotify_event))));
+  for(;;)
+  {
+    ssize_t read_result = read(cache->inotify_fd, buffer, sizeof(buffer));
+    if(read_result < 0 && errno == EINTR) { continue; }
+    if(read_result <= 0)                  { break; }
+
+    Temp scratch = scratch_begin(0, 0);
+    MutexScopeW(cache->rw_mutex)
+    {
+      for(u64 pos = 0; pos < (u64)read_result;)
+      {
+        struct inotify_event *event = (struct inotify_event *)(buffer + pos);
+        pos += sizeof(struct inotify_event) + event->len;
+
+        // Lost events or a moved/deleted directory leave paths we cannot map; start over
+        b32 dir_moved = (event->mask & IN_ISDIR) && (event->mask & (IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE));
+        if((event->mask & IN_Q_OVERFLOW) || dir_moved || (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF)))
+        {
+          fs9p_meta_cache_reset__locked(cache);
+          fs9p_meta_cache_reset_watches__locked(cache);
+          continue;
+        }
+
+        MetaCacheWatch9P *watch = fs9p_meta_cache_watch_from_descriptor__locked(cache, event->wd);
+        if(watch == 0 || (event->mask & IN_IGNORED)) { continue; }
+
+        String8 name = event->len > 0 ? str8_cstring(event->name) : str8_zero();
+        String8 path = name.size > 0 ? fs9p_path_join(scratch.arena, watch->path, name) : watch->path;
+        fs9p_meta_cache_invalidate__locked(cache, path);
+      }
+    }
+    scratch_end(scratch);
+  }
+}
+
+internal MetaCache9P *
+fs9p_meta_cache_alloc(Arena *arena, String8 root_path, u64 budget)
+{
+  int inotify_fd = inotify_init1(IN_CLOEXEC);
+  if(inotify_fd < 0) { return 0; }
+
+  MetaCache9P *cache = push_array(arena, MetaCache9P, 1);
+  cache->rw_mutex    = rw_mutex_alloc();
+  cache->arena       = arena_alloc();
+  cache->watch_arena = arena_alloc();
+  cache->budget      = budget;
+  cache->root_path   = str8_copy(arena, root_path);
+  cache->inotify_fd  = inotify_fd;
+  fs9p_meta_cache_reset__locked(cache);
+  fs9p_meta_cache_reset_watches__locked(cache);
+  cache->clear_count = 0;
+
+  Thread thread = thread_launch(fs9p_meta_cache_thread_entry_point, cache);
+  thread_detach(thread);
+  return cache;
+}
+
+// Returns the generation to store under, or max_u64 if the directory cannot
+// be watched; added_out reports a watch that did not exist before the call.
+internal u64
+fs9p_meta_cache_watch(MetaCache9P *cache, String8 watch_path, b32 *added_out)
+{
+  u64 result  = max_u64;
+  b32 watched = 0;
+  if(added_out != 0) { *added_out = 0; }
+  MutexScopeR(cache->rw_mutex)
+  {
+    watched = fs9p_meta_cache_watch_from_path__locked(cache, watch_path) != 0;
+    result  = cache->generation;
+  }
+  if(watched) { return result; }
+
+  Temp scratch    = scratch_begin(0, 0);
+  String8 os_path = fs9p_path_join(scratch.arena, cache->root_path, watch_path);
+  MutexScopeW(cache->rw_mutex)
+  {
+    result = max_u64;
+    int watch_descriptor = inotify_add_watch(cache->inotify_fd, (char *)os_path.str,
+                                             IN_ATTRIB | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                             IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK);
+    if(watch_descriptor >= 0)
+    {
+      MetaCacheWatch9P *watch = fs9p_meta_cache_watch_from_descriptor__locked(cache, watch_descriptor);
+      if(watch == 0)
+      {
+        watch                   = push_array(cache->watch_arena, MetaCacheWatch9P, 1);
+        watch->watch_descriptor = watch_descriptor;
+        watch->path             = str8_copy(cache->watch_arena, watch_path);
+        SLLStackPush_N(cache->watch_slots[(u64)watch_descriptor % META_CACHE_WATCH_SLOT_COUNT], watch, hash_next);
+        SLLStackPush_N(cache->watch_path_slots[u64_hash_from_str8(watch->path) % META_CACHE_WATCH_SLOT_COUNT], watch, path_next);
+        if(added_out != 0) { *added_out = 1; }
+      }
+      result = cache->generation;
+    }
+  }
+  scratch_end(scratch);
+  return result;
+}
+
+internal u64
+fs9p_meta_cache_prepare(MetaCache9P *cache, String8 path)
+{
+  // Children report through their directory's watch, the root through its own
+  String8 watch_path = (path.size == 0) ? path : fs9p_meta_cache_parent(path);
+  return fs9p_meta_cache_watch(cache, watch_path, 0);
+}
+
+internal b32
+fs9p_meta_cache_lookup(MetaCache9P *cache, Arena *arena, String8 path, String8 *data_out)
+{
+  b32 result = 0;
+  MutexScopeR(cache->rw_mutex)
+  {
+    MetaCacheEntry9P *entry = *fs9p_meta_cache_slot__locked(cache, path);
+    if(entry != 0)
+    {
+      *data_out = str8_copy(arena, entry->stat_data);
+      result    = 1;
+    }
+  }
+  if(result) { ins_atomic_u64_inc_eval(&cache->hit_count); }
+  else       { ins_atomic_u64_inc_eval(&cache->miss_count); }
+  return result;
+}
+
+internal void
+fs9p_meta_cache_store(MetaCache9P *cache, String8 path, String8 data, u64 generation)
+{
+  if(generation == max_u64) { return; }
+  MutexScopeW(cache->rw_mutex)
+  {
+    // Anything invalidated since the caller read the file system may be stale
+    if(generation == cache->generation)
+    {
+      if(arena_pos(cache->arena) + path.size + data.size > cache->budget) { fs9p_meta_cache_reset__locked(cache); }
+
+      MetaCacheEntry9P **slot = fs9p_meta_cache_slot__locked(cache, path);
+      MetaCacheEntry9P *entry = *slot;
+      if(entry == 0)
+      {
+        entry       = push_array(cache->arena, MetaCacheEntry9P, 1);
+        entry->path = str8_copy(cache->arena, path);
+        *slot       = entry;
+        cache->entry_count += 1;
+      }
+      entry->stat_data = str8_copy(cache->arena, data);
+    }
+  }
+}
+
+internal void
+fs9p_meta_cache_invalidate(MetaCache9P *cache, String8 path)
+{
+  if(cache == 0) { return; }
+  MutexScopeW(cache->rw_mutex) { fs9p_meta_cache_invalidate__locked(cache, path); }
+}
+
+internal void
+fs9p_meta_cache_clear(MetaCache9P *cache)
+{
+  if(cache == 0) { return; }
+  MutexScopeW(cache->rw_mutex) { fs9p_meta_cache_reset__locked(cache); }
+}
+
+////////////////////////////////
+//~ Descriptor Cache
+
+internal FdCache9P *
+fs9p_fd_cache_alloc(Arena *arena, u64 capacity)
+{
+  FdCache9P *cache = push_array(arena, FdCache9P, 1);
+  cache->mutex     = mutex_alloc();
+  cache->arena     = arena;
+  cache->slots     = push_array(arena, FdCacheEntry9P *, FD_CACHE_SLOT_COUNT);
+  cache->capacity  = capacity;
+  return cache;
+}
+
+internal FdCacheEntry9P **
+fs9p_fd_cache_slot__locked(FdCache9P *cache, u64 dev, u64 ino, u32 flags)
+{
+  u64 hash = (dev * 0x9e3779b97f4a7c15ull) ^ (ino * 0xff51afd7ed558ccdull) ^ flags;
+  FdCacheEntry9P **slot = &cache->slots[(hash ^ (hash >> 29)) % FD_CACHE_SLOT_COUNT];
+  for(; *slot != 0; slot = &(*slot)->hash_next)
+  {
+    FdCacheEntry9P *entry = *slot;
+    if(entry->dev == dev && entry->ino == ino && entry->flags == flags) { break; }
+  }
+  return slot;
+}
+
+internal void
+fs9p_fd_cache_lru_unlink__locked(FdCache9P *cache, FdCacheEntry9P *entry)
+{
+  if(entry->lru_prev != 0) { entry->lru_prev->lru_next = entry->lru_next; }
+  else                     { cache->lru_first          = entry->lru_next; }
+  if(entry->lru_next != 0) { entry->lru_next->lru_prev = entry->lru_prev; }
+  else                     { cache->lru_last           = entry->lru_prev; }
+  entry->lru_prev = 0;
+  entry->lru_next = 0;
+}
+
+// Unhashes an entry. Idle entries are closed and freed here; ones still in
+// use are marked stale and closed by their last release.
+internal void
+fs9p_fd_cache_remove__locked(FdCache9P *cache, FdCacheEntry9P *entry)
+{
+  FdCacheEntry9P **slot = fs9p_fd_cache_slot__locked(cache, entry->dev, entry->ino, entry->flags);
+  if(*slot == entry) { *slot = entry->hash_next; }
+  entry->hash_next  = 0;
+  entry->stale      = 1;
+  cache->entry_count -= 1;
+  if(entry->ref_count == 0)
+  {
+    fs9p_fd_cache_lru_unlink__locked(cache, entry);
+    close(entry->fd);
+    SLLStackPush_N(cache->free_list, entry, hash_next);
+  }
+}
+
+internal FdCacheEntry9P *
+fs9p_fd_cache_acquire(FdCache9P *cache, struct stat *st, u32 flags)
+{
+  FdCacheEntry9P *result = 0;
+  MutexScope(cache->mutex)
+  {
+    FdCacheEntry9P *entry = *fs9p_fd_cache_slot__locked(cache, st->st_dev, st->st_ino, flags);
+    if(entry != 0)
+    {
+      // A changed mtime or ctime means the file was rewritten or had its
+      // permissions changed since the descriptor was opened
+      b32 valid = entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+                  entry->ctime.tv_sec == st->st_ctim.tv_sec && entry->ctime.tv_nsec == st->st_ctim.tv_nsec;
+      if(valid)
+      {
+        if(entry->ref_count == 0) { fs9p_fd_cache_lru_unlink__locked(cache, entry); }
+        entry->ref_count += 1;
+        result            = entry;
+      }
+      else { fs9p_fd_cache_remove__locked(cache, entry); }
+    }
+    if(result != 0) { cache->hit_count += 1; }
+    else            { cache->miss_count += 1; }
+  }
+  return result;
+}
+
+// Adopts a freshly opened fd. Returns 0, leaving the fd with the caller,
+// when the file is already cached or every cached fd is in use.
+internal FdCacheEntry9P *
+fs9p_fd_cache_insert(FdCache9P *cache, int fd, u32 flags)
+{
+  struct stat st = {0};
+  if(fstat(fd, &st) != 0) { return 0; }
+
+  FdCacheEntry9P *result = 0;
+  MutexScope(cache->mutex)
+  {
+    if(cache->entry_count >= cache->capacity && cache->lru_first != 0)
+    {
+      fs9p_fd_cache_remove__locked(cache, cache->lru_first);
+      cache->eviction_count += 1;
+    }
+
+    FdCacheEntry9P **slot = fs9p_fd_cache_slot__locked(cache, st.st_dev, st.st_ino, flags);
+    if(*slot == 0 && cache->entry_count < cache->capacity)
+    {
+      result = cache->free_list;
+      if(result != 0) { SLLStackPop_N(cache->free_list, hash_next); }
+      else            { result = push_array_no_zero(cache->arena, FdCacheEntry9P, 1); }
+      MemoryZeroStruct(result);
+      result->dev        = st.st_dev;
+      result->ino        = st.st_ino;
+      result->flags      = flags;
+      result->fd         = fd;
+      result->ref_count  = 1;
+      result->mtime      = st.st_mtim;
+      result->ctime      = st.st_ctim;
+      *slot              = result;
+      cache->entry_count += 1;
+    }
+  }
+  return result;
+}
+
+internal void
+fs9p_fd_cache_release(FdCache9P *cache, FdCacheEntry9P *entry)
+{
+  MutexScope(cache->mutex)
+  {
+    entry->ref_count -= 1;
+    if(entry->ref_count == 0 && entry->stale)
+    {
+      close(entry->fd);
+      SLLStackPush_N(cache->free_list, entry, hash_next);
+    }
+    else if(entry->ref_count == 0)
+    {
+      // Most recently released entries go to the back and are evicted last
+      entry->lru_prev = cache->lru_last;
+      entry->lru_next = 0;
+      if(cache->lru_last != 0) { cache->lru_last->lru_next = entry; }
+      else                     { cache->lru_first          = entry; }
+      cache->lru_last = entry;
+    }
+  }
+}
+
+internal void
+fs9p_fd_cache_forget(FdCache9P *cache, struct stat *st)
+{
+  MutexScope(cache->mutex)
+  {
+    FdCacheEntry9P *entry = *fs9p_fd_cache_slot__locked(cache, st->st_dev, st->st_ino, O_RDONLY);
+    if(entry != 0) { fs9p_fd_cache_remove__locked(cache, entry); }
+  }
+}
+
+////////////////////////////////
+//~ Content Cache
+
+internal ContentCache9P *
+fs9p_content_cache_alloc(Arena *arena, u64 budget)
+{
+  ContentCache9P *cache = push_array(arena, ContentCache9P, 1);
+  for(u64 i = 0; i < CONTENT_CACHE_SHARD_COUNT; i += 1)
+  {
+    ContentCacheShard9P *shard = &cache->shards[i];
+    shard->mutex               = mutex_alloc();
+    shard->arena               = arena_alloc();
+    shard->slots               = push_array(shard->arena, ContentCacheEntry9P *, CONTENT_CACHE_SLOT_COUNT);
+    shard->sketch              = push_array(shard->arena, u8, CONTENT_CACHE_SKETCH_DEPTH * CONTENT_CACHE_SKETCH_WIDTH);
+    shard->budget              = budget / CONTENT_CACHE_SHARD_COUNT;
+  }
+  return cache;
+}
+
+internal u64
+fs9p_content_cache_hash(u64 dev, u64 ino)
+{
+  u64 hash = (dev * 0x9e3779b97f4a7c15ull) ^ (ino * 0xc2b2ae3d27d4eb4full);
+  hash ^= hash >> 31;
+  hash *= 0xbf58476d1ce4e5b9ull;
+  hash ^= hash >> 29;
+  return hash;
+}
+
+internal u64
+fs9p_content_cache_class_from_size(u64 size)
+{
+  u64 class_idx = 0;
+  for(; class_idx + 1 < CONTENT_CACHE_CLASS_COUNT && (1ull << (class_idx + CONTENT_CACHE_CLASS_MIN)) < size; class_idx += 1) {}
+  return class_idx;
+}
+
+internal ContentCacheEntry9P **
+fs9p_content_cache_slot__locked(ContentCacheShard9P *shard, u64 dev, u64 ino)
+{
+  u64 hash                   = fs9p_content_cache_hash(dev, ino);
+  ContentCacheEntry9P **slot = &shard->slots[(hash >> 8) % CONTENT_CACHE_SLOT_COUNT];
+  for(; *slot != 0; slot = &(*slot)->hash_next)
+  {
+    if((*slot)->dev == dev && (*slot)->ino == ino) { break; }
+  }
+  return slot;
+}
+
+//- count-min sketch of recent opens, used only to compare candidates
+
+internal u64
+fs9p_content_cache_frequency__locked(ContentCacheShard9P *shard, u64 hash)
+{
+  u64 result = CONTENT_CACHE_COUNTER_MAX;
+  for(u64 row = 0; row < CONTENT_CACHE_SKETCH_DEPTH; row += 1)
+  {
+    u64 row_hash = (hash + row * 0x9e3779b97f4a7c15ull) * 0xff51afd7ed558ccdull;
+    u8 *counter  = &shard->sketch[row * CONTENT_CACHE_SKETCH_WIDTH + (row_hash >> 32) % CONTENT_CACHE_SKETCH_WIDTH];
+    result       = Min(result, *counter);
+  }
+  return result;
+}
+
+internal void
+fs9p_content_cache_touch__locked(ContentCacheShard9P *shard, u64 hash)
+{
+  // Conservative update: only the counters holding the minimum are raised
+  u64 frequency = fs9p_content_cache_frequency__locked(shard, hash);
+  if(frequency < CONTENT_CACHE_COUNTER_MAX)
+  {
+    for(u64 row = 0; row < CONTENT_CACHE_SKETCH_DEPTH; row += 1)
+    {
+      u64 row_hash = (hash + row * 0x9e3779b97f4a7c15ull) * 0xff51afd7ed558ccdull;
+      u8 *counter  = &shard->sketch[row * CONTENT_CACHE_SKETCH_WIDTH + (row_hash >> 32) % CONTENT_CACHE_SKETCH_WIDTH];
+      if(*counter == frequency) { *counter += 1; }
+    }
+  }
+
+  // Halving every counter now and then lets old favourites fade
+  shard->sketch_additions += 1;
+  if(shard->sketch_additions >= CONTENT_CACHE_SKETCH_WIDTH * 10)
+  {
+    for(u64 i = 0; i < CONTENT_CACHE_SKETCH_DEPTH * CONTENT_CACHE_SKETCH_WIDTH; i += 1) { shard->sketch[i] >>= 1; }
+    shard->sketch_additions /= 2;
+  }
+}
+
+//- entries
+
+internal void
+fs9p_content_cache_lru_unlink__locked(ContentCacheShard9P *shard, ContentCacheEntry9P *entry)
+{
+  if(entry->lru_prev != 0) { entry->lru_prev->lru_next = entry->lru_next; }
+  else                     { shard->lru_first          = entry->lru_next; }
+  if(entry->lru_next != 0) { entry->lru_next->lru_prev = entry->lru_prev; }
+  else                     { shard->lru_last           = entry->lru_prev; }
+  entry->lru_prev = 0;
+  entry->lru_next = 0;
+}
+
+// Drops an entry from the shard. Its block is reused once no handle still
+// reads from it.
+internal void
+fs9p_content_cache_remove__locked(ContentCacheShard9P *shard, ContentCacheEntry9P *entry)
+{
+  ContentCacheEntry9P **slot = fs9p_content_cache_slot__locked(shard, entry->dev, entry->ino);
+  if(*slot == entry) { *slot = entry->hash_next; }
+  entry->hash_next = 0;
+  entry->in_cache  = 0;
+  fs9p_content_cache_lru_unlink__locked(shard, entry);
+  shard->bytes       -= 1ull << (fs9p_content_cache_class_from_size(entry->size) + CONTENT_CACHE_CLASS_MIN);
+  shard->entry_count -= 1;
+  if(entry->ref_count == 0)
+  {
+    TempFreeBlock9P *block = (TempFreeBlock9P *)entry->data;
+    SLLStackPush(shard->free_blocks[fs9p_content_cache_class_from_size(entry->size)], block);
+    SLLStackPush_N(shard->free_entries, entry, hash_next);
+  }
+}
+
+internal ContentCacheEntry9P *
+fs9p_content_cache_acquire(ContentCache9P *cache, struct stat *st)
+{
+  u64 hash                    = fs9p_content_cache_hash(st->st_dev, st->st_ino);
+  ContentCacheShard9P *shard  = &cache->shards[hash % CONTENT_CACHE_SHARD_COUNT];
+  ContentCacheEntry9P *result = 0;
+  MutexScope(shard->mutex)
+  {
+    fs9p_content_cache_touch__locked(shard, hash);
+    ContentCacheEntry9P *entry = *fs9p_content_cache_slot__locked(shard, st->st_dev, st->st_ino);
+    if(entry != 0)
+    {
+      b32 valid = !ins_atomic_u32_eval(&entry->stale) && entry->size == (u64)st->st_size &&
+                  entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+      if(valid)
+      {
+        fs9p_content_cache_lru_unlink__locked(shard, entry);
+        entry->lru_next = shard->lru_first;
+        if(shard->lru_first != 0) { shard->lru_first->lru_prev = entry; }
+        else                      { shard->lru_last            = entry; }
+        shard->lru_first  = entry;
+        entry->ref_count += 1;
+        result            = entry;
+      }
+      else { fs9p_content_cache_remove__locked(shard, entry); }
+    }
+  }
+  if(result != 0) { ins_atomic_u64_inc_eval(&cache->hit_count); }
+  else            { ins_atomic_u64_inc_eval(&cache->miss_count); }
+  return result;
+}
+
+// TinyLFU admission: a file is read in only if it fits in free space or was
+// opened more often recently than each entry it would push out, so a
+// one-pass scan never displaces the hot set.
+internal ContentCacheEntry9P *
+fs9p_content_cache_fill(ContentCache9P *cache, int fd, struct stat *st)
+{
+  u64 hash                   = fs9p_content_cache_hash(st->st_dev, st->st_ino);
+  ContentCacheShard9P *shard = &cache->shards[hash % CONTENT_CACHE_SHARD_COUNT];
+  u64 size                   = (u64)st->st_size;
+  u64 class_idx              = fs9p_content_cache_class_from_size(size);
+  u64 block_size             = 1ull << (class_idx + CONTENT_CACHE_CLASS_MIN);
+
+  b32 worth_reading = 0;
+  MutexScope(shard->mutex)
+  {
+    u64 frequency = fs9p_content_cache_frequency__locked(shard, hash);
+    worth_reading = block_size <= shard->budget &&
+                    (shard->bytes + block_size <= shard->budget ||
+                     (shard->lru_last != 0 &&
+                      fs9p_content_cache_frequency__locked(shard, fs9p_content_cache_hash(shard->lru_last->dev, shard->lru_last->ino)) < frequency));
+  }
+  if(!worth_reading) { ins_atomic_u64_inc_eval(&cache->reject_count); return 0; }
+
+  // The file is read outside the lock; one that changed size meanwhile is left alone
+  Temp scratch = scratch_begin(0, 0);
+  u8 *buffer   = push_array_no_zero(scratch.arena, u8, size + 1);
+  ssize_t n    = pread(fd, buffer, size + 1, 0);
+
+  ContentCacheEntry9P *result = 0;
+  b32 admitted                = n == (ssize_t)size;
+  MutexScope(shard->mutex)
+  {
+    ContentCacheEntry9P **slot = fs9p_content_cache_slot__locked(shard, st->st_dev, st->st_ino);
+    u64 frequency              = fs9p_content_cache_frequency__locked(shard, hash);
+    admitted                   = admitted && *slot == 0;
+    while(admitted && shard->bytes + block_size > shard->budget)
+    {
+      ContentCacheEntry9P *victim = shard->lru_last;
+      if(victim == 0 || fs9p_content_cache_frequency__locked(shard, fs9p_content_cache_hash(victim->dev, victim->ino)) >= frequency)
+      {
+        admitted = 0;
+      }
+      else
+      {
+        fs9p_content_cache_remove__locked(shard, victim);
+        ins_atomic_u64_inc_eval(&cache->eviction_count);
+      }
+    }
+
+    if(admitted)
+    {
+      result = shard->free_entries;
+      if(result != 0) { SLLStackPop_N(shard->free_entries, hash_next); }
+      else            { result = push_array_no_zero(shard->arena, ContentCacheEntry9P, 1); }
+      MemoryZeroStruct(result);
+
+      TempFreeBlock9P *block = shard->free_blocks[class_idx];
+      if(block != 0) { SLLStackPop(shard->free_blocks[class_idx]); }
+      else           { block = (TempFreeBlock9P *)push_array_no_zero(shard->arena, u8, block_size); }
+
+      result->dev       = st->st_dev;
+      result->ino       = st->st_ino;
+      result->mtime     = st->st_mtim;
+      result->size      = size;
+      result->data      = (u8 *)block;
+      result->ref_count = 1;
+      result->in_cache  = 1;
+      MemoryCopy(result->data, buffer, size);
+
+      result->hash_next = *slot;
+      *slot             = result;
+      result->lru_next  = shard->lru_first;
+      if(shard->lru_first != 0) { shard->lru_first->lru_prev = result; }
+      else                      { shard->lru_last            = result; }
+      shard->lru_first    = result;
+      shard->bytes       += block_size;
+      shard->entry_count += 1;
+    }
+  }
+  scratch_end(scratch);
+
+  if(result != 0) { ins_atomic_u64_inc_eval(&cache->admit_count); }
+  else            { ins_atomic_u64_inc_eval(&cache->reject_count); }
+  return result;
+}
+
+internal void
+fs9p_content_cache_release(ContentCache9P *cache, ContentCacheEntry9P *entry)
+{
+  u64 hash                   = fs9p_content_cache_hash(entry->dev, entry->ino);
+  ContentCacheShard9P *shard = &cache->shards[hash % CONTENT_CACHE_SHARD_COUNT];
+  MutexScope(shard->mutex)
+  {
+    entry->ref_count -= 1;
+    if(entry->ref_count == 0 && !entry->in_cache)
+    {
+      TempFreeBlock9P *block = (TempFreeBlock9P *)entry->data;
+      SLLStackPush(shard->free_blocks[fs9p_content_cache_class_from_size(entry->size)], block);
+      SLLStackPush_N(shard->free_entries, entry, hash_next);
+    }
+  }
+}
+
+internal void
+fs9p_content_cache_invalidate(ContentCache9P *cache, u64 dev, u64 ino)
+{
+  if(cache == 0) { return; }
+
+  u64 hash                   = fs9p_content_cache_hash(dev, ino);
+  ContentCacheShard9P *shard = &cache->shards[hash % CONTENT_CACHE_SHARD_COUNT];
+  MutexScope(shard->mutex)
+  {
+    ContentCacheEntry9P *entry = *fs9p_content_cache_slot__locked(shard, dev, ino);
+    if(entry != 0)
+    {
+      // Handles still holding the entry fall back to reading the file
+      ins_atomic_u32_eval_assign(&entry->stale, 1);
+      fs9p_content_cache_remove__locked(shard, entry);
+    }
+  }
 }
 
 ////////////////////////////////
-//~ Temporary Storage Operations
+//~ Temporary Storage Helpers
 
-internal b32
-temp9p_create(Arena *arena, FsContext9P *ctx, String8 path, u32 permissions)
+internal u64
+temp9p_class_from_size(u64 size)
 {
-  String8     parent_path = fs9p_dirname(arena, path);
-  String8     name        = fs9p_basename(arena, path);
-  TempNode9P *parent      = temp9p_node_lookup(ctx->tmp_root, parent_path);
+  u64 class_idx = TEMP_ALLOC_CLASS_MIN;
+  for(; ((u64)1 << class_idx) < size; class_idx += 1);
+  return class_idx;
+}
 
-  if(parent == 0 || !parent->is_directory) { return 0; }
-  for(TempNode9P *child = parent->first_child; child != 0; child = child->next_sibling) { if(str8_match(child->name, name, 0)) { return 0; } }
+internal void *
+temp9p_alloc(FsContext9P *ctx, u64 size)
+{
+  // Power-of-two size classes let pages, page tables, child tables and names
+  // all be recycled through per-class free lists
+  u64 class_idx  = temp9p_class_from_size(size);
+  u64 class_size = (u64)1 << class_idx;
+  void *result   = 0;
+  MutexScope(ctx->tmp_alloc_mutex)
+  {
+    TempFreeBlock9P *block = ctx->tmp_free_blocks[class_idx];
+    if(block != 0) { ctx->tmp_free_blocks[class_idx] = block->next; result = block; }
+    else           { result = push_array_no_zero_aligned(ctx->tmp_arena, u8, class_size, Min(class_size, TEMP_PAGE_SIZE)); }
+    ctx->tmp_bytes_in_use += class_size;
+  }
+  MemoryZero(result, class_size);
+  return result;
+}
 
-  b32         is_dir   = (permissions & P9_ModeFlag_Directory) != 0;
-  TempNode9P *node     = temp9p_node_create(ctx->tmp_arena, ctx, path, name, is_dir, permissions & 0777);
-  node->parent         = parent;
-  node->next_sibling   = parent->first_child;
-  parent->first_child  = node;
+internal void
+temp9p_free(FsContext9P *ctx, void *ptr, u64 size)
+{
+  if(ptr == 0) { return; }
+  u64 class_idx = temp9p_class_from_size(size);
+  MutexScope(ctx->tmp_alloc_mutex)
+  {
+    TempFreeBlock9P *block           = (TempFreeBlock9P *)ptr;
+    block->next                      = ctx->tmp_free_blocks[class_idx];
+    ctx->tmp_free_blocks[class_idx]  = block;
+    ctx->tmp_bytes_in_use           -= (u64)1 << class_idx;
+  }
+}
 
-  return 1;
+internal Mutex
+temp9p_node_mutex(FsContext9P *ctx, TempNode9P *node)
+{
+  return ctx->tmp_node_mutexes[node->qid.path % TEMP_NODE_STRIPE_COUNT];
 }
 
 internal TempNode9P *
-temp9p_open(FsContext9P *ctx, String8 path)
+temp9p_node_alloc(FsContext9P *ctx, String8 name, b32 is_dir, u32 mode)
 {
-  return temp9p_node_lookup(ctx->tmp_root, path);
+  TempNode9P *node = 0;
+  MutexScope(ctx->tmp_alloc_mutex)
+  {
+    node = ctx->tmp_free_nodes;
+    if(node != 0) { ctx->tmp_free_nodes = node->next_sibling; }
+    else          { node = push_array_no_zero(ctx->tmp_arena, TempNode9P, 1); }
+  }
+  MemoryZeroStruct(node);
+
+  node->name.str     = (u8 *)temp9p_alloc(ctx, name.size);
+  node->name.size    = name.size;
+  MemoryCopy(node->name.str, name.str, name.size);
+  node->user_id      = str8_lit("nobody");
+  node->group_id     = str8_lit("nobody");
+  node->qid.path     = ins_atomic_u64_inc_eval(&ctx->tmp_qid_count);
+  node->qid.type     = is_dir ? QidTypeFlag_Directory : QidTypeFlag_File;
+  node->mode         = mode;
+  node->access_time  = os_now_unix();
+  node->modify_time  = node->access_time;
+  node->is_directory = is_dir;
+  node->ref_count    = 1;
+  return node;
 }
 
-internal String8
-temp9p_read(Arena *arena, TempNode9P *node, u64 offset, u64 count)
+internal void
+temp9p_node_release(FsContext9P *ctx, TempNode9P *node)
 {
-  if(node == 0 || node->is_directory || offset >= node->content.size) { return str8_zero(); }
-  u64 read_size = Min(node->content.size - offset, count);
-  return str8_copy(arena, str8(node->content.str + offset, read_size));
+  if(node == 0) { return; }
+  if(ins_atomic_u64_dec_eval(&node->ref_count) != 0) { return; }
+
+  // The tree link and every open handle hold a reference, so the last one
+  // out owns an unreachable node and needs no locks
+  temp9p_truncate__locked(ctx, node, 0);
+  temp9p_free(ctx, node->pages, node->page_slot_count * sizeof(u8 *));
+  temp9p_free(ctx, node->child_slots, node->child_slot_count * sizeof(TempNode9P *));
+  temp9p_free(ctx, node->name.str, node->name.size);
+  MutexScope(ctx->tmp_alloc_mutex)
+  {
+    node->next_sibling  = ctx->tmp_free_nodes;
+    ctx->tmp_free_nodes = node;
+  }
 }
 
-internal u64
-temp9p_write(Arena *arena, TempNode9P *node, u64 offset, String8 data)
+internal TempNode9P *
+temp9p_child_lookup(TempNode9P *dir, String8 name)
 {
-  if(node == 0 || node->is_directory) { return 0; }
+  if(dir->child_slot_count == 0) { return 0; }
+  TempNode9P *child = dir->child_slots[u64_hash_from_str8(name) % dir->child_slot_count];
+  for(; child != 0 && !str8_match(child->name, name, 0); child = child->hash_next);
+  return child;
+}
 
-  u64 required_size = offset + data.size;
-  if(required_size > node->content.size)
+internal void
+temp9p_child_insert(FsContext9P *ctx, TempNode9P *dir, TempNode9P *node)
+{
+  if(dir->child_count + 1 > dir->child_slot_count)
   {
-    u8 *expanded_content = push_array(arena, u8, required_size);
-    if(node->content.size > 0) { MemoryCopy(expanded_content, node->content.str, node->content.size); }
-    if(offset > node->content.size) { MemoryZero(expanded_content + node->content.size, offset - node->content.size); }
-    node->content.str    = expanded_content;
-    node->content.size   = required_size;
+    u64 new_slot_count      = Max(TEMP_CHILD_SLOT_MIN, dir->child_slot_count * 2);
+    TempNode9P **new_slots  = (TempNode9P **)temp9p_alloc(ctx, new_slot_count * sizeof(TempNode9P *));
+    for(TempNode9P *child = dir->first_child; child != 0; child = child->next_sibling)
+    {
+      u64 slot_idx          = u64_hash_from_str8(child->name) % new_slot_count;
+      child->hash_next      = new_slots[slot_idx];
+      new_slots[slot_idx]   = child;
+    }
+    temp9p_free(ctx, dir->child_slots, dir->child_slot_count * sizeof(TempNode9P *));
+    dir->child_slots        = new_slots;
+    dir->child_slot_count   = new_slot_count;
   }
 
-  MemoryCopy(node->content.str + offset, data.str, data.size);
-  node->modify_time  = os_now_unix();
-  node->qid.version += 1;
+  u64 slot_idx                = u64_hash_from_str8(node->name) % dir->child_slot_count;
+  node->hash_next             = dir->child_slots[slot_idx];
+  dir->child_slots[slot_idx]  = node;
+  // Appended so sibling order never changes and listing cursors stay valid
+  node->parent                = dir;
+  node->next_sibling          = 0;
+  node->prev_sibling          = dir->last_child;
+  if(dir->last_child != 0) { dir->last_child->next_sibling = node; }
+  else                     { dir->first_child              = node; }
+  dir->last_child             = node;
+  dir->child_count           += 1;
+}
 
-  return data.size;
+internal void
+temp9p_child_rename(FsContext9P *ctx, TempNode9P *dir, TempNode9P *node, String8 name)
+{
+  // Only the hash chain moves, so the entry keeps its place in listings
+  TempNode9P **slot = &dir->child_slots[u64_hash_from_str8(node->name) % dir->child_slot_count];
+  for(; *slot != node; slot = &(*slot)->hash_next);
+  *slot = node->hash_next;
+
+  temp9p_free(ctx, node->name.str, node->name.size);
+  node->name.str             = (u8 *)temp9p_alloc(ctx, name.size);
+  node->name.size            = name.size;
+  MemoryCopy(node->name.str, name.str, name.size);
+
+  u64 slot_idx               = u64_hash_from_str8(node->name) % dir->child_slot_count;
+  node->hash_next            = dir->child_slots[slot_idx];
+  dir->child_slots[slot_idx] = node;
 }
 
 internal void
-temp9p_remove(FsContext9P *ctx, String8 path)
+temp9p_child_remove(TempNode9P *dir, TempNode9P *node)
 {
-  TempNode9P *node = temp9p_node_lookup(ctx->tmp_root, path);
-  if(node == 0 || node->parent == 0) { return; }
+  TempNode9P **slot = &dir->child_slots[u64_hash_from_str8(node->name) % dir->child_slot_count];
+  for(; *slot != node; slot = &(*slot)->hash_next);
+  *slot = node->hash_next;
+
+  if(node->prev_sibling != 0) { node->prev_sibling->next_sibling = node->next_sibling; }
+  else                        { dir->first_child = node->next_sibling; }
+  if(node->next_sibling != 0) { node->next_sibling->prev_sibling = node->prev_sibling; }
+  else                        { dir->last_child = node->prev_sibling; }
+
+  node->parent        = 0;
+  node->hash_next     = 0;
+  node->next_sibling  = 0;
+  node->prev_sibling  = 0;
+  dir->child_count   -= 1;
+}
 
-  TempNode9P *parent = node->parent;
-  if(parent->first_child == node) { parent->first_child = node->next_sibling; }
-  else
+internal TempNode9P *
+temp9p_node_lookup(TempNode9P *root, String8 path)
+{
+  if(path.size == 0 || str8_match(path, str8_lit("."), 0)) { return root; }
+
+  TempNode9P *node = root;
+  for(u64 path_pos = 0; path_pos < path.size && node != 0;)
+  {
+    u64 component_end = path_pos;
+    for(; component_end < path.size && path.str[component_end] != '/'; component_end += 1);
+
+    String8 component = str8(path.str + path_pos, component_end - path_pos);
+    node              = node->is_directory ? temp9p_child_lookup(node, component) : 0;
+    path_pos          = component_end;
+    if(path_pos < path.size && path.str[path_pos] == '/') { path_pos += 1; }
+  }
+
+  return node;
+}
+
+internal void
+temp9p_reserve_pages__locked(FsContext9P *ctx, TempNode9P *node, u64 page_count)
+{
+  if(page_count <= node->page_slot_count) { return; }
+
+  u64 new_slot_count = Max(16, node->page_slot_count * 2);
+  for(; new_slot_count < page_count; new_slot_count *= 2);
+  u8 **new_pages     = (u8 **)temp9p_alloc(ctx, new_slot_count * sizeof(u8 *));
+  MemoryCopy(new_pages, node->pages, node->page_slot_count * sizeof(u8 *));
+  temp9p_free(ctx, node->pages, node->page_slot_count * sizeof(u8 *));
+  node->pages           = new_pages;
+  node->page_slot_count = new_slot_count;
+}
+
+internal void
+temp9p_truncate__locked(FsContext9P *ctx, TempNode9P *node, u64 size)
+{
+  if(size < node->size)
   {
-    for(TempNode9P *prev = parent->first_child; prev != 0; prev = prev->next_sibling)
+    u64 keep_count = (size + TEMP_PAGE_SIZE - 1) / TEMP_PAGE_SIZE;
+    for(u64 i = keep_count; i < node->page_slot_count; i += 1)
     {
-      if(prev->next_sibling == node)
-      {
-        prev->next_sibling = node->next_sibling;
-        break;
-      }
+      temp9p_free(ctx, node->pages[i], TEMP_PAGE_SIZE);
+      node->pages[i] = 0;
+    }
+
+    // Pages past the end stay zero so a later extension reads back holes
+    u64 tail = size % TEMP_PAGE_SIZE;
+    if(tail != 0 && keep_count <= node->page_slot_count && node->pages[keep_count - 1] != 0)
+    {
+      MemoryZero(node->pages[keep_count - 1] + tail, TEMP_PAGE_SIZE - tail);
     }
   }
+  node->size = size;
 }
 
 internal Dir9P
-temp9p_stat(Arena *arena, TempNode9P *node)
+temp9p_dir_from_node__locked(Arena *arena, TempNode9P *node)
 {
-  Dir9P dir = dir9p_zero();
-  if(node == 0) { return dir; }
-
-  dir.length         = node->content.size;
+  Dir9P dir          = dir9p_zero();
+  dir.length         = node->is_directory ? 0 : node->size;
   dir.qid            = node->qid;
   dir.mode           = node->mode;
   if(node->is_directory) { dir.mode |= P9_ModeFlag_Directory; }
@@ -963,138 +2297,504 @@ temp9p_stat(Arena *arena, TempNode9P *node)
   dir.group_id       = str8_copy(arena, node->group_id);
   dir.modify_user_id = dir.user_id;
   dir.name           = str8_copy(arena, node->name);
-
   return dir;
 }
 
+////////////////////////////////
+//~ Temporary Storage Operations
+
+internal TempNode9P *
+temp9p_open(FsContext9P *ctx, String8 path, b32 truncate)
+{
+  TempNode9P *node = 0;
+  MutexScopeR(ctx->tmp_tree_mutex)
+  {
+    node = temp9p_node_lookup(ctx->tmp_root, path);
+    if(node != 0) { ins_atomic_u64_inc_eval(&node->ref_count); }
+  }
+
+  if(node != 0 && truncate && !node->is_directory)
+  {
+    MutexScope(temp9p_node_mutex(ctx, node))
+    {
+      temp9p_truncate__locked(ctx, node, 0);
+      node->modify_time  = os_now_unix();
+      node->qid.version += 1;
+    }
+  }
+  return node;
+}
+
 internal void
-temp9p_wstat(Arena *arena, TempNode9P *node, Dir9P *dir)
+temp9p_close(FsContext9P *ctx, TempNode9P *node)
 {
-  if(node == 0)            { return; }
-  if(dir->mode != max_u32) { node->mode = dir->mode & 07777; }
-  if(dir->length != max_u64)
+  temp9p_node_release(ctx, node);
+}
+
+internal String8
+temp9p_read(Arena *arena, FsContext9P *ctx, TempNode9P *node, u64 offset, u64 count)
+{
+  if(node == 0 || node->is_directory) { return str8_zero(); }
+
+  String8 result = str8_zero();
+  MutexScope(temp9p_node_mutex(ctx, node))
+  {
+    if(offset < node->size)
+    {
+      u64 read_size = Min(node->size - offset, count);
+      u8 *buffer    = push_array_no_zero(arena, u8, read_size);
+      for(u64 pos = 0; pos < read_size;)
+      {
+        u64 file_pos    = offset + pos;
+        u64 page_idx    = file_pos / TEMP_PAGE_SIZE;
+        u64 page_offset = file_pos % TEMP_PAGE_SIZE;
+        u64 chunk_size  = Min(TEMP_PAGE_SIZE - page_offset, read_size - pos);
+        u8 *page        = (page_idx < node->page_slot_count) ? node->pages[page_idx] : 0;
+        if(page != 0) { MemoryCopy(buffer + pos, page + page_offset, chunk_size); }
+        else          { MemoryZero(buffer + pos, chunk_size); }
+        pos += chunk_size;
+      }
+      result = str8(buffer, read_size);
+    }
+  }
+  return result;
+}
+
+internal u64
+temp9p_write(FsContext9P *ctx, TempNode9P *node, u64 offset, String8 data)
+{
+  if(node == 0 || node->is_directory) { return 0; }
+  if(data.size == 0)                  { return 0; }
+
+  MutexScope(temp9p_node_mutex(ctx, node))
+  {
+    u64 end = offset + data.size;
+    temp9p_reserve_pages__locked(ctx, node, (end + TEMP_PAGE_SIZE - 1) / TEMP_PAGE_SIZE);
+    for(u64 pos = 0; pos < data.size;)
+    {
+      u64 file_pos    = offset + pos;
+      u64 page_idx    = file_pos / TEMP_PAGE_SIZE;
+      u64 page_offset = file_pos % TEMP_PAGE_SIZE;
+      u64 chunk_size  = Min(TEMP_PAGE_SIZE - page_offset, data.size - pos);
+      if(node->pages[page_idx] == 0) { node->pages[page_idx] = (u8 *)temp9p_alloc(ctx, TEMP_PAGE_SIZE); }
+      MemoryCopy(node->pages[page_idx] + page_offset, data.str + pos, chunk_size);
+      pos += chunk_size;
+    }
+    node->size         = Max(node->size, end);
+    node->modify_time  = os_now_unix();
+    node->qid.version += 1;
+  }
+  return data.size;
+}
+
+internal b32
+temp9p_create(FsContext9P *ctx, String8 path, u32 permissions)
+{
+  Temp scratch        = scratch_begin(0, 0);
+  String8 parent_path = fs9p_dirname(scratch.arena, path);
+  String8 name        = fs9p_basename(scratch.arena, path);
+  b32 is_dir          = (permissions & P9_ModeFlag_Directory) != 0;
+  b32 result          = 0;
+
+  MutexScopeW(ctx->tmp_tree_mutex)
+  {
+    TempNode9P *parent = temp9p_node_lookup(ctx->tmp_root, parent_path);
+    if(parent != 0 && parent->is_directory && temp9p_child_lookup(parent, name) == 0)
+    {
+      TempNode9P *node = temp9p_node_alloc(ctx, name, is_dir, permissions & 0777);
+      temp9p_child_insert(ctx, parent, node);
+      result = 1;
+    }
+  }
+
+  scratch_end(scratch);
+  return result;
+}
+
+internal b32
+temp9p_remove(FsContext9P *ctx, String8 path)
+{
+  TempNode9P *node = 0;
+  MutexScopeW(ctx->tmp_tree_mutex)
+  {
+    // Directories must be empty, as with rmdir
+    TempNode9P *found = temp9p_node_lookup(ctx->tmp_root, path);
+    if(found != 0 && found->parent != 0 && found->child_count == 0)
+    {
+      temp9p_child_remove(found->parent, found);
+      node = found;
+    }
+  }
+
+  // Open handles keep the node alive until they close
+  temp9p_node_release(ctx, node);
+  return node != 0;
+}
+
+internal Dir9P
+temp9p_stat(Arena *arena, FsContext9P *ctx, String8 path)
+{
+  Dir9P result = dir9p_zero();
+  MutexScopeR(ctx->tmp_tree_mutex)
   {
-    if(dir->length < node->content.size) { node->content.size = dir->length; }
-    else if(dir->length > node->content.size)
+    TempNode9P *node = temp9p_node_lookup(ctx->tmp_root, path);
+    if(node != 0)
     {
-      u8 *new_content    = push_array(arena, u8, dir->length);
-      if(node->content.size > 0) { MemoryCopy(new_content, node->content.str, node->content.size); }
-      MemoryZero(new_content + node->content.size, dir->length - node->content.size);
-      node->content.str  = new_content;
-      node->content.size = dir->length;
+      MutexScope(temp9p_node_mutex(ctx, node)) { result = temp9p_dir_from_node__locked(arena, node); }
     }
   }
+  return result;
+}
 
-  if(dir->access_time != max_u32) { node->access_time = dir->access_time; }
-  if(dir->modify_time != max_u32) { node->modify_time = dir->modify_time; }
-  if(dir->name.size > 0 && !str8_match(dir->name, node->name, 0))
+internal b32
+temp9p_wstat(FsContext9P *ctx, String8 path, Dir9P *dir)
+{
+  b32 result = 0;
+  MutexScopeW(ctx->tmp_tree_mutex)
   {
-    String8 parent_path = fs9p_dirname(arena, node->path);
-    String8 new_path    = fs9p_path_join(arena, parent_path, dir->name);
-    node->path          = new_path;
-    node->name          = str8_copy(arena, dir->name);
+    TempNode9P *node = temp9p_node_lookup(ctx->tmp_root, path);
+    b32 rename       = (node != 0 && dir->name.size > 0 && !str8_match(dir->name, node->name, 0));
+    b32 conflict     = rename && (node->parent == 0 || temp9p_child_lookup(node->parent, dir->name) != 0);
+    if(node != 0 && !conflict)
+    {
+      MutexScope(temp9p_node_mutex(ctx, node))
+      {
+        if(dir->mode != max_u32)                            { node->mode = dir->mode & 07777; }
+        if(dir->length != max_u64 && !node->is_directory)   { temp9p_truncate__locked(ctx, node, dir->length); }
+        if(dir->access_time != max_u32)                     { node->access_time = dir->access_time; }
+        if(dir->modify_time != max_u32)                     { node->modify_time = dir->modify_time; }
+      }
+
+      if(rename) { temp9p_child_rename(ctx, node->parent, node, dir->name); }
+      result = 1;
+    }
   }
+  return result;
 }
 
 internal String8
-temp9p_readdir(Arena *arena, TempNode9P *node, TempNode9P **iter, u64 offset, u64 count)
+temp9p_readdir(Arena *arena, FsContext9P *ctx, DirIterator9P *iter, u64 offset, u64 count)
 {
+  TempNode9P *node = iter->tmp_node;
   if(node == 0 || !node->is_directory) { return str8_zero(); }
-  *iter = node->first_child;
-  u64 current_byte_position = 0;
-
-  u64 encode_buffer_cap  = Min(count, P9_DIR_ENTRY_MAX);
-  u8 *encode_buffer      = push_array(arena, u8, encode_buffer_cap);
-  u64 encode_buffer_size = 0;
-  Temp scratch = scratch_begin(&arena, 1);
-
-  for(TempNode9P *child = *iter; child != 0; child = child->next_sibling)
-  {
-    *iter = child->next_sibling;
-
-    Dir9P child_dir          = dir9p_zero();
-    child_dir.length         = child->content.size;
-    child_dir.qid            = child->qid;
-    child_dir.mode           = child->mode;
-    if(child->is_directory) { child_dir.mode |= P9_ModeFlag_Directory; }
-    child_dir.access_time    = child->access_time;
-    child_dir.modify_time    = child->modify_time;
-    child_dir.user_id        = str8_copy(scratch.arena, child->user_id);
-    child_dir.group_id       = str8_copy(scratch.arena, child->group_id);
-    child_dir.modify_user_id = child_dir.user_id;
-    child_dir.name           = str8_copy(scratch.arena, child->name);
-
-    String8 encoded_entry = str8_from_dir9p(scratch.arena, child_dir);
-    if(current_byte_position + encoded_entry.size <= offset)
-    {
-      current_byte_position += encoded_entry.size;
-      continue;
+
+  u8 *buffer             = push_array_no_zero(arena, u8, count);
+  u64 buffer_size        = 0;
+  b32 full               = 0;
+  TempNode9P *old_cursor = iter->tmp_cursor;
+  TempNode9P *last       = 0;
+  Temp scratch           = scratch_begin(&arena, 1);
+  MutexScopeR(ctx->tmp_tree_mutex)
+  {
+    // A read that continues the previous one resumes after its last entry, so
+    // children created meanwhile are appended instead of shifting offsets;
+    // any other offset, or a cursor that was removed, replays from the start
+    TempNode9P *child = node->first_child;
+    u64 position      = 0;
+    if(old_cursor != 0 && old_cursor->parent == node && offset == iter->tmp_cursor_position)
+    {
+      child    = old_cursor->next_sibling;
+      position = offset;
     }
 
-    if(encode_buffer_size + encoded_entry.size > count) { break; }
-    if(encode_buffer_size + encoded_entry.size > encode_buffer_cap)
+    for(; child != 0 && !full; child = child->next_sibling)
     {
-      u64 new_encode_cap    = encode_buffer_cap * 2;
-      for(; encode_buffer_size + encoded_entry.size > new_encode_cap; new_encode_cap *= 2);
-      u8 *new_encode_buffer = push_array(arena, u8, new_encode_cap);
-      MemoryCopy(new_encode_buffer, encode_buffer, encode_buffer_size);
-      encode_buffer         = new_encode_buffer;
-      encode_buffer_cap     = new_encode_cap;
+      Temp entry_scratch = temp_begin(scratch.arena);
+      Dir9P child_dir    = dir9p_zero();
+      MutexScope(temp9p_node_mutex(ctx, child)) { child_dir = temp9p_dir_from_node__locked(entry_scratch.arena, child); }
+
+      u64 entry_size = dir9p_size(child_dir);
+      if(position + entry_size <= offset)        { position += entry_size; last = child; }
+      else if(buffer_size + entry_size > count)  { full = 1; }
+      else
+      {
+        String8 encoded_entry = str8_from_dir9p(entry_scratch.arena, child_dir);
+        MemoryCopy(buffer + buffer_size, encoded_entry.str, encoded_entry.size);
+        buffer_size += encoded_entry.size;
+        position    += encoded_entry.size;
+        last         = child;
+      }
+      temp_end(entry_scratch);
     }
 
-    MemoryCopy(encode_buffer + encode_buffer_size, encoded_entry.str, encoded_entry.size);
-    encode_buffer_size += encoded_entry.size;
+    // The cursor holds a reference so it stays readable after a remove
+    if(last != 0)
+    {
+      ins_atomic_u64_inc_eval(&last->ref_count);
+      iter->tmp_cursor          = last;
+      iter->tmp_cursor_position = position;
+    }
   }
-
+  if(last != 0) { temp9p_node_release(ctx, old_cursor); }
   scratch_end(scratch);
-  return str8(encode_buffer, encode_buffer_size);
+  return str8(buffer, buffer_size);
 }
 
 ////////////////////////////////
 //~ UID/GID Conversion
 
+internal IdNamePair9P *
+fs9p_id_table_slot(IdNameTable9P *table, u32 id)
+{
+  if(table->slot_count == 0) { return 0; }
+  u64 mask = table->slot_count - 1;
+  u64 idx  = ((u64)id * 0x9E3779B97F4A7C15ull) >> 32;
+  for(;; idx += 1)
+  {
+    IdNamePair9P *slot = &table->slots[idx & mask];
+    if(!slot->occupied || slot->id == id) { return slot; }
+  }
+}
+
+internal void
+fs9p_id_table_build(Arena *arena, IdNameTable9P *table, IdNamePair9P *pairs, u64 count)
+{
+  table->slot_count = 64;
+  for(; table->slot_count < count * 2; table->slot_count *= 2);
+  table->slots = push_array(arena, IdNamePair9P, table->slot_count);
+  table->count = 0;
+  for(u64 i = 0; i < count; i += 1)
+  {
+    // The first database entry for an id wins, as with getpwuid
+    IdNamePair9P *slot = fs9p_id_table_slot(table, pairs[i].id);
+    if(slot->occupied) { continue; }
+    slot->occupied = 1;
+    slot->id       = pairs[i].id;
+    slot->name     = str8_copy(arena, pairs[i].name);
+    table->count  += 1;
+  }
+}
+
+internal void
+fs9p_id_pairs_push(Arena *arena, IdNamePair9P **pairs, u64 *count, u64 *cap, u32 id, String8 name)
+{
+  if(*count == *cap)
+  {
+    u64 new_cap             = Max(64, *cap * 2);
+    IdNamePair9P *new_pairs = push_array_no_zero(arena, IdNamePair9P, new_cap);
+    if(*count > 0) { MemoryCopy(new_pairs, *pairs, *count * sizeof(IdNamePair9P)); }
+    *pairs                  = new_pairs;
+    *cap                    = new_cap;
+  }
+  (*pairs)[*count].occupied = 1;
+  (*pairs)[*count].id       = id;
+  (*pairs)[*count].name     = name;
+  *count += 1;
+}
+
+internal void
+fs9p_id_table_insert(Arena *arena, IdNameTable9P *table, u32 id, String8 name)
+{
+  // Grows by doubling so a stream of individually resolved ids costs amortized O(1)
+  if((table->count + 1) * 2 > table->slot_count)
+  {
+    IdNameTable9P grown = {0};
+    grown.slot_count    = Max(64, table->slot_count * 2);
+    grown.slots         = push_array(arena, IdNamePair9P, grown.slot_count);
+    for(u64 i = 0; i < table->slot_count; i += 1)
+    {
+      if(table->slots[i].occupied) { *fs9p_id_table_slot(&grown, table->slots[i].id) = table->slots[i]; }
+    }
+    grown.count = table->count;
+    *table      = grown;
+  }
+  IdNamePair9P *slot = fs9p_id_table_slot(table, id);
+  if(slot->occupied) { return; }
+  slot->occupied = 1;
+  slot->id       = id;
+  slot->name     = str8_copy(arena, name);
+  table->count  += 1;
+}
+
 internal String8
-str8_from_uid(Arena *arena, FsContext9P *ctx, u32 uid)
+fs9p_id_name_resolve(Arena *arena, b32 is_group, u32 id)
+{
+  Temp scratch    = scratch_begin(&arena, 1);
+  String8 name    = str8_zero();
+  u64 buffer_size = ID_NAME_BUFFER_MIN;
+  for(;;)
+  {
+    char *buffer = push_array_no_zero(scratch.arena, char, buffer_size);
+    int error    = 0;
+    if(is_group)
+    {
+      struct group gr_entry = {0};
+      struct group *gr      = 0;
+      error = getgrgid_r((gid_t)id, &gr_entry, buffer, buffer_size, &gr);
+      if(error == 0 && gr != 0) { name = str8_copy(arena, str8_cstring(gr->gr_name)); }
+    }
+    else
+    {
+      struct passwd pw_entry = {0};
+      struct passwd *pw      = 0;
+      error = getpwuid_r((uid_t)id, &pw_entry, buffer, buffer_size, &pw);
+      if(error == 0 && pw != 0) { name = str8_copy(arena, str8_cstring(pw->pw_name)); }
+    }
+    if(error != ERANGE || buffer_size >= ID_NAME_BUFFER_MAX) { break; }
+    buffer_size *= 2;
+  }
+  scratch_end(scratch);
+  return name;
+}
+
+internal IdNameMap9P *
+fs9p_id_map_alloc(void)
 {
-  if(ctx == 0) { return str8_from_u64(arena, uid, 10, 0, 0); }
+  Temp scratch = scratch_begin(0, 0);
+  IdNamePair9P *uid_pairs = 0, *gid_pairs = 0;
+  u64 uid_count = 0, uid_cap = 0, gid_count = 0, gid_cap = 0;
+
+  //- preload everything the passwd and group databases enumerate; an entry
+  // too large for the buffer is retried with a bigger one, since ERANGE
+  // leaves the enumeration on the same entry
+  u64 buffer_size = ID_NAME_BUFFER_MIN;
+  char *buffer    = push_array_no_zero(scratch.arena, char, buffer_size);
+  struct passwd pw_entry = {0};
+  struct passwd *pw      = 0;
+  setpwent();
+  for(;;)
+  {
+    int error = getpwent_r(&pw_entry, buffer, buffer_size, &pw);
+    if(error == ERANGE && buffer_size < ID_NAME_BUFFER_MAX)
+    {
+      buffer_size *= 2;
+      buffer       = push_array_no_zero(scratch.arena, char, buffer_size);
+      continue;
+    }
+    if(error != 0 || pw == 0) { break; }
+    fs9p_id_pairs_push(scratch.arena, &uid_pairs, &uid_count, &uid_cap, pw->pw_uid,
+                       str8_copy(scratch.arena, str8_cstring(pw->pw_name)));
+  }
+  endpwent();
+
+  struct group gr_entry = {0};
+  struct group *gr      = 0;
+  setgrent();
+  for(;;)
+  {
+    int error = getgrent_r(&gr_entry, buffer, buffer_size, &gr);
+    if(error == ERANGE && buffer_size < ID_NAME_BUFFER_MAX)
+    {
+      buffer_size *= 2;
+      buffer       = push_array_no_zero(scratch.arena, char, buffer_size);
+      continue;
+    }
+    if(error != 0 || gr == 0) { break; }
+    fs9p_id_pairs_push(scratch.arena, &gid_pairs, &gid_count, &gid_cap, gr->gr_gid,
+                       str8_copy(scratch.arena, str8_cstring(gr->gr_name)));
+  }
+  endgrent();
+
+  Arena *arena     = arena_alloc();
+  IdNameMap9P *map = push_array(arena, IdNameMap9P, 1);
+  map->arena       = arena;
+  fs9p_id_table_build(arena, &map->uids, uid_pairs, uid_count);
+  fs9p_id_table_build(arena, &map->gids, gid_pairs, gid_count);
+  scratch_end(scratch);
+  return map;
+}
 
-  for(u32 i = 0; i < ArrayCount(ctx->uid_cache); i += 1)
+internal void
+fs9p_id_map_publish(FsContext9P *ctx, IdNameMap9P *map)
+{
+  MutexScope(ctx->id_map_mutex)
   {
-    if(ctx->uid_cache[i].id == uid && ctx->uid_cache[i].name.size > 0) { return str8_copy(arena, ctx->uid_cache[i].name); }
+    u64 now_us       = os_now_microseconds();
+    IdNameMap9P *old = (IdNameMap9P *)ins_atomic_ptr_eval_assign(&ctx->id_map, map);
+    if(old != 0)
+    {
+      old->retire_time_us = now_us;
+      SLLStackPush_N(ctx->id_map_retired, old, retired_next);
+    }
+
+    // Readers hold a map for a single probe, so one retired well before now is unreferenced
+    for(IdNameMap9P **ptr = &ctx->id_map_retired; *ptr != 0;)
+    {
+      IdNameMap9P *retired = *ptr;
+      if(now_us - retired->retire_time_us > ID_MAP_RETIRE_GRACE_US)
+      {
+        *ptr = retired->retired_next;
+        arena_release(retired->arena);
+      }
+      else
+      {
+        ptr = &retired->retired_next;
+      }
+    }
   }
 
-  struct passwd *pw = getpwuid((uid_t)uid);
-  if(pw != 0 && pw->pw_name != 0)
+  // Individually resolved ids are looked up again against the fresh databases
+  MutexScopeW(ctx->id_lookup_mutex)
   {
-    String8 name = str8_cstring(pw->pw_name);
-    ctx->uid_cache[ctx->uid_cache_pos].id   = uid;
-    ctx->uid_cache[ctx->uid_cache_pos].name = str8_copy(ctx->tmp_arena, name);
-    ctx->uid_cache_pos = (ctx->uid_cache_pos + 1) % ArrayCount(ctx->uid_cache);
-    return str8_copy(arena, name);
+    arena_clear(ctx->id_lookup_arena);
+    MemoryZeroStruct(&ctx->id_lookup_uids);
+    MemoryZeroStruct(&ctx->id_lookup_gids);
   }
+}
 
-  return str8_from_u64(arena, uid, 10, 0, 0);
+internal void
+fs9p_id_map_thread_entry_point(void *ptr)
+{
+  FsContext9P *ctx = (FsContext9P *)ptr;
+  for(;;)
+  {
+    os_sleep_milliseconds(ID_MAP_REFRESH_INTERVAL_MS);
+    fs9p_id_map_publish(ctx, fs9p_id_map_alloc());
+  }
 }
 
 internal String8
-str8_from_gid(Arena *arena, FsContext9P *ctx, u32 gid)
+fs9p_id_name(Arena *arena, FsContext9P *ctx, b32 is_group, u32 id)
 {
-  if(ctx == 0) { return str8_from_u64(arena, gid, 10, 0, 0); }
+  if(ctx == 0) { return str8_from_u64(arena, id, 10, 0, 0); }
 
-  for(u32 i = 0; i < ArrayCount(ctx->gid_cache); i += 1)
+  IdNameMap9P *map   = (IdNameMap9P *)ins_atomic_ptr_eval(&ctx->id_map);
+  IdNamePair9P *slot = (map != 0) ? fs9p_id_table_slot(is_group ? &map->gids : &map->uids, id) : 0;
+  String8 name       = str8_zero();
+  b32 found          = 0;
+  if(slot != 0 && slot->occupied)
   {
-    if(ctx->gid_cache[i].id == gid && ctx->gid_cache[i].name.size > 0) { return str8_copy(arena, ctx->gid_cache[i].name); }
+    name  = str8_copy(arena, slot->name);
+    found = 1;
   }
 
-  struct group *gr = getgrgid((gid_t)gid);
-  if(gr != 0 && gr->gr_name != 0)
+  // Ids the databases do not enumerate are resolved once into a side table
+  // that grows in place; an empty name records a miss
+  else if(map != 0)
+  {
+    IdNameTable9P *lookups = is_group ? &ctx->id_lookup_gids : &ctx->id_lookup_uids;
+    MutexScopeR(ctx->id_lookup_mutex)
+    {
+      IdNamePair9P *lookup = fs9p_id_table_slot(lookups, id);
+      if(lookup != 0 && lookup->occupied)
+      {
+        name  = str8_copy(arena, lookup->name);
+        found = 1;
+      }
+    }
+    if(!found)
+    {
+      name = fs9p_id_name_resolve(arena, is_group, id);
+      MutexScopeW(ctx->id_lookup_mutex) { fs9p_id_table_insert(ctx->id_lookup_arena, lookups, id, name); }
+    }
+  }
+  else
   {
-    String8 name = str8_cstring(gr->gr_name);
-    ctx->gid_cache[ctx->gid_cache_pos].id   = gid;
-    ctx->gid_cache[ctx->gid_cache_pos].name = str8_copy(ctx->tmp_arena, name);
-    ctx->gid_cache_pos = (ctx->gid_cache_pos + 1) % ArrayCount(ctx->gid_cache);
-    return str8_copy(arena, name);
+    name = fs9p_id_name_resolve(arena, is_group, id);
   }
 
-  return str8_from_u64(arena, gid, 10, 0, 0);
+  if(name.size == 0) { name = str8_from_u64(arena, id, 10, 0, 0); }
+  return name;
+}
+
+internal String8
+str8_from_uid(Arena *arena, FsContext9P *ctx, u32 uid)
+{
+  return fs9p_id_name(arena, ctx, 0, uid);
+}
+
+internal String8
+str8_from_gid(Arena *arena, FsContext9P *ctx, u32 gid)
+{
+  return fs9p_id_name(arena, ctx, 1, gid);
 }
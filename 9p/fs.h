@@ -5,6 +5,8 @@
 //~ Includes
 
 #include <grp.h>
+#include <linux/openat2.h>
+#include <sys/inotify.h>
 #include <sys/syscall.h>
 
 ////////////////////////////////
@@ -17,50 +19,308 @@ enum
   StorageBackend9P_ArenaTemp,
 };
 
+typedef u32 SyncPolicy9P;
+enum
+{
+  SyncPolicy9P_None,
+  SyncPolicy9P_Clunk,
+  SyncPolicy9P_Always,
+};
+
+#define TEMP_PAGE_SIZE         KB(4)
+#define TEMP_ALLOC_CLASS_MIN   4
+#define TEMP_ALLOC_CLASS_COUNT 64
+#define TEMP_CHILD_SLOT_MIN    8
+#define TEMP_NODE_STRIPE_COUNT 64
+
+typedef struct TempFreeBlock9P TempFreeBlock9P;
+struct TempFreeBlock9P
+{
+  TempFreeBlock9P *next;
+};
+
 typedef struct TempNode9P TempNode9P;
 struct TempNode9P
 {
-  String8 path;
+  TempNode9P *parent;
+  TempNode9P *first_child;
+  TempNode9P *last_child;
+  TempNode9P *next_sibling;
+  TempNode9P *prev_sibling;
+  TempNode9P *hash_next;
+  TempNode9P **child_slots;
+  u64 child_slot_count;
+  u64 child_count;
   String8 name;
-  String8 content;
   String8 user_id;
   String8 group_id;
+  u8 **pages;
+  u64 page_slot_count;
+  u64 size;
+  u64 ref_count;
   Qid qid;
   u32 mode;
   u32 access_time;
   u32 modify_time;
   b32 is_directory;
-  TempNode9P *first_child;
-  TempNode9P *next_sibling;
-  TempNode9P *parent;
 };
 
+#define META_CACHE_SLOT_COUNT       4096
+#define META_CACHE_WATCH_SLOT_COUNT 1024
+
+typedef struct MetaCacheEntry9P MetaCacheEntry9P;
+struct MetaCacheEntry9P
+{
+  MetaCacheEntry9P *hash_next;
+  String8 path;
+  String8 stat_data;
+};
+
+typedef struct MetaCacheWatch9P MetaCacheWatch9P;
+struct MetaCacheWatch9P
+{
+  MetaCacheWatch9P *hash_next;
+  MetaCacheWatch9P *path_next;
+  int watch_descriptor;
+  String8 path;
+};
+
+typedef struct MetaCache9P MetaCache9P;
+struct MetaCache9P
+{
+  RWMutex rw_mutex;
+  Arena *arena;
+  Arena *watch_arena;
+  u64 budget;
+  MetaCacheEntry9P **slots;
+  MetaCacheWatch9P **watch_slots;
+  MetaCacheWatch9P **watch_path_slots;
+  String8 root_path;
+  int inotify_fd;
+  u64 generation;
+  u64 entry_count;
+  u64 hit_count;
+  u64 miss_count;
+  u64 invalidation_count;
+  u64 clear_count;
+};
+
+#define FD_CACHE_SLOT_COUNT       1024
+#define FD_CACHE_CAPACITY_DEFAULT 256
+
+typedef struct FdCacheEntry9P FdCacheEntry9P;
+struct FdCacheEntry9P
+{
+  FdCacheEntry9P *hash_next;
+  FdCacheEntry9P *lru_prev;
+  FdCacheEntry9P *lru_next;
+  u64 dev;
+  u64 ino;
+  u32 flags;
+  int fd;
+  u64 ref_count;
+  struct timespec mtime;
+  struct timespec ctime;
+  b32 stale;
+};
+
+typedef struct FdCache9P FdCache9P;
+struct FdCache9P
+{
+  Mutex mutex;
+  Arena *arena;
+  FdCacheEntry9P **slots;
+  FdCacheEntry9P *lru_first;
+  FdCacheEntry9P *lru_last;
+  FdCacheEntry9P *free_list;
+  u64 capacity;
+  u64 entry_count;
+  u64 hit_count;
+  u64 miss_count;
+  u64 eviction_count;
+};
+
+#define CONTENT_CACHE_SHARD_COUNT    16
+#define CONTENT_CACHE_SLOT_COUNT     256
+#define CONTENT_CACHE_SKETCH_DEPTH   4
+#define CONTENT_CACHE_SKETCH_WIDTH   1024
+#define CONTENT_CACHE_COUNTER_MAX    15
+#define CONTENT_CACHE_CLASS_MIN      6
+#define CONTENT_CACHE_CLASS_COUNT    11
+#define CONTENT_CACHE_FILE_MAX       KB(64)
+
+typedef struct ContentCacheEntry9P ContentCacheEntry9P;
+struct ContentCacheEntry9P
+{
+  ContentCacheEntry9P *hash_next;
+  ContentCacheEntry9P *lru_prev;
+  ContentCacheEntry9P *lru_next;
+  u64 dev;
+  u64 ino;
+  struct timespec mtime;
+  u64 size;
+  u8 *data;
+  u64 ref_count;
+  b32 in_cache;
+  u32 stale;
+};
+
+typedef struct ContentCacheShard9P ContentCacheShard9P;
+struct ContentCacheShard9P
+{
+  Mutex mutex;
+  Arena *arena;
+  ContentCacheEntry9P **slots;
+  ContentCacheEntry9P *lru_first;
+  ContentCacheEntry9P *lru_last;
+  ContentCacheEntry9P *free_entries;
+  TempFreeBlock9P *free_blocks[CONTENT_CACHE_CLASS_COUNT];
+  u8 *sketch;
+  u64 sketch_additions;
+  u64 budget;
+  u64 bytes;
+  u64 entry_count;
+};
+
+typedef struct ContentCache9P ContentCache9P;
+struct ContentCache9P
+{
+  ContentCacheShard9P shards[CONTENT_CACHE_SHARD_COUNT];
+  u64 hit_count;
+  u64 miss_count;
+  u64 admit_count;
+  u64 reject_count;
+  u64 eviction_count;
+  u64 read_count;
+};
+
+#define DIR_STAT_MASK (STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_ATIME | STATX_MTIME | STATX_INO | STATX_SIZE)
+
+typedef struct DirStatEntry9P DirStatEntry9P;
+struct DirStatEntry9P
+{
+  String8 name;
+  String8 encoded;
+  u64 next_cookie;
+  b32 skip;
+  b32 stat_ok;
+  struct statx st;
+};
+
+typedef struct FsContext9P FsContext9P;
+typedef struct DirStatBatch9P DirStatBatch9P;
+struct DirStatBatch9P
+{
+  DirStatBatch9P *free_next;
+  FsContext9P *ctx;
+  Mutex mutex;
+  CondVar done_cond;
+  int dir_fd;
+  DirStatEntry9P *entries;
+  u64 entry_count;
+  u64 next_idx;
+  u64 done_count;
+  u64 ref_count;
+};
+
+#define ID_MAP_REFRESH_INTERVAL_MS 60000
+#define ID_MAP_RETIRE_GRACE_US     (10 * Million(1))
+#define ID_NAME_BUFFER_MIN         KB(16)
+#define ID_NAME_BUFFER_MAX         MB(4)
+
 typedef struct IdNamePair9P IdNamePair9P;
 struct IdNamePair9P
 {
+  b32 occupied;
   u32 id;
   String8 name;
 };
 
-typedef struct FsContext9P FsContext9P;
+typedef struct IdNameTable9P IdNameTable9P;
+struct IdNameTable9P
+{
+  IdNamePair9P *slots;
+  u64 slot_count;
+  u64 count;
+};
+
+typedef struct IdNameMap9P IdNameMap9P;
+struct IdNameMap9P
+{
+  IdNameMap9P *retired_next;
+  Arena *arena;
+  IdNameTable9P uids;
+  IdNameTable9P gids;
+  u64 retire_time_us;
+};
+
 struct FsContext9P
 {
   String8 root_path;
   String8 root_canonical;
+  int root_fd;
   String8 tmp_path;
-  Mutex tmp_mutex;
+  RWMutex tmp_tree_mutex;
+  Mutex tmp_alloc_mutex;
+  Mutex tmp_node_mutexes[TEMP_NODE_STRIPE_COUNT];
   Arena *tmp_arena;
+  TempFreeBlock9P *tmp_free_blocks[TEMP_ALLOC_CLASS_COUNT];
+  TempNode9P *tmp_free_nodes;
+  u64 tmp_bytes_in_use;
   TempNode9P *tmp_root;
   u64 tmp_qid_count;
   b32 readonly;
   u32 uid_offset;
   u32 gid_offset;
   StorageBackend9P backend;
+  MetaCache9P *meta_cache;
+  FdCache9P *fd_cache;
+  ContentCache9P *content_cache;
+  WP_Pool *stat_pool;
+  u64 stat_parallel_min;
+  Mutex stat_batch_mutex;
+  Arena *stat_batch_arena;
+  DirStatBatch9P *stat_batch_free_list;
+  SyncPolicy9P sync_policy;
+  b32 coalesce_writes;
+  u64 read_ahead_max;
+  u64 read_ahead_hit_count;
+  u64 read_ahead_miss_count;
+  u64 read_ahead_bytes;
+  IdNameMap9P *id_map;
+  Mutex id_map_mutex;
+  IdNameMap9P *id_map_retired;
+  RWMutex id_lookup_mutex;
+  Arena *id_lookup_arena;
+  IdNameTable9P id_lookup_uids;
+  IdNameTable9P id_lookup_gids;
+};
+
+#define READ_AHEAD_WINDOW_MIN     KB(256)
+#define READ_AHEAD_WINDOW_DEFAULT MB(32)
 
-  IdNamePair9P uid_cache[16];
-  IdNamePair9P gid_cache[16];
-  u32 uid_cache_pos;
-  u32 gid_cache_pos;
+typedef struct ReadAhead9P ReadAhead9P;
+struct ReadAhead9P
+{
+  u64 next_offset;
+  u64 sequential_count;
+  u64 window;
+  u64 advised_end;
+  u64 hit_count;
+  u64 miss_count;
+  u64 advised_bytes;
+};
+
+#define WRITE_COALESCE_SIZE KB(64)
+
+typedef struct WriteBuffer9P WriteBuffer9P;
+struct WriteBuffer9P
+{
+  u8 *data;
+  u64 capacity;
+  u64 offset;
+  u64 size;
+  b32 dirty;
 };
 
 typedef struct FsHandle9P FsHandle9P;
@@ -71,6 +331,11 @@ struct FsHandle9P
   DIR *dir_handle;
   u64 dir_position;
   b32 is_directory;
+  b32 is_regular;
+  FdCacheEntry9P *fd_cache_entry;
+  ContentCacheEntry9P *content_entry;
+  u64 dev;
+  u64 ino;
   TempNode9P *tmp_node;
   FsContext9P *ctx;
 };
@@ -91,6 +356,8 @@ struct PathResolution9P
   String8 absolute_path;
   b32 valid;
   String8 error;
+  int fd;
+  Qid qid;
 };
 
 typedef struct DirIterator9P DirIterator9P;
@@ -98,31 +365,37 @@ struct DirIterator9P
 {
   DIR *dir_handle;
   u64 position;
-  u64 path_len;
+  u64 cookie;
+  String8 path;
   TempNode9P *tmp_node;
-  TempNode9P *tmp_current;
-  u8 path_buffer[PATH_MAX];
+  TempNode9P *tmp_cursor;
+  u64 tmp_cursor_position;
+  FsContext9P *ctx;
 };
 
 typedef struct FidAuxiliary9P FidAuxiliary9P;
 struct FidAuxiliary9P
 {
   FidAuxiliary9P *next;
-  u64 path_len;
+  String8 path;
+  u64 path_capacity;
+  int path_fd;
   FsHandle9P *handle;
   b32 has_dir_iter;
   u32 open_mode;
-  String8 cached_dir_entries;
-  DirIterator9P dir_iter;
+  Mutex mutex;
+  DirIterator9P *dir_iter;
+  ReadAhead9P read_ahead;
+  WriteBuffer9P write_buffer;
   b32 is_auth_fid;
   b32 auth_verified;
+  Arena *auth_arena;
   String8 auth_user;
   Client9P *auth_client;
   ClientFid9P *auth_rpc_fid;
   u8 auth_response_buffer[16];
   u64 auth_response_len;
   b32 auth_response_ready;
-  u8 path_buffer[PATH_MAX];
 };
 
 ////////////////////////////////
@@ -139,14 +412,25 @@ internal String8 fs9p_dirname(Arena *arena, String8 path);
 internal b32 fs9p_path_is_safe(String8 path);
 internal PathResolution9P fs9p_resolve_path(Arena *arena, FsContext9P *ctx, String8 base_path, String8 name);
 internal String8 os_path_from_fs9p_path(Arena *arena, FsContext9P *ctx, String8 relative_path);
+internal int fs9p_openat_beneath(int dir_fd, String8 path, int flags);
+internal PathResolution9P fs9p_walk(Arena *arena, FsContext9P *ctx, int dir_fd, String8 dir_path, String8 name);
 
 ////////////////////////////////
 //~ File Operations
 
 internal FsHandle9P *fs9p_open(Arena *arena, FsContext9P *ctx, String8 path, u32 mode);
 internal void fs9p_close(FsHandle9P *handle);
+internal b32 fs9p_content_entry_fresh(FsHandle9P *handle);
 internal String8 fs9p_read(Arena *arena, FsHandle9P *handle, u64 offset, u64 count);
+internal b32 fs9p_read_range(FsHandle9P *handle, u64 offset, u64 count, Rng1U64 *range_out);
+internal Rng1U64 fs9p_read_ahead_plan(FsContext9P *ctx, ReadAhead9P *read_ahead, u64 offset, u64 count);
+internal void fs9p_read_ahead_issue(FsHandle9P *handle, Rng1U64 range, b32 first);
 internal u64 fs9p_write(FsHandle9P *handle, u64 offset, String8 data);
+internal u64 fs9p_write_buffered(FsHandle9P *handle, WriteBuffer9P *buffer, u64 offset, String8 data);
+internal b32 fs9p_write_flush(FsHandle9P *handle, WriteBuffer9P *buffer);
+internal b32 fs9p_sync(FsHandle9P *handle);
+internal u64 fs9p_write_sync(FsHandle9P *handle, u64 offset, String8 data);
+internal s64 fs9p_write_fd(FsHandle9P *handle);
 internal b32 fs9p_create(FsContext9P *ctx, String8 path, u32 permissions, u32 mode);
 internal void fs9p_remove(FsContext9P *ctx, String8 path);
 
@@ -160,30 +444,85 @@ internal b32 fs9p_wstat(FsContext9P *ctx, String8 path, Dir9P *dir);
 //~ Directory Operations
 
 internal b32 fs9p_opendir(FsContext9P *ctx, String8 path, DirIterator9P *iter);
-internal String8 fs9p_readdir(Arena *result_arena, Arena *cache_arena, FsContext9P *ctx, DirIterator9P *iter, String8 *cache, u64 offset, u64 count);
+internal void fs9p_stat_entries(FsContext9P *ctx, int dir_fd, DirStatEntry9P *entries, u64 entry_count);
+internal b32 fs9p_stat_entries_ring(IO_Ring *ring, int dir_fd, DirStatEntry9P *entries, u64 entry_count);
+internal String8 fs9p_readdir(Arena *arena, FsContext9P *ctx, DirIterator9P *iter, u64 offset, u64 count);
 internal void fs9p_closedir(DirIterator9P *iter);
 
+////////////////////////////////
+//~ Metadata Cache
+
+internal MetaCache9P *fs9p_meta_cache_alloc(Arena *arena, String8 root_path, u64 budget);
+internal u64 fs9p_meta_cache_watch(MetaCache9P *cache, String8 watch_path, b32 *added_out);
+internal u64 fs9p_meta_cache_prepare(MetaCache9P *cache, String8 path);
+internal b32 fs9p_meta_cache_lookup(MetaCache9P *cache, Arena *arena, String8 path, String8 *data_out);
+internal void fs9p_meta_cache_store(MetaCache9P *cache, String8 path, String8 data, u64 generation);
+internal void fs9p_meta_cache_invalidate(MetaCache9P *cache, String8 path);
+internal void fs9p_meta_cache_clear(MetaCache9P *cache);
+
+////////////////////////////////
+//~ Descriptor Cache
+
+internal FdCache9P *fs9p_fd_cache_alloc(Arena *arena, u64 capacity);
+internal FdCacheEntry9P *fs9p_fd_cache_acquire(FdCache9P *cache, struct stat *st, u32 flags);
+internal FdCacheEntry9P *fs9p_fd_cache_insert(FdCache9P *cache, int fd, u32 flags);
+internal void fs9p_fd_cache_release(FdCache9P *cache, FdCacheEntry9P *entry);
+internal void fs9p_fd_cache_forget(FdCache9P *cache, struct stat *st);
+internal FdCacheEntry9P **fs9p_fd_cache_slot__locked(FdCache9P *cache, u64 dev, u64 ino, u32 flags);
+internal void fs9p_fd_cache_remove__locked(FdCache9P *cache, FdCacheEntry9P *entry);
+internal void fs9p_fd_cache_lru_unlink__locked(FdCache9P *cache, FdCacheEntry9P *entry);
+
+////////////////////////////////
+//~ Content Cache
+
+internal ContentCache9P *fs9p_content_cache_alloc(Arena *arena, u64 budget);
+internal ContentCacheEntry9P *fs9p_content_cache_acquire(ContentCache9P *cache, struct stat *st);
+internal ContentCacheEntry9P *fs9p_content_cache_fill(ContentCache9P *cache, int fd, struct stat *st);
+internal void fs9p_content_cache_release(ContentCache9P *cache, ContentCacheEntry9P *entry);
+internal void fs9p_content_cache_invalidate(ContentCache9P *cache, u64 dev, u64 ino);
+internal u64 fs9p_content_cache_hash(u64 dev, u64 ino);
+internal ContentCacheEntry9P **fs9p_content_cache_slot__locked(ContentCacheShard9P *shard, u64 dev, u64 ino);
+internal u64 fs9p_content_cache_frequency__locked(ContentCacheShard9P *shard, u64 hash);
+internal void fs9p_content_cache_touch__locked(ContentCacheShard9P *shard, u64 hash);
+internal void fs9p_content_cache_lru_unlink__locked(ContentCacheShard9P *shard, ContentCacheEntry9P *entry);
+internal void fs9p_content_cache_remove__locked(ContentCacheShard9P *shard, ContentCacheEntry9P *entry);
+internal u64 fs9p_content_cache_class_from_size(u64 size);
+
 ////////////////////////////////
 //~ Temporary Storage Helpers
 
+internal void *temp9p_alloc(FsContext9P *ctx, u64 size);
+internal void temp9p_free(FsContext9P *ctx, void *ptr, u64 size);
+internal Mutex temp9p_node_mutex(FsContext9P *ctx, TempNode9P *node);
+internal TempNode9P *temp9p_node_alloc(FsContext9P *ctx, String8 name, b32 is_dir, u32 mode);
+internal void temp9p_node_release(FsContext9P *ctx, TempNode9P *node);
+internal TempNode9P *temp9p_child_lookup(TempNode9P *dir, String8 name);
+internal void temp9p_child_insert(FsContext9P *ctx, TempNode9P *dir, TempNode9P *node);
+internal void temp9p_child_remove(TempNode9P *dir, TempNode9P *node);
+internal void temp9p_child_rename(FsContext9P *ctx, TempNode9P *dir, TempNode9P *node, String8 name);
 internal TempNode9P *temp9p_node_lookup(TempNode9P *root, String8 path);
-internal TempNode9P *temp9p_node_create(Arena *arena, FsContext9P *ctx, String8 path, String8 name, b32 is_dir, u32 mode);
+internal void temp9p_truncate__locked(FsContext9P *ctx, TempNode9P *node, u64 size);
+internal Dir9P temp9p_dir_from_node__locked(Arena *arena, TempNode9P *node);
 
 ////////////////////////////////
 //~ Temporary Storage Operations
 
-internal TempNode9P *temp9p_open(FsContext9P *ctx, String8 path);
-internal String8 temp9p_read(Arena *arena, TempNode9P *node, u64 offset, u64 count);
-internal u64 temp9p_write(Arena *arena, TempNode9P *node, u64 offset, String8 data);
-internal b32 temp9p_create(Arena *arena, FsContext9P *ctx, String8 path, u32 permissions);
-internal void temp9p_remove(FsContext9P *ctx, String8 path);
-internal Dir9P temp9p_stat(Arena *arena, TempNode9P *node);
-internal void temp9p_wstat(Arena *arena, TempNode9P *node, Dir9P *dir);
-internal String8 temp9p_readdir(Arena *arena, TempNode9P *node, TempNode9P **iter, u64 offset, u64 count);
+internal TempNode9P *temp9p_open(FsContext9P *ctx, String8 path, b32 truncate);
+internal void temp9p_close(FsContext9P *ctx, TempNode9P *node);
+internal String8 temp9p_read(Arena *arena, FsContext9P *ctx, TempNode9P *node, u64 offset, u64 count);
+internal u64 temp9p_write(FsContext9P *ctx, TempNode9P *node, u64 offset, String8 data);
+internal b32 temp9p_create(FsContext9P *ctx, String8 path, u32 permissions);
+internal b32 temp9p_remove(FsContext9P *ctx, String8 path);
+internal Dir9P temp9p_stat(Arena *arena, FsContext9P *ctx, String8 path);
+internal b32 temp9p_wstat(FsContext9P *ctx, String8 path, Dir9P *dir);
+internal String8 temp9p_readdir(Arena *arena, FsContext9P *ctx, DirIterator9P *iter, u64 offset, u64 count);
 
 ////////////////////////////////
 //~ UID/GID Conversion
 
+internal IdNameMap9P *fs9p_id_map_alloc(void);
+internal void fs9p_id_map_publish(FsContext9P *ctx, IdNameMap9P *map);
+internal void fs9p_id_map_thread_entry_point(void *ptr);
 internal String8 str8_from_uid(Arena *arena, FsContext9P *ctx, u32 uid);
 internal String8 str8_from_gid(Arena *arena, FsContext9P *ctx, u32 gid);
 
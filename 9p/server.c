@@ -1,47 +1,256 @@
+////////////////////////////////
+//~ Globals
+
+read_only global ServerFid9P server9p_fid_tombstone = {0};
+
+////////////////////////////////
+//~ Message Buffer Pool
+
+internal ServerBufferPool9P *
+server9p_buffer_pool_alloc(Arena *arena, u64 idle_limit)
+{
+  ServerBufferPool9P *pool = push_array(arena, ServerBufferPool9P, 1);
+  pool->mutex              = mutex_alloc();
+  pool->idle_limit         = idle_limit;
+  pool->free_arenas        = push_array(arena, Arena *, SERVER_BUFFER_POOL_ARENA_MAX);
+  return pool;
+}
+
+internal u64
+server9p_buffer_class_from_size(u64 size)
+{
+  u64 class_idx = 0;
+  for(; class_idx < SERVER_BUFFER_CLASS_COUNT && (SERVER_BUFFER_CLASS_MIN << class_idx) < size;) { class_idx += 1; }
+  return class_idx;
+}
+
+internal u64
+server9p_buffer_capacity_from_size(u64 size)
+{
+  u64 class_idx = server9p_buffer_class_from_size(size);
+  if(class_idx < SERVER_BUFFER_CLASS_COUNT) { return SERVER_BUFFER_CLASS_MIN << class_idx; }
+  return AlignPow2(size, os_get_system_info()->page_size);
+}
+
+// Buffers are sized to power-of-two classes; only the pages a message
+// touches become resident, so the slack costs address space, not memory.
+internal u8 *
+server9p_buffer_pool_borrow(ServerBufferPool9P *pool, u64 size)
+{
+  u64 class_idx = server9p_buffer_class_from_size(size);
+  u64 capacity  = server9p_buffer_capacity_from_size(size);
+  u8 *result    = 0;
+  if(class_idx < SERVER_BUFFER_CLASS_COUNT)
+  {
+    MutexScope(pool->mutex)
+    {
+      result = pool->free_buffers[class_idx];
+      if(result != 0)
+      {
+        pool->free_buffers[class_idx]  = *(u8 **)result;
+        pool->idle_bytes              -= capacity;
+        pool->idle_count              -= 1;
+      }
+    }
+  }
+  if(result == 0)
+  {
+    result = (u8 *)os_reserve(capacity);
+    if(result != 0) { os_commit(result, capacity); }
+  }
+  if(result != 0)
+  {
+    ins_atomic_u64_add_eval(&pool->in_use_bytes, capacity);
+    ins_atomic_u64_inc_eval(&pool->in_use_count);
+  }
+  return result;
+}
+
+internal void
+server9p_buffer_pool_return(ServerBufferPool9P *pool, u8 *buffer, u64 size)
+{
+  u64 class_idx = server9p_buffer_class_from_size(size);
+  u64 capacity  = server9p_buffer_capacity_from_size(size);
+  b32 keep      = 0;
+  MutexScope(pool->mutex)
+  {
+    // Idle buffers link through their own first bytes
+    keep = class_idx < SERVER_BUFFER_CLASS_COUNT && pool->idle_bytes + capacity <= pool->idle_limit;
+    if(keep)
+    {
+      *(u8 **)buffer                 = pool->free_buffers[class_idx];
+      pool->free_buffers[class_idx]  = buffer;
+      pool->idle_bytes              += capacity;
+      pool->idle_count              += 1;
+    }
+  }
+  ins_atomic_u64_add_eval(&pool->in_use_bytes, -capacity);
+  ins_atomic_u64_dec_eval(&pool->in_use_count);
+  if(!keep) { os_release(buffer, capacity); }
+}
+
+internal Arena *
+server9p_buffer_pool_borrow_arena(ServerBufferPool9P *pool)
+{
+  Arena *arena = 0;
+  MutexScope(pool->mutex)
+  {
+    if(pool->free_arena_count > 0)
+    {
+      pool->free_arena_count -= 1;
+      arena                   = pool->free_arenas[pool->free_arena_count];
+    }
+  }
+  if(arena == 0) { arena = arena_alloc(); }
+  ins_atomic_u64_inc_eval(&pool->arena_in_use_count);
+  return arena;
+}
+
+internal void
+server9p_buffer_pool_return_arena(ServerBufferPool9P *pool, Arena *arena)
+{
+  // An arena a large reply grew stays committed at that size, so only small
+  // ones are kept for the next request
+  arena_clear(arena);
+  b32 keep = arena->cmt <= SERVER_REQUEST_ARENA_KEEP && arena->free_last == 0;
+  MutexScope(pool->mutex)
+  {
+    keep = keep && pool->free_arena_count < SERVER_BUFFER_POOL_ARENA_MAX;
+    if(keep)
+    {
+      pool->free_arenas[pool->free_arena_count] = arena;
+      pool->free_arena_count                   += 1;
+    }
+  }
+  ins_atomic_u64_dec_eval(&pool->arena_in_use_count);
+  if(!keep) { arena_release(arena); }
+}
+
 ////////////////////////////////
 //~ Request Management
 
 internal ServerRequest9P *
-server9p_request_alloc(Server9P *server, u32 tag)
+server9p_request_alloc(Server9P *server)
 {
-  u32 hash = tag % server->max_request_count;
-  for(ServerRequest9P *check = server->request_table[hash]; check != 0; check = check->hash_next)
+  ServerRequest9P *request = 0;
+  MutexScope(server->mutex)
   {
-    if(check->tag == tag) { return 0; }
+    request = server->request_free_list;
+    if(request != 0)
+    {
+      server->request_free_list = request->hash_next;
+      Arena *arena              = request->arena;
+      MemoryZeroStruct(request);
+      request->arena = arena;
+    }
+    else { request = push_array(server->arena, ServerRequest9P, 1); }
+    server->request_count += 1;
   }
 
-  ServerRequest9P *request = server->request_free_list;
-  if(request != 0)
+  // Pooled connections hold an arena only while the request is in flight
+  if(request->arena == 0 && server->buffer_pool != 0) { request->arena = server9p_buffer_pool_borrow_arena(server->buffer_pool); }
+  else if(request->arena == 0)                        { request->arena = arena_alloc(); }
+  request->server  = server;
+  request->scratch = temp_begin(request->arena);
+  return request;
+}
+
+internal void
+server9p_request_release(ServerRequest9P *request)
+{
+  Server9P *server = request->server;
+  if(request->splice_pipe != 0)
   {
-    server->request_free_list = request->hash_next;
-    MemoryZeroStruct(request);
+    server9p_splice_pipe_release(server, request->splice_pipe, request->splice_size == 0);
+    request->splice_pipe = 0;
   }
-  else { request = push_array(server->arena, ServerRequest9P, 1); }
+  if(request->pool_buffer.size > 0)
+  {
+    server9p_buffer_pool_return(server->buffer_pool, request->pool_buffer.str, request->pool_buffer.size);
+    request->pool_buffer = str8_zero();
+  }
+  if(server->buffer_pool != 0)
+  {
+    server9p_buffer_pool_return_arena(server->buffer_pool, request->arena);
+    request->arena = 0;
+  }
+  else { arena_clear(request->arena); }
+  MutexScope(server->mutex)
+  {
+    request->hash_next        = server->request_free_list;
+    server->request_free_list = request;
+    server->request_count    -= 1;
+    if(server->request_count == 0) { cond_var_broadcast(server->idle_cond); }
+  }
+}
 
-  request->tag                = tag;
-  request->server             = server;
+//- request table: caller holds server->mutex
+
+internal b32
+server9p_request_insert(Server9P *server, ServerRequest9P *request)
+{
+  if(server9p_request_lookup(server, request->tag) != 0) { return 0; }
+
+  u32 hash                    = request->tag % server->max_request_count;
   request->hash_next          = server->request_table[hash];
   server->request_table[hash] = request;
-  server->request_count      += 1;
-
-  return request;
+  return 1;
 }
 
 internal ServerRequest9P *
-server9p_request_remove(Server9P *server, u32 tag)
+server9p_request_lookup(Server9P *server, u32 tag)
 {
-  u32 hash               = tag % server->max_request_count;
+  u32 hash = tag % server->max_request_count;
+  for(ServerRequest9P *check = server->request_table[hash]; check != 0; check = check->hash_next)
+  {
+    if(check->tag == tag) { return check; }
+  }
+  return 0;
+}
+
+internal void
+server9p_request_remove(Server9P *server, ServerRequest9P *request)
+{
+  u32 hash               = request->tag % server->max_request_count;
   ServerRequest9P **prev = &server->request_table[hash];
-  for(ServerRequest9P *request = *prev; request != 0; prev = &request->hash_next, request = request->hash_next)
+  for(ServerRequest9P *check = *prev; check != 0; prev = &check->hash_next, check = check->hash_next)
   {
-    if(request->tag == tag)
+    if(check == request)
     {
-      *prev = request->hash_next;
-      server->request_count -= 1;
-      return request;
+      *prev              = request->hash_next;
+      request->hash_next = 0;
+      return;
     }
   }
-  return 0;
+}
+
+////////////////////////////////
+//~ Input Reader Helpers
+
+internal b32
+server9p_input_reader_acquire(Server9P *server)
+{
+  MsgReader9P *reader = &server->input_reader;
+  if(reader->buffer != 0) { return 1; }
+  if(server->buffer_pool != 0) { reader->buffer = server9p_buffer_pool_borrow(server->buffer_pool, P9_READER_BUFFER_SIZE); }
+  else                         { reader->buffer = push_array_no_zero(server->arena, u8, P9_READER_BUFFER_SIZE); }
+  reader->capacity = reader->buffer != 0 ? P9_READER_BUFFER_SIZE : 0;
+  return reader->buffer != 0;
+}
+
+internal void
+server9p_input_reader_release(Server9P *server, b32 force)
+{
+  // Pooled connections hand the buffer back whenever it drains, so idle
+  // connections still hold no message memory
+  MsgReader9P *reader = &server->input_reader;
+  if(server->buffer_pool == 0 || reader->buffer == 0)    { return; }
+  if(!force && msg9p_reader_buffered(reader) > 0)        { return; }
+  server9p_buffer_pool_return(server->buffer_pool, reader->buffer, reader->capacity);
+  reader->buffer   = 0;
+  reader->capacity = 0;
+  reader->start    = 0;
+  reader->end      = 0;
 }
 
 ////////////////////////////////
@@ -52,18 +261,19 @@ server9p_alloc(Arena *arena, u64 input_fd, u64 output_fd)
 {
   Server9P *server          = push_array(arena, Server9P, 1);
   server->arena             = arena;
+  server->mutex             = mutex_alloc();
+  server->write_mutex       = mutex_alloc();
+  server->idle_cond         = cond_var_alloc();
   server->input_fd          = input_fd;
   server->output_fd         = output_fd;
-  server->max_message_size  = P9_IOUNIT_DEFAULT + P9_MESSAGE_HEADER_SIZE;
-  server->read_buffer       = push_array(arena, u8, server->max_message_size);
-  server->write_buffer      = push_array(arena, u8, server->max_message_size);
 
-  server->fid_capacity      = 4096;
-  server->fid_hash_capacity = 8192;
-  server->fid_storage       = push_array(arena, ServerFid9P, server->fid_capacity);
-  server->fid_hash_table    = push_array_no_zero(arena, u32, server->fid_hash_capacity);
-  server->fid_count         = 0;
-  MemorySet(server->fid_hash_table, max_u8, server->fid_hash_capacity * sizeof(u32));
+  server->max_message_size       = P9_MESSAGE_SIZE_DEFAULT;
+  server->max_message_size_limit = P9_MESSAGE_SIZE_CEILING;
+
+  server->fid_hash_capacity = FID_HASH_CAPACITY_MIN;
+  server->fid_hash_table    = push_array(arena, ServerFid9P *, server->fid_hash_capacity);
+
+  server->user_name_slots = push_array(arena, ServerUserName9P *, SERVER_USER_NAME_SLOT_COUNT);
 
   server->max_request_count = 4096;
   server->request_table     = push_array(arena, ServerRequest9P *, server->max_request_count);
@@ -71,101 +281,830 @@ server9p_alloc(Arena *arena, u64 input_fd, u64 output_fd)
   return server;
 }
 
+internal void
+server9p_wait_idle(Server9P *server)
+{
+  MutexScope(server->mutex)
+  {
+    for(; server->request_count > 0;) { cond_var_wait(server->idle_cond, server->mutex); }
+  }
+}
+
+internal void
+server9p_release(Server9P *server)
+{
+  server9p_wait_idle(server);
+  for(ServerRequest9P *request = server->request_free_list; request != 0; request = request->hash_next)
+  {
+    if(request->arena != 0) { arena_release(request->arena); }
+  }
+  server->request_free_list = 0;
+  server9p_input_reader_release(server, 1);
+  if(server->output_batch != 0 && server->buffer_pool != 0) { server9p_buffer_pool_return(server->buffer_pool, server->output_batch, SERVER_OUTPUT_BATCH_SIZE); }
+  if(server->output_queue_arena != 0) { arena_release(server->output_queue_arena); }
+  for(ServerSplicePipe9P *pipe = server->splice_pipe_free; pipe != 0; pipe = pipe->next)
+  {
+    if(pipe->fds[0] >= 0) { close(pipe->fds[0]); close(pipe->fds[1]); }
+  }
+  server->splice_pipe_free = 0;
+  cond_var_release(server->idle_cond);
+  mutex_release(server->write_mutex);
+  mutex_release(server->mutex);
+}
+
+internal u32
+server9p_negotiate_message_size(Server9P *server, u32 requested_size)
+{
+  // Requests are received into per-request arenas, so raising msize only
+  // widens what the reader accepts; nothing is preallocated at this size
+  u32 limit = Clamp(P9_MESSAGE_SIZE_MIN, server->max_message_size_limit, P9_MESSAGE_SIZE_MAX);
+  if(requested_size < P9_MESSAGE_SIZE_MIN) { return 0; }
+  server->max_message_size = Min(requested_size, limit);
+  return server->max_message_size;
+}
+
+////////////////////////////////
+//~ Fid Management Helpers
+
+internal u32
+server9p_fid_hash(u32 fid)
+{
+  return fid * 2654435761u;
+}
+
+internal ServerFid9P **
+server9p_fid_slot__locked(Server9P *server, u32 fid)
+{
+  u32 mask = server->fid_hash_capacity - 1;
+  for(u32 probe = 0, idx = server9p_fid_hash(fid) & mask; probe < server->fid_hash_capacity; probe += 1, idx = (idx + 1) & mask)
+  {
+    ServerFid9P *f = server->fid_hash_table[idx];
+    if(f == 0)                  { return 0; }
+    if(f == FID_HASH_TOMBSTONE) { continue; }
+    if(f->fid == fid)           { return &server->fid_hash_table[idx]; }
+  }
+  return 0;
+}
+
+internal void
+server9p_fid_insert__locked(Server9P *server, ServerFid9P *f)
+{
+  u32 mask = server->fid_hash_capacity - 1;
+  for(u32 idx = server9p_fid_hash(f->fid) & mask;; idx = (idx + 1) & mask)
+  {
+    ServerFid9P *slot = server->fid_hash_table[idx];
+    if(slot == 0 || slot == FID_HASH_TOMBSTONE)
+    {
+      if(slot == FID_HASH_TOMBSTONE) { server->fid_tombstone_count -= 1; }
+      server->fid_hash_table[idx] = f;
+      server->fid_count          += 1;
+      return;
+    }
+  }
+}
+
+internal void
+server9p_fid_rehash__locked(Server9P *server, u32 new_capacity)
+{
+  Temp scratch            = scratch_begin(0, 0);
+  u32 old_capacity        = server->fid_hash_capacity;
+  ServerFid9P **old_table = push_array_no_zero(scratch.arena, ServerFid9P *, old_capacity);
+  MemoryCopy(old_table, server->fid_hash_table, sizeof(*old_table) * old_capacity);
+
+  // Sweeping tombstones at the same capacity reuses the table, so walk/clunk
+  // churn does not grow the connection arena
+  if(new_capacity == old_capacity) { MemoryZero(server->fid_hash_table, sizeof(*old_table) * old_capacity); }
+  else                             { server->fid_hash_table = push_array(server->arena, ServerFid9P *, new_capacity); }
+  server->fid_hash_capacity   = new_capacity;
+  server->fid_count           = 0;
+  server->fid_tombstone_count = 0;
+  for(u32 i = 0; i < old_capacity; i += 1)
+  {
+    ServerFid9P *f = old_table[i];
+    if(f != 0 && f != FID_HASH_TOMBSTONE) { server9p_fid_insert__locked(server, f); }
+  }
+  scratch_end(scratch);
+}
+
+internal ServerFid9P *
+server9p_fid_lookup__locked(Server9P *server, u32 fid)
+{
+  ServerFid9P **slot = server9p_fid_slot__locked(server, fid);
+  return slot != 0 ? *slot : 0;
+}
+
+// A connection with a memory limit stops growing its arena once the limit is
+// spent; memory it already holds is still reused through the free lists.
+internal b32
+server9p_memory_available__locked(Server9P *server, u64 size)
+{
+  b32 result = server->memory_limit == 0 || arena_pos(server->arena) + size <= server->memory_limit;
+  if(!result) { server->memory_rejection_count += 1; }
+  return result;
+}
+
+// Every fid carries its user name; clients repeat one or two names for the
+// life of a mount, so each distinct name is stored once per connection.
+internal String8
+server9p_user_name_intern__locked(Server9P *server, String8 name)
+{
+  u64 slot = u64_hash_from_str8(name) % SERVER_USER_NAME_SLOT_COUNT;
+  for(ServerUserName9P *check = server->user_name_slots[slot]; check != 0; check = check->hash_next)
+  {
+    if(str8_match(check->name, name, 0)) { return check->name; }
+  }
+  if(!server9p_memory_available__locked(server, sizeof(ServerUserName9P) + name.size)) { return str8_zero(); }
+
+  ServerUserName9P *entry       = push_array(server->arena, ServerUserName9P, 1);
+  entry->name                   = str8_copy(server->arena, name);
+  entry->hash_next              = server->user_name_slots[slot];
+  server->user_name_slots[slot] = entry;
+  return entry->name;
+}
+
+internal ServerFid9P *
+server9p_fid_alloc__locked(Server9P *server, u32 fid)
+{
+  if(server9p_fid_slot__locked(server, fid) != 0) { return 0; }
+  if(server->fid_free_list == 0 && !server9p_memory_available__locked(server, sizeof(ServerFid9P))) { return 0; }
+
+  // Keep live entries plus tombstones under 3/4 load; grow only when live entries pass 1/2
+  u32 used = server->fid_count + server->fid_tombstone_count + 1;
+  if(used * 4 > server->fid_hash_capacity * 3)
+  {
+    u32 new_capacity = server->fid_hash_capacity;
+    for(; (server->fid_count + 1) * 2 > new_capacity;) { new_capacity *= 2; }
+    server9p_fid_rehash__locked(server, new_capacity);
+  }
+
+  ServerFid9P *f = server->fid_free_list;
+  if(f != 0) { SLLStackPop_N(server->fid_free_list, free_next); }
+  else       { f = push_array_no_zero(server->arena, ServerFid9P, 1); }
+
+  MemoryZeroStruct(f);
+  f->fid       = fid;
+  f->ref_count = 1;
+  f->server    = server;
+  f->open_mode = P9_OPEN_MODE_NONE;
+  server9p_fid_insert__locked(server, f);
+  return f;
+}
+
+internal String8
+server9p_fid_alloc_error__locked(Server9P *server, u32 fid)
+{
+  return server9p_fid_slot__locked(server, fid) != 0 ? str8_lit("duplicate fid") : str8_lit("out of memory");
+}
+
+internal ServerFid9P *
+server9p_fid_unhash__locked(Server9P *server, u32 fid)
+{
+  ServerFid9P **slot = server9p_fid_slot__locked(server, fid);
+  if(slot == 0) { return 0; }
+
+  ServerFid9P *f               = *slot;
+  *slot                        = FID_HASH_TOMBSTONE;
+  server->fid_count           -= 1;
+  server->fid_tombstone_count += 1;
+  return f;
+}
+
+////////////////////////////////
+//~ Output Batching
+
+// The owner is told whenever the queue starts or stops holding bytes, or
+// crosses the limit past which it should stop reading new requests
+internal void
+server9p_output_queue_changed__locked(Server9P *server, u64 old_size)
+{
+  u64 new_size = server->output_queue_size;
+  b32 changed  = (old_size == 0) != (new_size == 0) || (old_size > SERVER_OUTPUT_QUEUE_LIMIT) != (new_size > SERVER_OUTPUT_QUEUE_LIMIT);
+  if(changed && server->on_output_queue != 0) { server->on_output_queue(server); }
+}
+
+internal void
+server9p_output_enqueue__locked(Server9P *server, String8 *parts, u64 part_count, u64 skip)
+{
+  u64 size = 0;
+  for(u64 i = 0; i < part_count; i += 1) { size += parts[i].size; }
+  if(size <= skip) { return; }
+  size -= skip;
+
+  if(server->output_queue_arena == 0) { server->output_queue_arena = arena_alloc(); }
+  ServerOutputChunk9P *chunk = push_array(server->output_queue_arena, ServerOutputChunk9P, 1);
+  chunk->data                = str8(push_array_no_zero(server->output_queue_arena, u8, size), size);
+  u64 pos                    = 0;
+  for(u64 i = 0; i < part_count; i += 1)
+  {
+    String8 part = str8_skip(parts[i], skip);
+    skip        -= Min(skip, parts[i].size);
+    if(part.size > 0) { MemoryCopy(chunk->data.str + pos, part.str, part.size); }
+    pos += part.size;
+  }
+  SLLQueuePush(server->output_queue_first, server->output_queue_last, chunk);
+
+  u64 old_size = server->output_queue_size;
+  ins_atomic_u64_add_eval(&server->output_queue_size, size);
+  server9p_output_queue_changed__locked(server, old_size);
+}
+
+// Sends parts behind anything already queued; whatever a non-blocking socket
+// will not take now is copied into the queue for the owner to drain
+internal b32
+server9p_output_send__locked(Server9P *server, String8 *parts, u64 part_count)
+{
+  u64 total_size = 0;
+  for(u64 i = 0; i < part_count; i += 1) { total_size += parts[i].size; }
+  if(total_size == 0) { return 1; }
+
+  b32 queued  = server->output_queue_size > 0;
+  u64 written = queued ? 0 : msg9p_writev(server->output_fd, parts, part_count);
+  if(written == total_size) { return 1; }
+  if(!queued && errno != EAGAIN && errno != EWOULDBLOCK) { return 0; }
+  server9p_output_enqueue__locked(server, parts, part_count, written);
+  return 1;
+}
+
+// Writes every batched reply, then header and payload, with one writev
+internal b32
+server9p_output_write__locked(Server9P *server, String8 header, String8 payload)
+{
+  String8 parts[3] = {str8(server->output_batch, server->output_batch_size), header, payload};
+  u64 reply_count  = server->output_batch_count + (header.size > 0 ? 1 : 0);
+  b32 result       = server9p_output_send__locked(server, parts, ArrayCount(parts));
+  if(reply_count > 0 && server->on_output != 0) { server->on_output(server, reply_count); }
+
+  server->output_batch_size  = 0;
+  server->output_batch_count = 0;
+  if(server->output_batch != 0 && server->buffer_pool != 0)
+  {
+    server9p_buffer_pool_return(server->buffer_pool, server->output_batch, SERVER_OUTPUT_BATCH_SIZE);
+    server->output_batch = 0;
+  }
+  return result;
+}
+
+// Like TCP_CORK in user space: while the connection is corked, small
+// replies are copied into the batch instead of being written one by one
+internal b32
+server9p_output_push__locked(Server9P *server, String8 header, String8 payload)
+{
+  u64 size = header.size + payload.size;
+  if(ins_atomic_u64_eval(&server->output_cork_count) == 0 || size > SERVER_OUTPUT_COALESCE_MAX)
+  {
+    return server9p_output_write__locked(server, header, payload);
+  }
+
+  u64 now_us = os_now_microseconds();
+  if(server->output_batch_count > 0 && now_us - server->output_batch_time_us >= SERVER_OUTPUT_BATCH_DELAY_US)
+  {
+    return server9p_output_write__locked(server, header, payload);
+  }
+  if(server->output_batch_size + size > SERVER_OUTPUT_BATCH_SIZE) { server9p_output_write__locked(server, str8_zero(), str8_zero()); }
+  if(server->output_batch == 0)
+  {
+    if(server->buffer_pool != 0) { server->output_batch = server9p_buffer_pool_borrow(server->buffer_pool, SERVER_OUTPUT_BATCH_SIZE); }
+    else                         { server->output_batch = push_array_no_zero(server->arena, u8, SERVER_OUTPUT_BATCH_SIZE); }
+    if(server->output_batch == 0) { return server9p_output_write__locked(server, header, payload); }
+  }
+
+  if(server->output_batch_count == 0) { server->output_batch_time_us = now_us; }
+  MemoryCopy(server->output_batch + server->output_batch_size, header.str, header.size);
+  if(payload.size > 0) { MemoryCopy(server->output_batch + server->output_batch_size + header.size, payload.str, payload.size); }
+  server->output_batch_size  += size;
+  server->output_batch_count += 1;
+  return 1;
+}
+
+internal void
+server9p_output_cork(Server9P *server)
+{
+  ins_atomic_u64_inc_eval(&server->output_cork_count);
+}
+
+internal void
+server9p_output_uncork(Server9P *server)
+{
+  if(ins_atomic_u64_dec_eval(&server->output_cork_count) != 0) { return; }
+  MutexScope(server->write_mutex)
+  {
+    if(server->output_batch_count > 0) { server9p_output_write__locked(server, str8_zero(), str8_zero()); }
+  }
+}
+
+internal b32
+server9p_output_corked(Server9P *server)
+{
+  return ins_atomic_u64_eval(&server->output_cork_count) != 0;
+}
+
+// A batch is otherwise only checked for age when another reply joins it, so
+// whoever holds the cork open calls this to keep the delay bounded
+internal void
+server9p_output_flush_expired(Server9P *server)
+{
+  MutexScope(server->write_mutex)
+  {
+    u64 now_us = os_now_microseconds();
+    if(server->output_batch_count > 0 && now_us - server->output_batch_time_us >= SERVER_OUTPUT_BATCH_DELAY_US)
+    {
+      server9p_output_write__locked(server, str8_zero(), str8_zero());
+    }
+  }
+}
+
+// Changes only under the write mutex but is read without it
+internal u64
+server9p_output_queued(Server9P *server)
+{
+  return ins_atomic_u64_eval(&server->output_queue_size);
+}
+
+// Writes queued replies until the socket pushes back; returns 1 once the
+// queue is empty. A peer that went away takes its queued replies with it.
+internal b32
+server9p_output_drain(Server9P *server)
+{
+  b32 result = 0;
+  MutexScope(server->write_mutex)
+  {
+    u64 old_size = server->output_queue_size;
+    for(; server->output_queue_first != 0;)
+    {
+      ServerOutputChunk9P *chunk = server->output_queue_first;
+      String8 rest               = str8_skip(chunk->data, server->output_queue_pos);
+      u64 written                = msg9p_writev(server->output_fd, &rest, 1);
+      server->output_queue_pos += written;
+      ins_atomic_u64_add_eval(&server->output_queue_size, -written);
+      if(written < rest.size)
+      {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) { break; }
+        server->output_queue_first = 0;
+        break;
+      }
+      SLLQueuePop(server->output_queue_first, server->output_queue_last);
+      server->output_queue_pos = 0;
+    }
+    if(server->output_queue_first == 0)
+    {
+      if(server->output_queue_arena != 0) { arena_release(server->output_queue_arena); }
+      server->output_queue_arena = 0;
+      server->output_queue_last  = 0;
+      server->output_queue_pos   = 0;
+      ins_atomic_u64_eval_assign(&server->output_queue_size, 0);
+    }
+    server9p_output_queue_changed__locked(server, old_size);
+    result = server->output_queue_size == 0;
+  }
+  return result;
+}
+
 ////////////////////////////////
 //~ Request Handling
 
+internal b32
+server9p_request_prepare(ServerRequest9P *request, String8 msg)
+{
+  // The request owns msg until it is released, so decoded fields can view it
+  Message9P f = msg9p_view_from_str8(msg);
+  if(f.type == 0) { return 0; }
+
+  request->buffer = msg.str;
+  server9p_request_setup(request, f);
+  return 1;
+}
+
+internal void
+server9p_request_setup(ServerRequest9P *request, Message9P f)
+{
+  Server9P *server         = request->server;
+  request->tag             = f.tag;
+  request->in_msg          = f;
+  request->out_msg         = msg9p_zero();
+  request->receive_time_us = os_now_microseconds();
+
+  MutexScope(server->mutex)
+  {
+    if(!server9p_request_insert(server, request)) { request->error = str8_lit("duplicate tag"); }
+    else
+    {
+      switch(f.type)
+      {
+      case Msg9P_Tauth:
+      {
+        String8 user_id = server9p_user_name_intern__locked(server, f.user_name);
+        if(user_id.size != f.user_name.size) { request->error = str8_lit("out of memory"); }
+        else
+        {
+          request->fid = server9p_fid_alloc__locked(server, f.auth_fid);
+          if(request->fid == 0) { request->error = server9p_fid_alloc_error__locked(server, f.auth_fid); }
+          else
+          {
+            request->fid->user_id    = user_id;
+            request->fid->ref_count += 1;
+          }
+        }
+      }
+      break;
+      case Msg9P_Tattach:
+      {
+        String8 user_id = server9p_user_name_intern__locked(server, f.user_name);
+        if(user_id.size != f.user_name.size) { request->error = str8_lit("out of memory"); }
+        else
+        {
+          request->fid = server9p_fid_alloc__locked(server, f.fid);
+          if(request->fid == 0) { request->error = server9p_fid_alloc_error__locked(server, f.fid); }
+          else
+          {
+            request->fid->user_id    = user_id;
+            request->fid->ref_count += 1;
+          }
+        }
+        if(f.auth_fid != P9_FID_NONE)
+        {
+          request->auth_fid = server9p_fid_lookup__locked(server, f.auth_fid);
+          if(request->auth_fid != 0) { request->auth_fid->ref_count += 1; }
+        }
+      }
+      break;
+      case Msg9P_Twalk:
+      {
+        request->fid = server9p_fid_lookup__locked(server, f.fid);
+        if(request->fid == 0) { request->error = str8_lit("unknown fid"); break; }
+        request->fid->ref_count += 1;
+        if(f.fid != f.new_fid)
+        {
+          request->new_fid = server9p_fid_alloc__locked(server, f.new_fid);
+          if(request->new_fid == 0) { request->error = server9p_fid_alloc_error__locked(server, f.new_fid); }
+          else
+          {
+            request->new_fid->user_id    = request->fid->user_id;
+            request->new_fid->ref_count += 1;
+          }
+        }
+        else { request->new_fid = request->fid; }
+      }
+      break;
+      case Msg9P_Topen:
+      case Msg9P_Tcreate:
+      case Msg9P_Tread:
+      case Msg9P_Twrite:
+      case Msg9P_Tstat:
+      case Msg9P_Twstat:
+      case Msg9P_Tclunk:
+      case Msg9P_Tremove:
+      {
+        request->fid = server9p_fid_lookup__locked(server, f.fid);
+        if(request->fid == 0) { request->error = str8_lit("unknown fid"); }
+        else                  { request->fid->ref_count += 1; }
+      }
+      break;
+      default: break;
+      }
+    }
+  }
+}
+
 internal ServerRequest9P *
 server9p_get_request(Server9P *server)
 {
-  Temp    scratch = scratch_begin(&server->arena, 1);
-  String8 msg     = read_9p_msg(scratch.arena, server->input_fd);
-
-  if(msg.size == 0)
+  if(!server9p_input_reader_acquire(server)) { return 0; }
+  ServerRequest9P *request = server9p_request_alloc(server);
+  String8 msg              = msg9p_reader_read(request->arena, &server->input_reader, server->input_fd);
+  server9p_input_reader_release(server, 0);
+  if(msg.size == 0 || !server9p_request_prepare(request, msg))
   {
-    scratch_end(scratch);
+    server9p_request_release(request);
     return 0;
   }
+  return request;
+}
+
+////////////////////////////////
+//~ Splice Input Helpers
 
-  Message9P f = msg9p_from_str8(scratch.arena, msg);
-  if(f.type == 0)
+internal ServerSplicePipe9P *
+server9p_splice_pipe_alloc(Server9P *server)
+{
+  ServerSplicePipe9P *result = 0;
+  MutexScope(server->mutex)
   {
-    scratch_end(scratch);
-    return 0;
+    result = server->splice_pipe_free;
+    if(result != 0)
+    {
+      SLLStackPop(server->splice_pipe_free);
+      if(result->fds[0] >= 0) { server->splice_pipe_free_count -= 1; }
+    }
+    else if(server9p_memory_available__locked(server, sizeof(ServerSplicePipe9P)))
+    {
+      result         = push_array(server->arena, ServerSplicePipe9P, 1);
+      result->fds[0] = -1;
+      result->fds[1] = -1;
+    }
   }
+  if(result != 0 && result->fds[0] < 0)
+  {
+    if(pipe2(result->fds, O_CLOEXEC) != 0)
+    {
+      result->fds[0] = -1;
+      result->fds[1] = -1;
+    }
+    else
+    {
+      fcntl(result->fds[1], F_SETPIPE_SZ, SERVER_SPLICE_PIPE_SIZE);
+      int pipe_size    = fcntl(result->fds[1], F_GETPIPE_SZ);
+      result->capacity = pipe_size > 0 ? (u64)pipe_size : KB(64);
+    }
+  }
+  return result;
+}
 
-  ServerRequest9P *request = server9p_request_alloc(server, f.tag);
-  if(request == 0)
+// Only an empty pipe is kept for reuse; one still holding payload bytes is closed
+internal void
+server9p_splice_pipe_release(Server9P *server, ServerSplicePipe9P *pipe, b32 empty)
+{
+  MutexScope(server->mutex)
   {
-    request          = push_array(server->arena, ServerRequest9P, 1);
-    request->tag     = f.tag;
-    request->in_msg  = f;
-    request->error   = str8_lit("duplicate tag");
-    request->buffer  = msg.str;
-    request->server  = server;
-    request->scratch = scratch;
-    return request;
+    if(pipe->fds[0] >= 0 && (!empty || server->splice_pipe_free_count >= SERVER_SPLICE_PIPE_KEEP))
+    {
+      close(pipe->fds[0]);
+      close(pipe->fds[1]);
+      pipe->fds[0] = -1;
+      pipe->fds[1] = -1;
+    }
+    SLLStackPush(server->splice_pipe_free, pipe);
+    if(pipe->fds[0] >= 0) { server->splice_pipe_free_count += 1; }
   }
+}
+
+internal void
+server9p_input_splice_begin(Server9P *server)
+{
+  // Only the fixed Twrite header and whatever followed it in the reader have
+  // been received; the rest of the payload moves from the socket into a pipe
+  // the request owns, and the worker handling it writes the pipe to the file
+  u8 *ptr = server->input_msg.str;
+  if(ptr[P9_MESSAGE_SIZE_FIELD_SIZE] != Msg9P_Twrite) { return; }
+
+  u32 tag   = from_le_u16(read_u16(ptr + P9_MESSAGE_SIZE_FIELD_SIZE + P9_MESSAGE_TYPE_FIELD_SIZE));
+  u32 count = from_le_u32(read_u32(ptr + P9_MESSAGE_MINIMUM_SIZE + 4 + 8));
+  if(count != server->input_msg.size - SERVER_TWRITE_HEADER_SIZE) { return; }
+
+  // A Twrite refused for its tag takes the ordinary path to its error
+  b32 tag_in_use = 0;
+  MutexScope(server->mutex) { tag_in_use = server9p_request_lookup(server, tag) != 0; }
+  if(tag_in_use) { return; }
 
-  request->server    = server;
-  request->responded = 0;
-  request->buffer    = msg.str;
-  request->in_msg    = f;
-  request->out_msg   = msg9p_zero();
-  request->scratch   = scratch;
-  switch(f.type)
+  u64 head_count           = server->input_pos - SERVER_TWRITE_HEADER_SIZE;
+  ServerSplicePipe9P *pipe = server9p_splice_pipe_alloc(server);
+  if(pipe == 0) { return; }
+  if(pipe->fds[0] < 0 || count - head_count > pipe->capacity)
   {
-  case Msg9P_Tauth:
+    server9p_splice_pipe_release(server, pipe, 1);
+    return;
+  }
+
+  ServerRequest9P *request       = server->input_request;
+  request->splice_pipe           = pipe;
+  request->splice_head_size      = head_count;
+  request->splice_size           = 0;
+  server->input_splice_remaining = count - head_count;
+}
+
+// A pipe can fill before its capacity when the socket hands over small
+// fragments; what it holds is read back and the payload is received normally
+internal void
+server9p_input_splice_spill(Server9P *server)
+{
+  ServerRequest9P *request = server->input_request;
+  ServerSplicePipe9P *pipe = request->splice_pipe;
+  for(; request->splice_size > 0;)
   {
-    request->fid = server9p_fid_alloc(server, f.auth_fid);
-    if(request->fid == 0) { request->error        = str8_lit("duplicate fid"); }
-    else                  { request->fid->user_id = str8_copy(server->arena, f.user_name); }
+    ssize_t read_result = read(pipe->fds[0], server->input_msg.str + server->input_pos, request->splice_size);
+    if(read_result > 0)                        { server->input_pos += read_result; request->splice_size -= read_result; }
+    else if(read_result < 0 && errno == EINTR) { continue; }
+    else                                       { server->input_closed = 1; break; }
   }
-  break;
-  case Msg9P_Tattach:
+  server9p_splice_pipe_release(server, pipe, request->splice_size == 0);
+  request->splice_pipe           = 0;
+  request->splice_size           = 0;
+  server->input_splice_remaining = 0;
+}
+
+internal b32
+server9p_input_splice(Server9P *server)
+{
+  // Only ask splice for bytes already queued so the I/O thread never waits
+  // on a slow sender
+  int available = 0;
+  if(ioctl(server->input_fd, FIONREAD, &available) != 0) { server->input_closed = 1; return 0; }
+  if(available == 0)
   {
-    request->fid = server9p_fid_alloc(server, f.fid);
-    if(request->fid == 0) { request->error        = str8_lit("duplicate fid"); }
-    else                  { request->fid->user_id = str8_copy(server->arena, f.user_name); }
+    u8 peek             = 0;
+    ssize_t peek_result = recv(server->input_fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+    if(peek_result > 0)                                              { return 1; }
+    if(peek_result < 0 && errno == EINTR)                            { return 1; }
+    if(peek_result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { return 0; }
+    server->input_closed = 1;
+    return 0;
   }
-  break;
-  case Msg9P_Twalk:
+
+  ServerRequest9P *request = server->input_request;
+  u64 chunk_size           = Min(server->input_splice_remaining, (u64)available);
+  ssize_t splice_result    = splice(server->input_fd, 0, request->splice_pipe->fds[1], 0, chunk_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if(splice_result < 0 && errno == EINTR)                            { return 1; }
+  if(splice_result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { server9p_input_splice_spill(server); return !server->input_closed; }
+  if(splice_result <= 0)                                             { server->input_closed = 1; return 0; }
+  server->input_splice_remaining -= splice_result;
+  request->splice_size           += splice_result;
+  return 1;
+}
+
+internal ServerRequest9P *
+server9p_input_splice_finish(Server9P *server)
+{
+  ServerRequest9P *request = server->input_request;
+  u8 *ptr                  = server->input_msg.str;
+
+  Message9P f   = msg9p_zero();
+  f.type        = Msg9P_Twrite;
+  f.tag         = from_le_u16(read_u16(ptr + P9_MESSAGE_SIZE_FIELD_SIZE + P9_MESSAGE_TYPE_FIELD_SIZE));
+  f.fid         = from_le_u32(read_u32(ptr + P9_MESSAGE_MINIMUM_SIZE));
+  f.file_offset = from_le_u64(read_u64(ptr + P9_MESSAGE_MINIMUM_SIZE + 4));
+  f.byte_count  = from_le_u32(read_u32(ptr + P9_MESSAGE_MINIMUM_SIZE + 4 + 8));
+
+  request->buffer  = ptr;
+  request->spliced = 1;
+  server9p_request_setup(request, f);
+
+  server->input_request = 0;
+  server->input_msg     = str8_zero();
+  server->input_pos     = 0;
+  return request;
+}
+
+internal ServerRequest9P *
+server9p_try_get_request(Server9P *server)
+{
+  MsgReader9P *reader     = &server->input_reader;
+  ServerRequest9P *result = 0;
+  for(; result == 0 && !server->input_closed;)
   {
-    request->fid = server9p_fid_lookup(server, f.fid);
-    if(request->fid == 0) { request->error = str8_lit("unknown fid"); }
-    else if(f.fid != f.new_fid)
+    //- move a large Twrite payload from the socket into the request's pipe
+    if(server->input_request != 0 && server->input_request->splice_pipe != 0)
+    {
+      if(server->input_splice_remaining == 0)  { result = server9p_input_splice_finish(server); }
+      else if(!server9p_input_splice(server)) { break; }
+      continue;
+    }
+
+    //- receive the rest of a message larger than the reader straight into the request
+    if(server->input_request != 0)
+    {
+      if(server->input_pos < server->input_limit)
+      {
+        ssize_t recv_result = recv(server->input_fd, server->input_msg.str + server->input_pos, server->input_limit - server->input_pos, MSG_DONTWAIT);
+        reader->recv_count += 1;
+        if(recv_result > 0)                                              { server->input_pos += recv_result; continue; }
+        if(recv_result < 0 && errno == EINTR)                            { continue; }
+        if(recv_result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { break; }
+        server->input_closed = 1;
+        break;
+      }
+      if(server->input_limit < server->input_msg.size)
+      {
+        server->input_limit = server->input_msg.size;
+        server9p_input_splice_begin(server);
+        continue;
+      }
+
+      ServerRequest9P *request = server->input_request;
+      String8 msg              = server->input_msg;
+      server->input_request    = 0;
+      server->input_msg        = str8_zero();
+      server->input_pos        = 0;
+      if(server9p_request_prepare(request, msg)) { result = request; }
+      else
+      {
+        server9p_request_release(request);
+        server->input_closed = 1;
+      }
+      continue;
+    }
+
+    //- hand out messages already buffered; receive more only when the next is incomplete
+    if(!server9p_input_reader_acquire(server)) { server->input_closed = 1; break; }
+    u64 buffered = msg9p_reader_buffered(reader);
+    u32 msg_size = msg9p_reader_next_size(reader);
+    if(buffered >= P9_MESSAGE_SIZE_FIELD_SIZE && (msg_size < P9_MESSAGE_MINIMUM_SIZE || msg_size > server->max_message_size))
+    {
+      server->input_closed = 1;
+      break;
+    }
+    if(buffered < P9_MESSAGE_SIZE_FIELD_SIZE || (buffered < msg_size && msg_size <= reader->capacity))
+    {
+      s64 fill_result = msg9p_reader_fill(reader, server->input_fd, 1);
+      if(fill_result > 0)                                              { continue; }
+      if(fill_result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { break; }
+      server->input_closed = 1;
+      break;
+    }
+
+    ServerRequest9P *request = server9p_request_alloc(server);
+    String8 msg              = str8_zero();
+    if(server->buffer_pool != 0)
+    {
+      request->pool_buffer = str8(server9p_buffer_pool_borrow(server->buffer_pool, msg_size), msg_size);
+      if(request->pool_buffer.str == 0) { request->pool_buffer = str8_zero(); }
+      msg = request->pool_buffer;
+    }
+    else { msg = str8(push_array_no_zero(request->arena, u8, msg_size), msg_size); }
+    if(msg.size == 0)
+    {
+      server9p_request_release(request);
+      server->input_closed = 1;
+      break;
+    }
+
+    String8 head = msg9p_reader_take(reader, msg_size);
+    MemoryCopy(msg.str, head.str, head.size);
+    if(head.size < msg_size)
+    {
+      server->input_request = request;
+      server->input_msg     = msg;
+      server->input_pos     = head.size;
+      server->input_limit   = msg_size;
+
+      // Stop after the fixed Twrite header when the payload may be spliced
+      if(server->splice_writes && msg_size >= SERVER_TWRITE_HEADER_SIZE + SERVER_SPLICE_WRITE_MIN)
+      {
+        server->input_limit = Max(SERVER_TWRITE_HEADER_SIZE, head.size);
+      }
+      continue;
+    }
+
+    if(server9p_request_prepare(request, msg)) { result = request; }
+    else
     {
-      request->new_fid = server9p_fid_alloc(server, f.new_fid);
-      if(request->new_fid == 0) { request->error            = str8_lit("duplicate fid"); }
-      else                      { request->new_fid->user_id = str8_copy(server->arena, request->fid->user_id); }
+      server9p_request_release(request);
+      server->input_closed = 1;
     }
-    else { request->new_fid = request->fid; }
   }
-  break;
-  case Msg9P_Topen:
-  case Msg9P_Tcreate:
-  case Msg9P_Tread:
-  case Msg9P_Twrite:
-  case Msg9P_Tstat:
-  case Msg9P_Twstat:
-  case Msg9P_Tclunk:
-  case Msg9P_Tremove:
+
+  server9p_input_reader_release(server, server->input_closed);
+  if(server->input_closed && server->input_request != 0)
   {
-    request->fid = server9p_fid_lookup(server, f.fid);
-    if(request->fid == 0) { request->error = str8_lit("unknown fid"); }
+    server9p_request_release(server->input_request);
+    server->input_request = 0;
   }
-  break;
-  default: break;
+  return result;
+}
+
+internal b32
+server9p_respond__begin(ServerRequest9P *request, ServerRequest9P **flush_first_out)
+{
+  Server9P *server      = request->server;
+  b32 already_responded = 0;
+
+  // Responses may come from any worker thread; claim the request and detach
+  // pending flushes under the server mutex so each Rflush follows its request
+  MutexScope(server->mutex)
+  {
+    already_responded = request->responded;
+    if(!already_responded)
+    {
+      request->responded = 1;
+      server9p_request_remove(server, request);
+      *flush_first_out     = request->flush_first;
+      request->flush_first = 0;
+      request->flush_last  = 0;
+    }
+  }
+  return !already_responded;
+}
+
+internal void
+server9p_respond__end(ServerRequest9P *request, ServerRequest9P *flush_first)
+{
+  if(request->new_fid != 0 && request->new_fid != request->fid) { server9p_fid_release(request->new_fid); }
+  if(request->fid != 0)      { server9p_fid_release(request->fid); }
+  if(request->auth_fid != 0) { server9p_fid_release(request->auth_fid); }
+  server9p_request_release(request);
+
+  for(ServerRequest9P *flush = flush_first, *next = 0; flush != 0; flush = next)
+  {
+    next = flush->flush_next;
+    server9p_respond(flush, str8_zero());
   }
-  return request;
 }
 
 internal b32
 server9p_respond(ServerRequest9P *request, String8 err)
 {
-  Server9P *server = request->server;
-  if(request->responded != 0) { return 0; }
+  Server9P *server             = request->server;
+  ServerRequest9P *flush_first = 0;
+  if(!server9p_respond__begin(request, &flush_first)) { return 0; }
 
-  request->responded    = 1;
   request->error        = err;
   request->out_msg.tag  = request->in_msg.tag;
   request->out_msg.type = request->in_msg.type + 1;
@@ -176,126 +1115,290 @@ server9p_respond(ServerRequest9P *request, String8 err)
     request->out_msg.type          = Msg9P_Rerror;
   }
 
-  String8 buf = str8_from_msg9p(request->scratch.arena, request->out_msg);
-  if(buf.size == 0)
+  // An Rread payload goes out from the handler's buffer alongside the header
+  b32 result      = 0;
+  String8 payload = str8_zero();
+  String8 header  = str8_from_msg9p_header(request->scratch.arena, request->out_msg, &payload);
+  if(header.size > 0)
   {
-    scratch_end(request->scratch);
-    request->hash_next        = server->request_free_list;
-    server->request_free_list = request;
-    return 0;
+    MutexScope(server->write_mutex) { result = server9p_output_push__locked(server, header, payload); }
   }
+  if(server->on_respond != 0) { server->on_respond(request); }
 
-  server9p_request_remove(server, request->in_msg.tag);
+  server9p_respond__end(request, flush_first);
+  return result;
+}
 
-  u64 total_num_bytes_to_write      = buf.size;
-  u64 total_num_bytes_written       = 0;
-  u64 total_num_bytes_left_to_write = total_num_bytes_to_write;
+internal b32
+server9p_respond_read_file(ServerRequest9P *request, u64 file_fd, Rng1U64 range)
+{
+  Server9P *server             = request->server;
+  ServerRequest9P *flush_first = 0;
+  if(!server9p_respond__begin(request, &flush_first)) { return 0; }
+
+  request->out_msg.tag        = request->in_msg.tag;
+  request->out_msg.type       = Msg9P_Rread;
+  request->out_msg.byte_count = dim_1u64(range);
+
+  // Rread is size[4] type[1] tag[2] count[4] data[count]; the header goes out
+  // from the scratch arena and the payload moves file->socket in the kernel
+  u64 count       = dim_1u64(range);
+  u64 header_size = P9_MESSAGE_SIZE_FIELD_SIZE + P9_MESSAGE_TYPE_FIELD_SIZE + P9_MESSAGE_TAG_FIELD_SIZE + P9_MESSAGE_SIZE_FIELD_SIZE;
+  String8 header  = str8(push_array_no_zero(request->scratch.arena, u8, header_size), header_size);
+  u8 *ptr         = header.str;
+  write_u32(ptr, from_le_u32((u32)(header_size + count)));
+  ptr += P9_MESSAGE_SIZE_FIELD_SIZE;
+  *ptr = (u8)Msg9P_Rread;
+  ptr += P9_MESSAGE_TYPE_FIELD_SIZE;
+  write_u16(ptr, from_le_u16((u16)request->out_msg.tag));
+  ptr += P9_MESSAGE_TAG_FIELD_SIZE;
+  write_u32(ptr, from_le_u32((u32)count));
 
-  for(; total_num_bytes_left_to_write > 0;)
+  b32 result = 0;
+  MutexScope(server->write_mutex)
   {
-    ssize_t write_result = write(server->output_fd, buf.str + total_num_bytes_written, total_num_bytes_left_to_write);
-    if(write_result >= 0)
+    u64 total_num_bytes_sent = 0;
+    // Batched replies precede the header so the stream stays in reply order
+    if(server9p_output_write__locked(server, header, str8_zero()))
     {
-      total_num_bytes_written += write_result;
-      total_num_bytes_left_to_write -= write_result;
+      // Once the socket pushes back the rest goes into the queue as a copy
+      off_t file_offset = (off_t)range.min;
+      for(; server->output_queue_size == 0 && total_num_bytes_sent < count;)
+      {
+        ssize_t send_result = sendfile(server->output_fd, file_fd, &file_offset, count - total_num_bytes_sent);
+        if(send_result > 0)                        { total_num_bytes_sent += send_result; }
+        else if(send_result < 0 && errno == EINTR) { continue; }
+        else                                       { break; }
+      }
+
+      // The header already promised count bytes, so a file that shrank under
+      // us or a source sendfile refuses is finished from a copy to keep framing
+      if(total_num_bytes_sent < count)
+      {
+        u64 remaining = count - total_num_bytes_sent;
+        String8 tail  = str8(push_array(request->scratch.arena, u8, remaining), remaining);
+        for(u64 tail_pos = 0; tail_pos < tail.size;)
+        {
+          ssize_t read_result = pread(file_fd, tail.str + tail_pos, tail.size - tail_pos, (off_t)(range.min + total_num_bytes_sent + tail_pos));
+          if(read_result > 0)                        { tail_pos += read_result; }
+          else if(read_result < 0 && errno == EINTR) { continue; }
+          else                                       { break; }
+        }
+        if(server9p_output_send__locked(server, &tail, 1)) { total_num_bytes_sent += tail.size; }
+      }
     }
-    else if(errno == EINTR) { continue; }
-    else
+    result = total_num_bytes_sent == count;
+  }
+  if(server->on_respond != 0) { server->on_respond(request); }
+
+  server9p_respond__end(request, flush_first);
+  return result;
+}
+
+internal void
+server9p_flush(ServerRequest9P *request)
+{
+  Server9P *server = request->server;
+  b32 pending      = 0;
+  MutexScope(server->mutex)
+  {
+    ServerRequest9P *old_request = server9p_request_lookup(server, request->in_msg.cancel_tag);
+    if(old_request != 0 && old_request != request && !old_request->responded)
     {
-      scratch_end(request->scratch);
-      request->hash_next        = server->request_free_list;
-      server->request_free_list = request;
-      return 0;
+      ins_atomic_u32_eval_assign(&old_request->flushed, 1);
+      SLLQueuePush_N(old_request->flush_first, old_request->flush_last, request, flush_next);
+      old_request->flush_count += 1;
+      request->old_request      = old_request;
+      pending                   = 1;
     }
   }
 
-  scratch_end(request->scratch);
-  request->hash_next        = server->request_free_list;
-  server->request_free_list = request;
-
-  return total_num_bytes_written == total_num_bytes_to_write;
+  // Rflush for an in-flight request is sent after its original reply
+  if(!pending) { server9p_respond(request, str8_zero()); }
 }
 
-////////////////////////////////
-//~ Fid Management
+internal b32
+server9p_request_is_flushed(ServerRequest9P *request)
+{
+  return ins_atomic_u32_eval(&request->flushed) != 0;
+}
 
-internal ServerFid9P *
-server9p_fid_alloc(Server9P *server, u32 fid)
+// Writes a spliced Twrite payload to file_fd at the request's offset: the
+// bytes that arrived with the header first, then the pipe. Whatever the file
+// refuses is drained so the pipe can be reused; returns the bytes written.
+internal u64
+server9p_request_splice_payload(ServerRequest9P *request, int file_fd)
 {
-  if(server9p_fid_lookup(server, fid) != 0) { return 0; }
+  ServerSplicePipe9P *pipe = request->splice_pipe;
+  u8 *head                 = request->buffer + SERVER_TWRITE_HEADER_SIZE;
+  u64 result               = 0;
+  b32 failed               = 0;
+  for(; result < request->splice_head_size && !failed;)
+  {
+    ssize_t write_result = pwrite(file_fd, head + result, request->splice_head_size - result, (off_t)(request->in_msg.file_offset + result));
+    if(write_result > 0)                        { result += write_result; }
+    else if(write_result < 0 && errno == EINTR) { continue; }
+    else                                        { failed = 1; }
+  }
 
-  u32 slot_idx = max_u32;
-  for(u32 i = 0; i < server->fid_capacity; i += 1)
+  for(; request->splice_size > 0;)
   {
-    if(server->fid_storage[i].fid == 0)
+    if(!failed)
     {
-      slot_idx = i;
-      break;
+      loff_t file_offset   = (loff_t)(request->in_msg.file_offset + result);
+      ssize_t write_result = splice(pipe->fds[0], 0, file_fd, &file_offset, request->splice_size, SPLICE_F_MOVE);
+      if(write_result > 0)
+      {
+        result               += write_result;
+        request->splice_size -= write_result;
+        continue;
+      }
+      if(write_result < 0 && errno == EINTR) { continue; }
+      failed = 1;
     }
-  }
-  if(slot_idx == max_u32) { return 0; }
 
-  ServerFid9P *f = &server->fid_storage[slot_idx];
-  f->fid         = fid;
-  f->qid         = (Qid){0};
-  f->auxiliary   = 0;
-  f->server      = server;
-  f->open_mode   = P9_OPEN_MODE_NONE;
-  f->user_id     = str8_zero();
-  f->offset      = 0;
+    u8 discard[4096];
+    ssize_t read_result = read(pipe->fds[0], discard, Min(request->splice_size, sizeof(discard)));
+    if(read_result > 0)                        { request->splice_size -= read_result; }
+    else if(read_result < 0 && errno == EINTR) { continue; }
+    else                                       { break; }
+  }
+  return result;
+}
 
-  u32 hash = fid % server->fid_hash_capacity;
-  for(u32 probe = 0; probe < server->fid_hash_capacity; probe += 1)
+// Reads a spliced Twrite payload back into the request buffer, for fids whose
+// writes cannot be spliced into a file
+internal b32
+server9p_request_read_payload(ServerRequest9P *request)
+{
+  ServerSplicePipe9P *pipe = request->splice_pipe;
+  u8 *data                 = request->buffer + SERVER_TWRITE_HEADER_SIZE;
+  u64 size                 = request->splice_head_size;
+  for(; request->splice_size > 0;)
   {
-    u32 idx = (hash + probe) % server->fid_hash_capacity;
-    u32 val = server->fid_hash_table[idx];
-    if(val == FID_HASH_EMPTY || val == FID_HASH_TOMBSTONE)
-    {
-      server->fid_hash_table[idx] = slot_idx;
-      break;
-    }
+    ssize_t read_result = read(pipe->fds[0], data + size, request->splice_size);
+    if(read_result > 0)                        { size += read_result; request->splice_size -= read_result; }
+    else if(read_result < 0 && errno == EINTR) { continue; }
+    else                                       { break; }
   }
+  request->in_msg.payload_data = str8(data, size);
+  request->spliced             = 0;
+  return size == request->in_msg.byte_count;
+}
 
-  server->fid_count += 1;
-  return f;
+////////////////////////////////
+//~ Fid Management
+
+internal ServerFid9P *
+server9p_fid_alloc(Server9P *server, u32 fid)
+{
+  ServerFid9P *result = 0;
+  MutexScope(server->mutex) { result = server9p_fid_alloc__locked(server, fid); }
+  return result;
 }
 
 internal ServerFid9P *
 server9p_fid_lookup(Server9P *server, u32 fid)
 {
-  u32 hash = fid % server->fid_hash_capacity;
-  for(u32 probe = 0; probe < server->fid_hash_capacity; probe += 1)
-  {
-    u32 idx      = (hash + probe) % server->fid_hash_capacity;
-    u32 slot_idx = server->fid_hash_table[idx];
-    if(slot_idx == FID_HASH_EMPTY)     { return 0; }
-    if(slot_idx == FID_HASH_TOMBSTONE) { continue; }
-
-    ServerFid9P *f = &server->fid_storage[slot_idx];
-    if(f->fid == fid) { return f; }
-  }
-  return 0;
+  ServerFid9P *result = 0;
+  MutexScope(server->mutex) { result = server9p_fid_lookup__locked(server, fid); }
+  return result;
 }
 
 internal ServerFid9P *
 server9p_fid_remove(Server9P *server, u32 fid)
 {
-  u32 hash = fid % server->fid_hash_capacity;
-  for(u32 probe = 0; probe < server->fid_hash_capacity; probe += 1)
+  ServerFid9P *result = 0;
+  MutexScope(server->mutex) { result = server9p_fid_unhash__locked(server, fid); }
+  if(result != 0) { server9p_fid_release(result); }
+  return result;
+}
+
+internal void
+server9p_fid_remove_all(Server9P *server)
+{
+  // Removal only leaves tombstones, so the table can be walked in place
+  for(u32 i = 0; i < server->fid_hash_capacity; i += 1)
   {
-    u32 idx      = (hash + probe) % server->fid_hash_capacity;
-    u32 slot_idx = server->fid_hash_table[idx];
-    if(slot_idx == FID_HASH_EMPTY)     { return 0; }
-    if(slot_idx == FID_HASH_TOMBSTONE) { continue; }
+    ServerFid9P *f = server->fid_hash_table[i];
+    if(f != 0 && f != FID_HASH_TOMBSTONE) { server9p_fid_remove(server, f->fid); }
+  }
+}
 
-    ServerFid9P *f = &server->fid_storage[slot_idx];
-    if(f->fid == fid)
+internal void
+server9p_fid_release(ServerFid9P *fid)
+{
+  Server9P *server = fid->server;
+  b32 destroy      = 0;
+  MutexScope(server->mutex)
+  {
+    destroy = fid->ref_count == 1;
+    if(!destroy) { fid->ref_count -= 1; }
+  }
+
+  // Return the fid to the free list only after the destroy callback has run
+  if(destroy)
+  {
+    if(server->fid_destroy != 0) { server->fid_destroy(fid); }
+    MutexScope(server->mutex)
     {
-      server->fid_hash_table[idx] = FID_HASH_TOMBSTONE;
-      f->fid                      = 0;
-      server->fid_count          -= 1;
-      return f;
+      for(ServerFidBlock9P *block = fid->storage, *next = 0; block != 0; block = next)
+      {
+        next                       = block->next;
+        server->fid_storage_bytes -= block->capacity;
+        SLLStackPush_N(server->fid_block_free[block->class_idx], block, next);
+      }
+      fid->storage   = 0;
+      fid->auxiliary = 0;
+      fid->ref_count = 0;
+      SLLStackPush_N(server->fid_free_list, fid, free_next);
     }
   }
-  return 0;
+}
+
+// Returns zeroed memory that is reclaimed when the fid is clunked or removed,
+// or 0 when the connection's memory limit is spent or size exceeds the
+// largest block class.
+internal void *
+server9p_fid_push(ServerFid9P *fid, u64 size)
+{
+  Server9P *server = fid->server;
+  u64 header_size  = AlignPow2(sizeof(ServerFidBlock9P), 16);
+  u64 aligned_size = AlignPow2(size, 16);
+  void *result     = 0;
+  MutexScope(server->mutex)
+  {
+    ServerFidBlock9P *block = fid->storage;
+    if(block == 0 || block->pos + aligned_size > block->capacity)
+    {
+      block         = 0;
+      u64 class_idx = 0;
+      for(; class_idx < SERVER_FID_BLOCK_CLASS_COUNT && (SERVER_FID_BLOCK_SIZE_MIN << class_idx) < aligned_size;) { class_idx += 1; }
+      if(class_idx < SERVER_FID_BLOCK_CLASS_COUNT)
+      {
+        u64 capacity = SERVER_FID_BLOCK_SIZE_MIN << class_idx;
+        block        = server->fid_block_free[class_idx];
+        if(block != 0) { SLLStackPop_N(server->fid_block_free[class_idx], next); }
+        else if(server9p_memory_available__locked(server, header_size + capacity))
+        {
+          block            = (ServerFidBlock9P *)push_array_no_zero_aligned(server->arena, u8, header_size + capacity, 16);
+          block->class_idx = class_idx;
+          block->capacity  = capacity;
+        }
+      }
+      if(block != 0)
+      {
+        block->pos                 = 0;
+        server->fid_storage_bytes += block->capacity;
+        SLLStackPush_N(fid->storage, block, next);
+      }
+    }
+    if(block != 0)
+    {
+      result      = (u8 *)block + header_size + block->pos;
+      block->pos += aligned_size;
+    }
+  }
+  if(result != 0) { MemoryZero(result, size); }
+  return result;
 }
@@ -1,74 +1,205 @@
 #ifndef _9P_SERVER_H
 #define _9P_SERVER_H
 
+////////////////////////////////
+//~ Includes
+
+#include <sys/ioctl.h>
+
 ////////////////////////////////
 //~ Constants
 
-#define FID_HASH_EMPTY     max_u32
-#define FID_HASH_TOMBSTONE (max_u32 - 1)
+#define FID_HASH_CAPACITY_MIN 64
+#define FID_HASH_TOMBSTONE    (&server9p_fid_tombstone)
+
+#define SERVER_TWRITE_HEADER_SIZE  (P9_MESSAGE_MINIMUM_SIZE + 4 + 8 + 4)
+#define SERVER_SPLICE_WRITE_MIN    KB(64)
+#define SERVER_SPLICE_PIPE_SIZE    MB(1)
+#define SERVER_SPLICE_PIPE_KEEP    4
+
+#define SERVER_FID_BLOCK_SIZE_MIN    KB(1)
+#define SERVER_FID_BLOCK_CLASS_COUNT 7
+#define SERVER_USER_NAME_SLOT_COUNT  64
+
+#define SERVER_BUFFER_CLASS_MIN       KB(4)
+#define SERVER_BUFFER_CLASS_COUNT     14
+#define SERVER_BUFFER_POOL_ARENA_MAX  256
+#define SERVER_REQUEST_ARENA_KEEP     KB(256)
+
+#define SERVER_OUTPUT_BATCH_SIZE      KB(64)
+#define SERVER_OUTPUT_COALESCE_MAX    KB(4)
+#define SERVER_OUTPUT_BATCH_DELAY_US  1000
+#define SERVER_OUTPUT_QUEUE_LIMIT     MB(4)
 
 ////////////////////////////////
 //~ Server Types
 
 typedef struct Server9P Server9P;
 typedef struct ServerFid9P ServerFid9P;
+typedef struct ServerRequest9P ServerRequest9P;
 typedef struct FidAuxiliary9P FidAuxiliary9P;
+typedef struct ServerFidBlock9P ServerFidBlock9P;
+typedef struct ServerUserName9P ServerUserName9P;
+typedef struct ServerBufferPool9P ServerBufferPool9P;
+typedef struct ServerOutputChunk9P ServerOutputChunk9P;
+typedef struct ServerSplicePipe9P ServerSplicePipe9P;
+
+typedef void ServerFidDestroyFunction9P(ServerFid9P *fid);
+typedef void ServerRespondFunction9P(ServerRequest9P *request);
+typedef void ServerOutputFunction9P(Server9P *server, u64 reply_count);
+typedef void ServerOutputQueueFunction9P(Server9P *server);
+
+// Storage that lives exactly as long as one fid; blocks come from per-size
+// class free lists on the server and return there when the fid is destroyed
+struct ServerFidBlock9P
+{
+  ServerFidBlock9P *next;
+  u64 class_idx;
+  u64 capacity;
+  u64 pos;
+};
+
+struct ServerUserName9P
+{
+  ServerUserName9P *hash_next;
+  String8 name;
+};
+
+// Message buffers and request arenas shared by every connection of a
+// process; connections borrow them only while a request is in flight
+struct ServerBufferPool9P
+{
+  Mutex mutex;
+  u8 *free_buffers[SERVER_BUFFER_CLASS_COUNT];
+  u64 idle_limit;
+  u64 idle_bytes;
+  u64 idle_count;
+  u64 in_use_bytes;
+  u64 in_use_count;
+  Arena **free_arenas;
+  u64 free_arena_count;
+  u64 arena_in_use_count;
+};
+
+// Reply bytes a non-blocking socket would not take yet, in stream order
+struct ServerOutputChunk9P
+{
+  ServerOutputChunk9P *next;
+  String8 data;
+};
+
+// Holds one large Twrite payload between the I/O thread that receives it
+// and the worker that writes it out
+struct ServerSplicePipe9P
+{
+  ServerSplicePipe9P *next;
+  int fds[2];
+  u64 capacity;
+};
 
 struct ServerFid9P
 {
+  ServerFid9P *free_next;
   u32 fid;
+  u32 ref_count;
   Qid qid;
   void *auxiliary;
   Server9P *server;
   u32 open_mode;
   String8 user_id;
   u64 offset;
+  ServerFidBlock9P *storage;
 };
 
-typedef struct ServerRequest9P ServerRequest9P;
 struct ServerRequest9P
 {
   u32 tag;
   u32 responded;
+  u32 flushed;
   Message9P in_msg;
   Message9P out_msg;
   ServerFid9P *fid;
   ServerFid9P *new_fid;
   ServerFid9P *auth_fid;
   ServerRequest9P *old_request;
-  ServerRequest9P **flush;
+  ServerRequest9P *flush_first;
+  ServerRequest9P *flush_last;
+  ServerRequest9P *flush_next;
   u32 flush_count;
   String8 error;
   u8 *buffer;
+  String8 pool_buffer;
   u8 *read_buffer;
   void *auxiliary;
   Server9P *server;
   ServerRequest9P *hash_next;
+  Arena *arena;
   Temp scratch;
+  b32 spliced;
+  ServerSplicePipe9P *splice_pipe;
+  u64 splice_head_size;
+  u64 splice_size;
+  u64 receive_time_us;
 };
 
 struct Server9P
 {
   Arena *arena;
+  Mutex mutex;
+  Mutex write_mutex;
+  CondVar idle_cond;
   u64 input_fd;
   u64 output_fd;
   u32 max_message_size;
-  u8 *read_buffer;
-  u8 *write_buffer;
+  u32 max_message_size_limit;
+
+  ServerRequest9P *input_request;
+  String8 input_msg;
+  u64 input_pos;
+  u64 input_limit;
+  MsgReader9P input_reader;
+  b32 input_closed;
 
-  ServerFid9P *fid_storage;
-  u32 *fid_hash_table;
+  u64 input_splice_remaining;
+  b32 splice_writes;
+  ServerSplicePipe9P *splice_pipe_free;
+  u64 splice_pipe_free_count;
+
+  ServerFid9P **fid_hash_table;
+  ServerFid9P *fid_free_list;
   u32 fid_count;
-  u32 fid_capacity;
+  u32 fid_tombstone_count;
   u32 fid_hash_capacity;
+  ServerFidBlock9P *fid_block_free[SERVER_FID_BLOCK_CLASS_COUNT];
+  u64 fid_storage_bytes;
+
+  ServerUserName9P **user_name_slots;
+  u64 memory_limit;
+  u64 memory_rejection_count;
 
   ServerRequest9P **request_table;
   u32 request_count;
   u32 max_request_count;
   u32 next_tag;
   ServerRequest9P *request_free_list;
+  ServerBufferPool9P *buffer_pool;
+
+  u8 *output_batch;
+  u64 output_batch_size;
+  u64 output_batch_count;
+  u64 output_batch_time_us;
+  u64 output_cork_count;
+  Arena *output_queue_arena;
+  ServerOutputChunk9P *output_queue_first;
+  ServerOutputChunk9P *output_queue_last;
+  u64 output_queue_pos;
+  u64 output_queue_size;
 
   FidAuxiliary9P *fid_aux_free_list;
+  ServerFidDestroyFunction9P *fid_destroy;
+  ServerRespondFunction9P *on_respond;
+  ServerOutputFunction9P *on_output;
+  ServerOutputQueueFunction9P *on_output_queue;
   void *auxiliary;
 };
 
@@ -88,22 +219,61 @@ enum
   QidTypeFlag_File      = 0x00,
 };
 
+////////////////////////////////
+//~ Message Buffer Pool
+
+internal ServerBufferPool9P *server9p_buffer_pool_alloc(Arena *arena, u64 idle_limit);
+internal u8 *server9p_buffer_pool_borrow(ServerBufferPool9P *pool, u64 size);
+internal void server9p_buffer_pool_return(ServerBufferPool9P *pool, u8 *buffer, u64 size);
+internal Arena *server9p_buffer_pool_borrow_arena(ServerBufferPool9P *pool);
+internal void server9p_buffer_pool_return_arena(ServerBufferPool9P *pool, Arena *arena);
+
+////////////////////////////////
+//~ Splice Pipes
+
+internal ServerSplicePipe9P *server9p_splice_pipe_alloc(Server9P *server);
+internal void server9p_splice_pipe_release(Server9P *server, ServerSplicePipe9P *pipe, b32 empty);
+
 ////////////////////////////////
 //~ Request Management
 
-internal ServerRequest9P *server9p_request_alloc(Server9P *server, u32 tag);
-internal ServerRequest9P *server9p_request_remove(Server9P *server, u32 tag);
+internal ServerRequest9P *server9p_request_alloc(Server9P *server);
+internal void server9p_request_release(ServerRequest9P *request);
+internal b32 server9p_request_insert(Server9P *server, ServerRequest9P *request);
+internal ServerRequest9P *server9p_request_lookup(Server9P *server, u32 tag);
+internal void server9p_request_remove(Server9P *server, ServerRequest9P *request);
 
 ////////////////////////////////
 //~ Server Lifecycle
 
 internal Server9P *server9p_alloc(Arena *arena, u64 input_fd, u64 output_fd);
+internal void server9p_wait_idle(Server9P *server);
+internal void server9p_release(Server9P *server);
+internal u32 server9p_negotiate_message_size(Server9P *server, u32 requested_size);
+
+////////////////////////////////
+//~ Output Batching
+
+internal void server9p_output_cork(Server9P *server);
+internal void server9p_output_uncork(Server9P *server);
+internal b32 server9p_output_corked(Server9P *server);
+internal void server9p_output_flush_expired(Server9P *server);
+internal u64 server9p_output_queued(Server9P *server);
+internal b32 server9p_output_drain(Server9P *server);
 
 ////////////////////////////////
 //~ Request Handling
 
+internal b32 server9p_request_prepare(ServerRequest9P *request, String8 msg);
+internal void server9p_request_setup(ServerRequest9P *request, Message9P f);
 internal ServerRequest9P *server9p_get_request(Server9P *server);
+internal ServerRequest9P *server9p_try_get_request(Server9P *server);
 internal b32 server9p_respond(ServerRequest9P *request, String8 err);
+internal b32 server9p_respond_read_file(ServerRequest9P *request, u64 file_fd, Rng1U64 range);
+internal void server9p_flush(ServerRequest9P *request);
+internal b32 server9p_request_is_flushed(ServerRequest9P *request);
+internal u64 server9p_request_splice_payload(ServerRequest9P *request, int file_fd);
+internal b32 server9p_request_read_payload(ServerRequest9P *request);
 
 ////////////////////////////////
 //~ Fid Management
@@ -111,5 +281,8 @@ internal b32 server9p_respond(ServerRequest9P *request, String8 err);
 internal ServerFid9P *server9p_fid_alloc(Server9P *server, u32 fid);
 internal ServerFid9P *server9p_fid_lookup(Server9P *server, u32 fid);
 internal ServerFid9P *server9p_fid_remove(Server9P *server, u32 fid);
+internal void server9p_fid_remove_all(Server9P *server);
+internal void server9p_fid_release(ServerFid9P *fid);
+internal void *server9p_fid_push(ServerFid9P *fid, u64 size);
 
 #endif // _9P_SERVER_H
@@ -1,3 +1,9 @@
+////////////////////////////////
+//~ Globals/Thread-Locals
+
+// Pushes made by the calling thread; benchmarks read it to report allocations
+thread_static u64 arena_push_count = 0;
+
 ////////////////////////////////
 //~ Arena Functions
 
@@ -76,6 +82,7 @@ arena_push(Arena *arena, u64 size, u64 align, b32 zero)
   Arena *current = arena->current;
   u64 pos_pre    = AlignPow2(current->pos, align);
   u64 pos_pst    = pos_pre + size;
+  arena_push_count += 1;
 
   if(current->res < pos_pst && !(arena->flags & ArenaFlag_NoChain))
   {
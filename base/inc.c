@@ -10,5 +10,6 @@
 #include "thread_context.c"
 #include "command_line.c"
 #include "os.c"
+#include "io_ring.c"
 #include "log.c"
 #include "entry_point.c"
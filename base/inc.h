@@ -14,6 +14,7 @@
 #include "thread_context.h"
 #include "command_line.h"
 #include "os.h"
+#include "io_ring.h"
 #include "log.h"
 #include "entry_point.h"
 
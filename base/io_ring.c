@@ -0,0 +1,295 @@
+////////////////////////////////
+//~ Globals/Thread-Locals
+
+global b32 io_ring_enabled = 0;
+thread_static IO_Ring *io_ring_thread_ring = 0;
+thread_static b32 io_ring_thread_failed = 0;
+
+////////////////////////////////
+//~ Ring Lifecycle
+
+internal IO_Ring *
+io_ring_alloc(Arena *arena, u32 entry_count)
+{
+  struct io_uring_params params = {0};
+  int fd = (int)syscall(__NR_io_uring_setup, entry_count, &params);
+  if(fd < 0) { return 0; }
+
+  // Kernels with a single mmap share one mapping between both rings
+  u64 sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+  u64 cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  b32 single_mmap  = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if(single_mmap) { sq_ring_size = cq_ring_size = Max(sq_ring_size, cq_ring_size); }
+
+  void *sq_ring = mmap(0, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  void *cq_ring = sq_ring;
+  if(sq_ring != MAP_FAILED && !single_mmap)
+  {
+    cq_ring = mmap(0, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  }
+  u64 sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes    = MAP_FAILED;
+  if(sq_ring != MAP_FAILED && cq_ring != MAP_FAILED)
+  {
+    sqes = mmap(0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  }
+  if(sqes == MAP_FAILED)
+  {
+    if(cq_ring != MAP_FAILED && cq_ring != sq_ring) { munmap(cq_ring, cq_ring_size); }
+    if(sq_ring != MAP_FAILED)                       { munmap(sq_ring, sq_ring_size); }
+    close(fd);
+    return 0;
+  }
+
+  IO_Ring *ring        = push_array(arena, IO_Ring, 1);
+  ring->fd             = fd;
+  ring->sq_entry_count = params.sq_entries;
+  ring->cq_entry_count = params.cq_entries;
+  ring->sq_head        = (u32 *)((u8 *)sq_ring + params.sq_off.head);
+  ring->sq_tail        = (u32 *)((u8 *)sq_ring + params.sq_off.tail);
+  ring->sq_mask        = *(u32 *)((u8 *)sq_ring + params.sq_off.ring_mask);
+  ring->sq_array       = (u32 *)((u8 *)sq_ring + params.sq_off.array);
+  ring->sqes           = (struct io_uring_sqe *)sqes;
+  ring->cq_head        = (u32 *)((u8 *)cq_ring + params.cq_off.head);
+  ring->cq_tail        = (u32 *)((u8 *)cq_ring + params.cq_off.tail);
+  ring->cq_mask        = *(u32 *)((u8 *)cq_ring + params.cq_off.ring_mask);
+  ring->cqes           = (struct io_uring_cqe *)((u8 *)cq_ring + params.cq_off.cqes);
+  ring->sq_ring        = sq_ring;
+  ring->sq_ring_size   = sq_ring_size;
+  ring->cq_ring        = cq_ring;
+  ring->cq_ring_size   = cq_ring_size;
+  ring->sqes_size      = sqes_size;
+  return ring;
+}
+
+internal void
+io_ring_release(IO_Ring *ring)
+{
+  if(ring == 0) { return; }
+  munmap(ring->sqes, ring->sqes_size);
+  if(ring->cq_ring != ring->sq_ring) { munmap(ring->cq_ring, ring->cq_ring_size); }
+  munmap(ring->sq_ring, ring->sq_ring_size);
+  close(ring->fd);
+}
+
+// Rings are never shared between threads, so submission needs no locking.
+// Returns 0 when rings are disabled or the kernel refuses one; callers fall
+// back to plain syscalls.
+internal IO_Ring *
+io_ring_from_thread(void)
+{
+  if(!io_ring_enabled || io_ring_thread_failed) { return 0; }
+  if(io_ring_thread_ring == 0)
+  {
+    io_ring_thread_ring   = io_ring_alloc(arena_alloc(), IO_RING_ENTRY_COUNT);
+    io_ring_thread_failed = io_ring_thread_ring == 0;
+  }
+  return io_ring_thread_ring;
+}
+
+internal b32
+io_ring_register_buffers(IO_Ring *ring, Arena *arena, u32 count, u64 size)
+{
+  u8 *buffers          = push_array_no_zero_aligned(arena, u8, count * size, os_get_system_info()->page_size);
+  struct iovec *iovecs = push_array(arena, struct iovec, count);
+  for(u32 i = 0; i < count; i += 1)
+  {
+    iovecs[i].iov_base = buffers + i * size;
+    iovecs[i].iov_len  = size;
+  }
+  if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iovecs, count) != 0) { return 0; }
+
+  ring->buffers      = buffers;
+  ring->buffer_size  = size;
+  ring->buffer_count = count;
+  return 1;
+}
+
+internal u8 *
+io_ring_buffer(IO_Ring *ring, u32 idx)
+{
+  if(idx >= ring->buffer_count) { return 0; }
+  return ring->buffers + idx * ring->buffer_size;
+}
+
+////////////////////////////////
+//~ Submission
+
+internal struct io_uring_sqe *
+io_ring_push(IO_Ring *ring, u8 opcode, int fd, u64 user_data)
+{
+  // A full queue is handed to the kernel before taking another entry
+  u32 tail = *ring->sq_tail;
+  u32 head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if(tail - head >= ring->sq_entry_count)
+  {
+    if(io_ring_submit(ring, 0) < 0) { return 0; }
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if(tail - head >= ring->sq_entry_count) { return 0; }
+  }
+
+  u32 idx                  = tail & ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[idx];
+  MemoryZeroStruct(sqe);
+  sqe->opcode         = opcode;
+  sqe->fd             = fd;
+  sqe->user_data      = user_data;
+  ring->sq_array[idx] = idx;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->unsubmitted_count += 1;
+  return sqe;
+}
+
+internal b32
+io_ring_push_read(IO_Ring *ring, int fd, void *buffer, u64 size, u64 offset, u64 user_data)
+{
+  struct io_uring_sqe *sqe = io_ring_push(ring, IORING_OP_READ, fd, user_data);
+  if(sqe == 0) { return 0; }
+  sqe->addr = (u64)buffer;
+  sqe->len  = (u32)size;
+  sqe->off  = offset;
+  return 1;
+}
+
+internal b32
+io_ring_push_write(IO_Ring *ring, int fd, void *buffer, u64 size, u64 offset, u64 user_data)
+{
+  struct io_uring_sqe *sqe = io_ring_push(ring, IORING_OP_WRITE, fd, user_data);
+  if(sqe == 0) { return 0; }
+  sqe->addr = (u64)buffer;
+  sqe->len  = (u32)size;
+  sqe->off  = offset;
+  return 1;
+}
+
+internal b32
+io_ring_push_read_fixed(IO_Ring *ring, int fd, u32 buffer_idx, u64 size, u64 offset, u64 user_data)
+{
+  if(buffer_idx >= ring->buffer_count || size > ring->buffer_size) { return 0; }
+  struct io_uring_sqe *sqe = io_ring_push(ring, IORING_OP_READ_FIXED, fd, user_data);
+  if(sqe == 0) { return 0; }
+  sqe->addr      = (u64)io_ring_buffer(ring, buffer_idx);
+  sqe->len       = (u32)size;
+  sqe->off       = offset;
+  sqe->buf_index = (u16)buffer_idx;
+  return 1;
+}
+
+internal b32
+io_ring_push_fdatasync(IO_Ring *ring, int fd, u64 user_data)
+{
+  struct io_uring_sqe *sqe = io_ring_push(ring, IORING_OP_FSYNC, fd, user_data);
+  if(sqe == 0) { return 0; }
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  return 1;
+}
+
+internal b32
+io_ring_push_statx(IO_Ring *ring, int dir_fd, char *name, int flags, u32 mask, struct statx *out, u64 user_data)
+{
+  struct io_uring_sqe *sqe = io_ring_push(ring, IORING_OP_STATX, dir_fd, user_data);
+  if(sqe == 0) { return 0; }
+  sqe->addr        = (u64)name;
+  sqe->len         = mask;
+  sqe->off         = (u64)out;
+  sqe->statx_flags = (u32)flags;
+  return 1;
+}
+
+// The next entry pushed starts only after the last one succeeds.
+internal void
+io_ring_link_last(IO_Ring *ring)
+{
+  u32 tail = *ring->sq_tail;
+  ring->sqes[(tail - 1) & ring->sq_mask].flags |= IOSQE_IO_LINK;
+}
+
+internal s64
+io_ring_submit(IO_Ring *ring, u32 wait_count)
+{
+  u32 flags = wait_count > 0 ? IORING_ENTER_GETEVENTS : 0;
+  for(;;)
+  {
+    s64 result = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted_count, wait_count, flags, 0, 0);
+    if(result >= 0)
+    {
+      ring->unsubmitted_count -= (u32)result;
+      ring->in_flight_count   += (u32)result;
+      return result;
+    }
+    if(errno != EINTR) { return -1; }
+  }
+}
+
+////////////////////////////////
+//~ Completion
+
+internal u32
+io_ring_reap(IO_Ring *ring, IO_Completion *completions, u32 max_count)
+{
+  u32 head  = *ring->cq_head;
+  u32 tail  = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  u32 count = 0;
+  for(; head != tail && count < max_count; head += 1, count += 1)
+  {
+    struct io_uring_cqe *cqe     = &ring->cqes[head & ring->cq_mask];
+    completions[count].user_data = cqe->user_data;
+    completions[count].result    = cqe->res;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  ring->in_flight_count -= count;
+  return count;
+}
+
+// Entries the kernel has not taken yet are dropped from the queue; without
+// SQPOLL it reads the queue only inside io_uring_enter, so the tail is ours.
+internal void
+io_ring_withdraw(IO_Ring *ring)
+{
+  u32 tail = *ring->sq_tail;
+  __atomic_store_n(ring->sq_tail, tail - ring->unsubmitted_count, __ATOMIC_RELEASE);
+  ring->unsubmitted_count = 0;
+}
+
+// Blocks until everything in flight has completed, keeping at most max_count
+// of the completions.
+internal u32
+io_ring_drain(IO_Ring *ring, IO_Completion *completions, u32 max_count)
+{
+  u32 reaped = 0;
+  for(; ring->in_flight_count > 0;)
+  {
+    IO_Completion discard[16];
+    if(reaped < max_count) { reaped += io_ring_reap(ring, completions + reaped, max_count - reaped); }
+    else                   { io_ring_reap(ring, discard, ArrayCount(discard)); }
+    if(ring->in_flight_count == 0) { break; }
+
+    // The kernel still writes into the entries' buffers until they complete,
+    // so a failing wait is retried rather than abandoned
+    s64 result = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, 0, 0);
+    if(result < 0 && errno != EINTR) { os_sleep_milliseconds(1); }
+  }
+  return reaped;
+}
+
+// Submits whatever is queued and blocks until count completions are reaped.
+// If the kernel refuses the submission, fewer are returned, but only once
+// nothing queued still refers to the caller's memory.
+internal u32
+io_ring_wait(IO_Ring *ring, IO_Completion *completions, u32 count)
+{
+  u32 reaped = 0;
+  for(; reaped < count;)
+  {
+    reaped += io_ring_reap(ring, completions + reaped, count - reaped);
+    if(reaped >= count) { break; }
+    if(ring->unsubmitted_count == 0 && ring->in_flight_count == 0) { break; }
+    if(io_ring_submit(ring, 1) < 0)
+    {
+      io_ring_withdraw(ring);
+      reaped += io_ring_drain(ring, completions + reaped, count - reaped);
+      break;
+    }
+  }
+  return reaped;
+}
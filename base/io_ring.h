@@ -0,0 +1,79 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+////////////////////////////////
+//~ Includes
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+////////////////////////////////
+//~ Ring Types
+
+#define IO_RING_ENTRY_COUNT 256
+
+typedef struct IO_Completion IO_Completion;
+struct IO_Completion
+{
+  u64 user_data;
+  s32 result;
+};
+
+typedef struct IO_Ring IO_Ring;
+struct IO_Ring
+{
+  int fd;
+  u32 sq_entry_count;
+  u32 cq_entry_count;
+  u32 *sq_head;
+  u32 *sq_tail;
+  u32 sq_mask;
+  u32 *sq_array;
+  struct io_uring_sqe *sqes;
+  u32 *cq_head;
+  u32 *cq_tail;
+  u32 cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  u64 sq_ring_size;
+  void *cq_ring;
+  u64 cq_ring_size;
+  u64 sqes_size;
+  u32 unsubmitted_count;
+  u32 in_flight_count;
+  u8 *buffers;
+  u64 buffer_size;
+  u32 buffer_count;
+};
+
+////////////////////////////////
+//~ Ring Lifecycle
+
+internal IO_Ring *io_ring_alloc(Arena *arena, u32 entry_count);
+internal void io_ring_release(IO_Ring *ring);
+internal IO_Ring *io_ring_from_thread(void);
+internal b32 io_ring_register_buffers(IO_Ring *ring, Arena *arena, u32 count, u64 size);
+internal u8 *io_ring_buffer(IO_Ring *ring, u32 idx);
+
+////////////////////////////////
+//~ Submission
+
+internal struct io_uring_sqe *io_ring_push(IO_Ring *ring, u8 opcode, int fd, u64 user_data);
+internal b32 io_ring_push_read(IO_Ring *ring, int fd, void *buffer, u64 size, u64 offset, u64 user_data);
+internal b32 io_ring_push_write(IO_Ring *ring, int fd, void *buffer, u64 size, u64 offset, u64 user_data);
+internal b32 io_ring_push_read_fixed(IO_Ring *ring, int fd, u32 buffer_idx, u64 size, u64 offset, u64 user_data);
+internal b32 io_ring_push_fdatasync(IO_Ring *ring, int fd, u64 user_data);
+internal b32 io_ring_push_statx(IO_Ring *ring, int dir_fd, char *name, int flags, u32 mask, struct statx *out, u64 user_data);
+internal void io_ring_link_last(IO_Ring *ring);
+internal s64 io_ring_submit(IO_Ring *ring, u32 wait_count);
+
+////////////////////////////////
+//~ Completion
+
+internal u32 io_ring_reap(IO_Ring *ring, IO_Completion *completions, u32 max_count);
+internal void io_ring_withdraw(IO_Ring *ring);
+internal u32 io_ring_drain(IO_Ring *ring, IO_Completion *completions, u32 max_count);
+internal u32 io_ring_wait(IO_Ring *ring, IO_Completion *completions, u32 count);
+
+#endif // IO_RING_H
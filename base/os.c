@@ -463,6 +463,12 @@ os_socket_connect_unix(String8 path)
 
 internal OS_Handle
 os_socket_listen_tcp(u16 port)
+{
+  return os_socket_listen_tcp__opts(port, 0);
+}
+
+internal OS_Handle
+os_socket_listen_tcp__opts(u16 port, b32 reuse_port)
 {
   char port_buffer[6] = {0};
   snprintf(port_buffer, sizeof port_buffer, "%u", port);
@@ -481,7 +487,8 @@ os_socket_listen_tcp(u16 port)
     return os_handle_zero();
   }
   int option = 1;
-  if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof option) < 0)
+  if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof option) < 0 ||
+     (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &option, sizeof option) < 0))
   {
     close(fd);
     freeaddrinfo(addrinfo_result);
@@ -125,6 +125,7 @@ internal b32 os_make_directory(String8 path);
 internal OS_Handle os_socket_connect_tcp(String8 host, u16 port);
 internal OS_Handle os_socket_connect_unix(String8 path);
 internal OS_Handle os_socket_listen_tcp(u16 port);
+internal OS_Handle os_socket_listen_tcp__opts(u16 port, b32 reuse_port);
 internal OS_Handle os_socket_listen_unix(String8 path);
 internal OS_Handle os_socket_accept(OS_Handle listen_socket);
 internal b32 os_copy_file(OS_Handle out, OS_Handle in, u64 size);
@@ -32,6 +32,7 @@ thread_state_alloc(void)
 internal void
 thread_state_release(ThreadState *state)
 {
+  if(ins_atomic_u32_dec_eval(&state->ref_count) != 0) { return; }
   DeferLoop(pthread_mutex_lock(&thread_mutex), pthread_mutex_unlock(&thread_mutex))
   {
     SLLStackPush(thread_state_free, state);
@@ -44,6 +45,7 @@ thread_entry_point(void *ptr)
   ThreadState *state                 = (ThreadState *)ptr;
   ThreadEntryPointFunctionType *func = state->func;
   void *thread_ptr                   = state->ptr;
+  thread_state_release(state);
   supplement_thread_base_entry_point(func, thread_ptr);
   return 0;
 }
@@ -54,10 +56,12 @@ thread_launch(ThreadEntryPointFunctionType *func, void *ptr)
   ThreadState *state = thread_state_alloc();
   state->func        = func;
   state->ptr         = ptr;
+  state->ref_count   = 2;
   {
     int pthread_result = pthread_create(&state->handle, 0, thread_entry_point, state);
-    if(pthread_result == -1)
+    if(pthread_result != 0)
     {
+      state->ref_count = 1;
       thread_state_release(state);
       state = 0;
     }
@@ -29,6 +29,7 @@ struct ThreadState
   pthread_t handle;
   ThreadEntryPointFunctionType *func;
   void *ptr;
+  u32 ref_count;
 };
 
 ////////////////////////////////
@@ -48,20 +48,9 @@ fid_aux_get(Server9P *server, ServerFid9P *fid)
 }
 
 internal void
-fid_release_all(Server9P *server)
+fid_aux_destroy(ServerFid9P *fid)
 {
-  for(u32 i = 0; i < server->fid_capacity; i += 1)
-  {
-    ServerFid9P *fid = &server->fid_storage[i];
-    if(fid->fid != 0)
-    {
-      fid_aux_release(server, (Auth_FidAuxiliary9P *)fid->auxiliary);
-      fid->fid = 0;
-    }
-  }
-
-  MemorySet(server->fid_hash_table, max_u8, server->fid_hash_capacity * sizeof(u32));
-  server->fid_count = 0;
+  fid_aux_release(fid->server, (Auth_FidAuxiliary9P *)fid->auxiliary);
 }
 
 ////////////////////////////////
@@ -70,9 +59,11 @@ fid_release_all(Server9P *server)
 internal void
 srv_version(ServerRequest9P *request)
 {
-  request->out_msg.max_message_size = request->in_msg.max_message_size;
+  u32 max_message_size = server9p_negotiate_message_size(request->server, request->in_msg.max_message_size);
+  if(max_message_size == 0) { server9p_respond(request, str8_lit("msize too small")); return; }
+
+  request->out_msg.max_message_size = max_message_size;
   request->out_msg.protocol_version = request->in_msg.protocol_version;
-  request->server->max_message_size = request->in_msg.max_message_size;
   server9p_respond(request, str8_zero());
 }
 
@@ -237,8 +228,6 @@ srv_write(ServerRequest9P *request)
 internal void
 srv_clunk(ServerRequest9P *request)
 {
-  Auth_FidAuxiliary9P *aux = fid_aux_get(request->server, request->fid);
-  fid_aux_release(request->server, aux);
   server9p_fid_remove(request->server, request->in_msg.fid);
   server9p_respond(request, str8_zero());
 }
@@ -316,6 +305,7 @@ handle_connection(OS_Handle connection_socket)
     arena_release(connection_arena);
     return;
   }
+  server->fid_destroy = fid_aux_destroy;
 
   for(;;)
   {
@@ -346,7 +336,8 @@ handle_connection(OS_Handle connection_socket)
     }
   }
 
-  fid_release_all(server);
+  server9p_fid_remove_all(server);
+  server9p_release(server);
   os_file_close(connection_socket);
   log_info(str8_lit("9auth: connection closed\n"));
   log_scope_flush(scratch.arena);
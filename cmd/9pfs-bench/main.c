@@ -0,0 +1,639 @@
+#include "base/inc.h"
+#include "9p/inc.h"
+#include "base/inc.c"
+#include "9p/inc.c"
+
+////////////////////////////////
+//~ Benchmark Types
+
+typedef struct BenchResult BenchResult;
+struct BenchResult
+{
+  u64 op_count;
+  u64 elapsed_us;
+  b32 skipped;
+  b32 counts_allocs;
+  u64 alloc_count;
+  u64 byte_count;
+};
+
+typedef struct BenchCase BenchCase;
+struct BenchCase
+{
+  String8 name;
+  BenchResult (*func)(Arena *);
+};
+
+////////////////////////////////
+//~ Reporting
+
+internal void
+bench_report(String8 name, BenchResult result)
+{
+  if(result.skipped)
+  {
+    log_infof("%-32S skipped (no io_uring or scratch file)\n", name);
+    return;
+  }
+  if(result.op_count == 0)
+  {
+    log_errorf("FAIL: %S\n", name);
+    return;
+  }
+
+  u64 ns_per_op   = (result.elapsed_us * 1000) / result.op_count;
+  u64 ops_per_sec = (result.op_count * Million(1)) / Max(result.elapsed_us, 1);
+  Temp scratch    = scratch_begin(0, 0);
+  String8 extra   = str8_zero();
+  if(result.counts_allocs)  { extra = str8f(scratch.arena, " %4llu allocs/op", result.alloc_count / result.op_count); }
+  if(result.byte_count > 0) { extra = str8f(scratch.arena, "%S %10.1f MB/s", extra, (f64)result.byte_count / (f64)Max(result.elapsed_us, 1)); }
+  log_infof("%-32S %10llu ops %8llu ns/op %10llu ops/s%S\n", name, result.op_count, ns_per_op, ops_per_sec, extra);
+  scratch_end(scratch);
+}
+
+////////////////////////////////
+//~ Fid Table Benchmarks
+
+#define BENCH_LIVE_FID_COUNT 100000
+#define BENCH_FID_OP_COUNT   1000000
+
+internal Server9P *
+bench_fid_server_alloc(Arena *arena)
+{
+  Server9P *server = server9p_alloc(arena, 0, 0);
+  for(u32 fid = 0; fid < BENCH_LIVE_FID_COUNT; fid += 1) { server9p_fid_alloc(server, fid); }
+  return server;
+}
+
+internal void
+bench_fid_server_release(Server9P *server)
+{
+  server9p_fid_remove_all(server);
+  server9p_release(server);
+}
+
+internal BenchResult
+bench_fid_walk_clunk(Arena *arena)
+{
+  Server9P *server   = bench_fid_server_alloc(arena);
+  BenchResult result = {0};
+  result.op_count    = BENCH_FID_OP_COUNT;
+
+  // Twalk to a fresh fid and Tclunk the oldest one, keeping the live count fixed
+  u64 start = os_now_microseconds();
+  for(u32 i = 0; i < BENCH_FID_OP_COUNT; i += 1)
+  {
+    server9p_fid_alloc(server, BENCH_LIVE_FID_COUNT + i);
+    server9p_fid_remove(server, i);
+  }
+  result.elapsed_us = os_now_microseconds() - start;
+
+  bench_fid_server_release(server);
+  return result;
+}
+
+internal BenchResult
+bench_fid_walk_clunk_transient(Arena *arena)
+{
+  Server9P *server   = bench_fid_server_alloc(arena);
+  BenchResult result = {0};
+  result.op_count    = BENCH_FID_OP_COUNT;
+
+  // Short-lived fids (walk, stat, clunk) on top of the live set
+  u64 start = os_now_microseconds();
+  for(u32 i = 0; i < BENCH_FID_OP_COUNT; i += 1)
+  {
+    u32 fid = BENCH_LIVE_FID_COUNT + (i % 64);
+    server9p_fid_alloc(server, fid);
+    server9p_fid_remove(server, fid);
+  }
+  result.elapsed_us = os_now_microseconds() - start;
+
+  bench_fid_server_release(server);
+  return result;
+}
+
+internal BenchResult
+bench_fid_lookup(Arena *arena)
+{
+  Server9P *server   = bench_fid_server_alloc(arena);
+  BenchResult result = {0};
+  result.op_count    = BENCH_FID_OP_COUNT;
+
+  u64 found = 0;
+  u64 start = os_now_microseconds();
+  for(u32 i = 0; i < BENCH_FID_OP_COUNT; i += 1)
+  {
+    if(server9p_fid_lookup(server, (i * 7919) % BENCH_LIVE_FID_COUNT) != 0) { found += 1; }
+  }
+  result.elapsed_us = os_now_microseconds() - start;
+  if(found != BENCH_FID_OP_COUNT) { result.op_count = 0; }
+
+  bench_fid_server_release(server);
+  return result;
+}
+
+////////////////////////////////
+//~ Disk Queue Depth Benchmarks
+
+#define BENCH_DISK_FILE_SIZE  MB(256)
+#define BENCH_DISK_BLOCK_SIZE KB(4)
+#define BENCH_DISK_OP_COUNT   100000
+
+global String8 bench_disk_dir = {0};
+
+// Opens an unlinked scratch file, with O_DIRECT where the filesystem allows
+// it so reads reach the device instead of the page cache
+internal int
+bench_disk_file_open(void)
+{
+  Temp scratch = scratch_begin(0, 0);
+  String8 path = str8f(scratch.arena, "%S/9pfs-bench-%d.tmp", bench_disk_dir, getpid());
+  int fd       = open((char *)path.str, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if(fd >= 0)
+  {
+    u8 *chunk = push_array(scratch.arena, u8, MB(1));
+    for(u64 i = 0; i < MB(1); i += 1) { chunk[i] = (u8)(i * 131); }
+    for(u64 offset = 0; offset < BENCH_DISK_FILE_SIZE; offset += MB(1))
+    {
+      if(pwrite(fd, chunk, MB(1), offset) != MB(1)) { close(fd); fd = -1; break; }
+    }
+  }
+  if(fd >= 0)
+  {
+    fsync(fd);
+    close(fd);
+    fd = open((char *)path.str, O_RDONLY | O_DIRECT);
+    if(fd < 0) { fd = open((char *)path.str, O_RDONLY); }
+  }
+  unlink((char *)path.str);
+  scratch_end(scratch);
+  return fd;
+}
+
+internal u64
+bench_disk_random_offset(u64 *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return (*state % (BENCH_DISK_FILE_SIZE / BENCH_DISK_BLOCK_SIZE)) * BENCH_DISK_BLOCK_SIZE;
+}
+
+internal BenchResult
+bench_disk_read_ring(Arena *arena, u32 depth)
+{
+  BenchResult result = {0};
+  int fd             = bench_disk_file_open();
+  IO_Ring *ring      = (fd >= 0) ? io_ring_alloc(arena, depth) : 0;
+  if(ring == 0 || !io_ring_register_buffers(ring, arena, depth, BENCH_DISK_BLOCK_SIZE))
+  {
+    result.skipped = 1;
+    if(ring != 0) { io_ring_release(ring); }
+    if(fd >= 0)   { close(fd); }
+    return result;
+  }
+
+  // Every completion immediately refills its buffer, keeping depth reads in flight
+  u64 rng_state       = 0x9e3779b97f4a7c15ull;
+  u64 submitted_count = 0;
+  u64 completed_count = 0;
+  b32 failed          = 0;
+  u64 start           = os_now_microseconds();
+  for(u32 i = 0; i < depth; i += 1, submitted_count += 1)
+  {
+    io_ring_push_read_fixed(ring, fd, i, BENCH_DISK_BLOCK_SIZE, bench_disk_random_offset(&rng_state), i);
+  }
+  for(; completed_count < BENCH_DISK_OP_COUNT && !failed;)
+  {
+    IO_Completion completion = {0};
+    if(io_ring_wait(ring, &completion, 1) != 1 || completion.result != BENCH_DISK_BLOCK_SIZE) { failed = 1; break; }
+    completed_count += 1;
+    if(submitted_count < BENCH_DISK_OP_COUNT)
+    {
+      u32 buffer_idx = (u32)completion.user_data;
+      io_ring_push_read_fixed(ring, fd, buffer_idx, BENCH_DISK_BLOCK_SIZE, bench_disk_random_offset(&rng_state), buffer_idx);
+      submitted_count += 1;
+    }
+  }
+  result.elapsed_us = os_now_microseconds() - start;
+  result.op_count   = failed ? 0 : completed_count;
+
+  // Reads still in flight must land before the buffers go away
+  for(; ring->in_flight_count > 0 || ring->unsubmitted_count > 0;)
+  {
+    IO_Completion completion = {0};
+    if(io_ring_wait(ring, &completion, 1) != 1) { break; }
+  }
+  io_ring_release(ring);
+  close(fd);
+  return result;
+}
+
+internal BenchResult
+bench_disk_pread_qd1(Arena *arena)
+{
+  BenchResult result = {0};
+  int fd             = bench_disk_file_open();
+  if(fd < 0) { result.skipped = 1; return result; }
+
+  u8 *buffer    = push_array_no_zero_aligned(arena, u8, BENCH_DISK_BLOCK_SIZE, BENCH_DISK_BLOCK_SIZE);
+  u64 rng_state = 0x9e3779b97f4a7c15ull;
+  u64 start     = os_now_microseconds();
+  for(u64 i = 0; i < BENCH_DISK_OP_COUNT; i += 1)
+  {
+    if(pread(fd, buffer, BENCH_DISK_BLOCK_SIZE, bench_disk_random_offset(&rng_state)) != BENCH_DISK_BLOCK_SIZE) { close(fd); return result; }
+  }
+  result.elapsed_us = os_now_microseconds() - start;
+  result.op_count   = BENCH_DISK_OP_COUNT;
+  close(fd);
+  return result;
+}
+
+internal BenchResult
+bench_disk_ring_qd1(Arena *arena)
+{
+  return bench_disk_read_ring(arena, 1);
+}
+
+internal BenchResult
+bench_disk_ring_qd64(Arena *arena)
+{
+  return bench_disk_read_ring(arena, 64);
+}
+
+////////////////////////////////
+//~ Codec Benchmarks
+
+#define BENCH_CODEC_TIME_US       50000
+#define BENCH_CODEC_BATCH_COUNT   64
+#define BENCH_CODEC_DIR_COUNT     64
+#define BENCH_CODEC_SEND_OP_COUNT 100000
+#define BENCH_CODEC_PAYLOAD_SIZE  KB(64)
+
+typedef u32 BenchCodecMode;
+enum
+{
+  BenchCodecMode_Size,
+  BenchCodecMode_Encode,
+  BenchCodecMode_DecodeCopy,
+  BenchCodecMode_DecodeView,
+  BenchCodecMode_COUNT,
+};
+
+// A message of one type, or a readdir batch when type is 0
+typedef struct BenchCodecCase BenchCodecCase;
+struct BenchCodecCase
+{
+  String8 name;
+  Message9P msg;
+  Dir9P *dirs;
+  u64 dir_count;
+  String8 data;
+};
+
+read_only global String8 bench_codec_mode_names[BenchCodecMode_COUNT] =
+{
+  str8_lit_comp("size"), str8_lit_comp("encode"), str8_lit_comp("decode_copy"), str8_lit_comp("decode_view"),
+};
+
+read_only global struct { Message9PType type; String8 name; } bench_codec_types[] =
+{
+  {Msg9P_Tversion, str8_lit_comp("tversion")}, {Msg9P_Rversion, str8_lit_comp("rversion")},
+  {Msg9P_Tauth,    str8_lit_comp("tauth")},    {Msg9P_Rauth,    str8_lit_comp("rauth")},
+  {Msg9P_Tattach,  str8_lit_comp("tattach")},  {Msg9P_Rattach,  str8_lit_comp("rattach")},
+  {Msg9P_Rerror,   str8_lit_comp("rerror")},
+  {Msg9P_Tflush,   str8_lit_comp("tflush")},   {Msg9P_Rflush,   str8_lit_comp("rflush")},
+  {Msg9P_Twalk,    str8_lit_comp("twalk16")},  {Msg9P_Rwalk,    str8_lit_comp("rwalk16")},
+  {Msg9P_Topen,    str8_lit_comp("topen")},    {Msg9P_Ropen,    str8_lit_comp("ropen")},
+  {Msg9P_Tcreate,  str8_lit_comp("tcreate")},  {Msg9P_Rcreate,  str8_lit_comp("rcreate")},
+  {Msg9P_Tread,    str8_lit_comp("tread")},    {Msg9P_Rread,    str8_lit_comp("rread1m")},
+  {Msg9P_Twrite,   str8_lit_comp("twrite64k")}, {Msg9P_Rwrite,  str8_lit_comp("rwrite")},
+  {Msg9P_Tclunk,   str8_lit_comp("tclunk")},   {Msg9P_Rclunk,   str8_lit_comp("rclunk")},
+  {Msg9P_Tremove,  str8_lit_comp("tremove")},  {Msg9P_Rremove,  str8_lit_comp("rremove")},
+  {Msg9P_Tstat,    str8_lit_comp("tstat")},    {Msg9P_Rstat,    str8_lit_comp("rstat")},
+  {Msg9P_Twstat,   str8_lit_comp("twstat")},   {Msg9P_Rwstat,   str8_lit_comp("rwstat")},
+};
+
+internal Dir9P
+bench_codec_dir(Arena *arena, u64 idx)
+{
+  Dir9P dir          = dir9p_zero();
+  dir.qid.type       = QidTypeFlag_File;
+  dir.qid.path       = 0x10000 + idx;
+  dir.mode           = 0644;
+  dir.access_time    = 1700000000;
+  dir.modify_time    = 1700000000;
+  dir.length         = 4096 * (idx + 1);
+  dir.name           = str8f(arena, "source_file_%03llu.c", idx);
+  dir.user_id        = str8_lit("glenda");
+  dir.group_id       = str8_lit("sys");
+  dir.modify_user_id = str8_lit("glenda");
+  return dir;
+}
+
+// Field values follow what 9mount and 9pfs exchange in practice
+internal Message9P
+bench_codec_message(Arena *arena, Message9PType type)
+{
+  read_only local_persist String8 walk_names[] =
+  {
+    str8_lit_comp("usr"),     str8_lit_comp("glenda"),  str8_lit_comp("src"),     str8_lit_comp("cmd"),
+    str8_lit_comp("9pfs"),    str8_lit_comp("vendor"),  str8_lit_comp("github"),  str8_lit_comp("plan9"),
+    str8_lit_comp("sys"),     str8_lit_comp("lib"),     str8_lit_comp("include"), str8_lit_comp("ape"),
+    str8_lit_comp("private"), str8_lit_comp("network"), str8_lit_comp("tests"),   str8_lit_comp("main.c"),
+  };
+  Qid qid       = {QidTypeFlag_File, 3, 0x12345};
+  Message9P msg = msg9p_zero();
+  msg.type      = type;
+  msg.tag       = 17;
+  msg.fid       = 42;
+  switch(type)
+  {
+  case Msg9P_Tversion:
+  case Msg9P_Rversion:
+  {
+    msg.tag              = P9_TAG_NONE;
+    msg.max_message_size = P9_MESSAGE_SIZE_DEFAULT;
+    msg.protocol_version = str8_lit("9P2000");
+  }break;
+  case Msg9P_Tauth:
+  case Msg9P_Tattach:
+  {
+    msg.auth_fid    = type == Msg9P_Tauth ? 1 : P9_FID_NONE;
+    msg.user_name   = str8_lit("glenda");
+    msg.attach_path = str8_lit("/srv/share");
+  }break;
+  case Msg9P_Rauth:  { msg.auth_qid = qid; }break;
+  case Msg9P_Rerror: { msg.error_message = str8_lit("file does not exist"); }break;
+  case Msg9P_Tflush: { msg.cancel_tag = 16; }break;
+  case Msg9P_Twalk:
+  {
+    msg.new_fid         = 43;
+    msg.walk_name_count = ArrayCount(walk_names);
+    for(u64 i = 0; i < ArrayCount(walk_names); i += 1) { msg.walk_names[i] = walk_names[i]; }
+  }break;
+  case Msg9P_Rwalk:
+  {
+    msg.walk_qid_count = P9_MAX_WALK_ELEM_COUNT;
+    for(u64 i = 0; i < P9_MAX_WALK_ELEM_COUNT; i += 1)
+    {
+      msg.walk_qids[i]      = qid;
+      msg.walk_qids[i].path = qid.path + i;
+    }
+  }break;
+  case Msg9P_Topen: { msg.open_mode = P9_OpenFlag_Read; }break;
+  case Msg9P_Tcreate:
+  {
+    msg.name        = str8_lit("output.log");
+    msg.permissions = 0644;
+    msg.open_mode   = P9_OpenFlag_ReadWrite;
+  }break;
+  case Msg9P_Rattach:
+  case Msg9P_Ropen:
+  case Msg9P_Rcreate:
+  {
+    msg.qid          = qid;
+    msg.io_unit_size = type == Msg9P_Rattach ? 0 : P9_IOUNIT_DEFAULT;
+  }break;
+  case Msg9P_Tread:
+  {
+    msg.file_offset = MB(64);
+    msg.byte_count  = P9_IOUNIT_DEFAULT;
+  }break;
+  case Msg9P_Rread:
+  case Msg9P_Twrite:
+  {
+    u64 size          = type == Msg9P_Rread ? MB(1) : KB(64);
+    msg.file_offset   = MB(64);
+    msg.payload_data  = str8(push_array(arena, u8, size), size);
+    msg.byte_count    = (u32)size;
+  }break;
+  case Msg9P_Rwrite: { msg.byte_count = KB(64); }break;
+  case Msg9P_Rstat:
+  case Msg9P_Twstat: { msg.stat_data = str8_from_dir9p(arena, bench_codec_dir(arena, 0)); }break;
+  default: break;
+  }
+  return msg;
+}
+
+// Runs one operation on c and returns the bytes it covered, or 0 if it failed
+internal u64
+bench_codec_op(Arena *arena, BenchCodecCase *c, BenchCodecMode mode)
+{
+  u64 result = 0;
+  if(c->msg.type != 0)
+  {
+    switch(mode)
+    {
+    case BenchCodecMode_Size:   { result = msg9p_size(c->msg); }break;
+    case BenchCodecMode_Encode: { result = str8_from_msg9p(arena, c->msg).size; }break;
+    case BenchCodecMode_DecodeCopy:
+    case BenchCodecMode_DecodeView:
+    {
+      // Stat messages also decode their stat blob, as a server handling them would
+      b32 view    = mode == BenchCodecMode_DecodeView;
+      Message9P f = view ? msg9p_view_from_str8(c->data) : msg9p_from_str8(arena, c->data);
+      if(f.type != c->msg.type) { break; }
+      if(f.stat_data.size > 0)
+      {
+        Dir9P dir = view ? dir9p_view_from_str8(f.stat_data) : dir9p_from_str8(arena, f.stat_data);
+        if(dir.name.size == 0) { break; }
+      }
+      result = c->data.size;
+    }break;
+    }
+    return result;
+  }
+
+  //- readdir batch: what one Rread of a directory carries
+  switch(mode)
+  {
+  case BenchCodecMode_Size:
+  {
+    for(u64 i = 0; i < c->dir_count; i += 1) { result += dir9p_size(c->dirs[i]); }
+  }break;
+  case BenchCodecMode_Encode:
+  {
+    for(u64 i = 0; i < c->dir_count; i += 1) { result += str8_from_dir9p(arena, c->dirs[i]).size; }
+  }break;
+  case BenchCodecMode_DecodeCopy:
+  {
+    DirList9P list = client9p_dir_list_from_str8(arena, c->data);
+    if(list.count == c->dir_count) { result = c->data.size; }
+  }break;
+  case BenchCodecMode_DecodeView:
+  {
+    u64 count = 0;
+    for(u64 offset = 0; offset + P9_STRING8_SIZE_FIELD_SIZE <= c->data.size;)
+    {
+      u64 entry_size = P9_STRING8_SIZE_FIELD_SIZE + from_le_u16(read_u16(c->data.str + offset));
+      Dir9P dir      = dir9p_view_from_str8(str8(c->data.str + offset, Min(entry_size, c->data.size - offset)));
+      if(dir.name.size == 0) { break; }
+      offset += entry_size;
+      count  += 1;
+    }
+    if(count == c->dir_count) { result = c->data.size; }
+  }break;
+  }
+  return result;
+}
+
+// Repeats the operation in batches until the time budget is spent, so
+// 20-byte and 1 MiB messages both get a stable measurement
+internal BenchResult
+bench_codec_run(Arena *arena, BenchCodecCase *c, BenchCodecMode mode)
+{
+  BenchResult result   = {0};
+  result.counts_allocs = 1;
+  u64 push_count       = arena_push_count;
+  u64 start            = os_now_microseconds();
+  for(; result.elapsed_us < BENCH_CODEC_TIME_US;)
+  {
+    for(u64 i = 0; i < BENCH_CODEC_BATCH_COUNT; i += 1)
+    {
+      Temp temp      = temp_begin(arena);
+      u64 byte_count = bench_codec_op(temp.arena, c, mode);
+      temp_end(temp);
+      if(byte_count == 0) { result.op_count = 0; return result; }
+      result.byte_count += byte_count;
+    }
+    result.op_count   += BENCH_CODEC_BATCH_COUNT;
+    result.elapsed_us  = os_now_microseconds() - start;
+  }
+  result.alloc_count = arena_push_count - push_count;
+  return result;
+}
+
+internal void
+run_codec_benchmarks(Arena *arena, String8 filter)
+{
+  u64 case_count        = ArrayCount(bench_codec_types) + 1;
+  BenchCodecCase *cases = push_array(arena, BenchCodecCase, case_count);
+  for(u64 i = 0; i < ArrayCount(bench_codec_types); i += 1)
+  {
+    cases[i].name = bench_codec_types[i].name;
+    cases[i].msg  = bench_codec_message(arena, bench_codec_types[i].type);
+    cases[i].data = str8_from_msg9p(arena, cases[i].msg);
+  }
+
+  BenchCodecCase *readdir = &cases[case_count - 1];
+  String8List entries     = {0};
+  readdir->name           = str8_lit("readdir64");
+  readdir->dir_count      = BENCH_CODEC_DIR_COUNT;
+  readdir->dirs           = push_array(arena, Dir9P, BENCH_CODEC_DIR_COUNT);
+  for(u64 i = 0; i < BENCH_CODEC_DIR_COUNT; i += 1)
+  {
+    readdir->dirs[i] = bench_codec_dir(arena, i);
+    str8_list_push(arena, &entries, str8_from_dir9p(arena, readdir->dirs[i]));
+  }
+  readdir->data = str8_list_join(arena, entries, 0);
+
+  for(u64 i = 0; i < case_count; i += 1)
+  {
+    for(BenchCodecMode mode = 0; mode < BenchCodecMode_COUNT; mode += 1)
+    {
+      String8 name = str8f(arena, "codec_%S_%S", cases[i].name, bench_codec_mode_names[mode]);
+      if(!str8_match(str8_prefix(name, filter.size), filter, 0)) { continue; }
+      Arena *bench_arena = arena_alloc();
+      BenchResult result = bench_codec_run(bench_arena, &cases[i], mode);
+      arena_release(bench_arena);
+      bench_report(name, result);
+    }
+  }
+}
+
+// Sends one 64 KiB Rread repeatedly to /dev/null, either encoded whole as
+// before or as a header written together with the caller's payload
+internal BenchResult
+bench_codec_send_rread(Arena *arena, b32 gather)
+{
+  BenchResult result = {0};
+  int fd             = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if(fd < 0) { result.skipped = 1; return result; }
+
+  Message9P msg        = msg9p_zero();
+  msg.type             = Msg9P_Rread;
+  msg.tag              = 1;
+  msg.payload_data     = str8(push_array(arena, u8, BENCH_CODEC_PAYLOAD_SIZE), BENCH_CODEC_PAYLOAD_SIZE);
+  msg.byte_count       = BENCH_CODEC_PAYLOAD_SIZE;
+  result.counts_allocs = 1;
+  u64 push_count       = arena_push_count;
+  u64 start            = os_now_microseconds();
+  for(u64 i = 0; i < BENCH_CODEC_SEND_OP_COUNT; i += 1)
+  {
+    Temp temp       = temp_begin(arena);
+    String8 payload = str8_zero();
+    String8 header  = gather ? str8_from_msg9p_header(temp.arena, msg, &payload) : str8_from_msg9p(temp.arena, msg);
+    u64 written     = msg9p_write(fd, header, payload);
+    temp_end(temp);
+    if(written != P9_MESSAGE_MINIMUM_SIZE + 4 + BENCH_CODEC_PAYLOAD_SIZE) { close(fd); return result; }
+  }
+  result.elapsed_us  = os_now_microseconds() - start;
+  result.alloc_count = arena_push_count - push_count;
+  result.op_count    = BENCH_CODEC_SEND_OP_COUNT;
+  close(fd);
+  return result;
+}
+
+internal BenchResult
+bench_codec_rread_copy(Arena *arena)
+{
+  return bench_codec_send_rread(arena, 0);
+}
+
+internal BenchResult
+bench_codec_rread_gather(Arena *arena)
+{
+  return bench_codec_send_rread(arena, 1);
+}
+
+////////////////////////////////
+//~ Benchmark Runner
+
+internal void
+run_benchmarks(Arena *arena, String8 filter)
+{
+  BenchCase benchmarks[] = {
+    {str8_lit("fid_walk_clunk_100k"),           bench_fid_walk_clunk},
+    {str8_lit("fid_walk_clunk_transient_100k"), bench_fid_walk_clunk_transient},
+    {str8_lit("fid_lookup_100k"),               bench_fid_lookup},
+    {str8_lit("disk_read_4k_pread_qd1"),        bench_disk_pread_qd1},
+    {str8_lit("disk_read_4k_uring_qd1"),        bench_disk_ring_qd1},
+    {str8_lit("disk_read_4k_uring_qd64"),       bench_disk_ring_qd64},
+    {str8_lit("codec_send_rread_64k_copy"),     bench_codec_rread_copy},
+    {str8_lit("codec_send_rread_64k_gather"),   bench_codec_rread_gather},
+  };
+
+  for(u64 i = 0; i < ArrayCount(benchmarks); i += 1)
+  {
+    if(!str8_match(str8_prefix(benchmarks[i].name, filter.size), filter, 0)) { continue; }
+    Temp scratch       = scratch_begin(&arena, 1);
+    Arena *bench_arena = arena_alloc();
+    BenchResult result = benchmarks[i].func(bench_arena);
+    arena_release(bench_arena);
+    scratch_end(scratch);
+    bench_report(benchmarks[i].name, result);
+  }
+  run_codec_benchmarks(arena, filter);
+}
+
+////////////////////////////////
+//~ Entry Point
+
+internal void
+entry_point(CmdLine *cmd_line)
+{
+  String8 disk_dir_arg = cmd_line_string(cmd_line, str8_lit("disk-dir"));
+  String8 filter       = cmd_line_string(cmd_line, str8_lit("filter"));
+  bench_disk_dir       = (disk_dir_arg.size > 0) ? disk_dir_arg : str8_lit(".");
+  Temp scratch         = scratch_begin(0, 0);
+  Log *log     = log_alloc();
+  log_select(log);
+  log_scope_begin();
+
+  run_benchmarks(scratch.arena, filter);
+
+  log_scope_flush(scratch.arena);
+  scratch_end(scratch);
+}
@@ -3,6 +3,14 @@
 #include "base/inc.c"
 #include "9p/inc.c"
 
+////////////////////////////////
+//~ Globals
+
+// Set with --root when the server exports a directory on this host, for
+// tests that change its tree behind the server's back
+global String8 test_address   = {0};
+global String8 test_root_path = {0};
+
 ////////////////////////////////
 //~ Helper Functions
 
@@ -401,6 +409,27 @@ test_readdir_many(Arena *arena, Client9P *client)
   return result;
 }
 
+internal b32
+test_small_msize(Arena *arena, Client9P *client)
+{
+  // Linux v9fs mounts with msize=4096; that is granted as asked, and a
+  // listing spread over many replies still works at that size
+  (void)client;
+  OS_Handle socket = dial9p_connect(arena, test_address, str8_lit("tcp"), str8_lit("9pfs"));
+  if(os_handle_match(socket, os_handle_zero())) { return 0; }
+  Client9P *small = client9p_init(arena, socket.u64[0]);
+  if(small == 0) { return 0; }
+
+  b32 result  = !client9p_version(arena, small, KB(2));
+  result      = result && client9p_version(arena, small, KB(4)) && small->max_message_size == KB(4);
+  small->root = result ? client9p_attach(arena, small, P9_FID_NONE, get_user_name(arena), str8_zero()) : 0;
+  ClientFid9P *fid = small->root != 0 ? client9p_open(arena, small, str8_lit("many_dir"), P9_OpenFlag_Read) : 0;
+  result           = result && fid != 0 && client9p_fid_read_dirs(arena, fid).count >= 100;
+  if(fid != 0) { client9p_fid_close(arena, fid); }
+  client9p_unmount(arena, small);
+  return result;
+}
+
 internal b32
 test_readdir_long_names(Arena *arena, Client9P *client)
 {
@@ -507,6 +536,121 @@ test_truncate_grow(Arena *arena, Client9P *client)
   return test_stat_file(arena, client, str8_lit("partial_write"), new_data.size);
 }
 
+internal b32
+test_sparse_hole(Arena *arena, Client9P *client)
+{
+  // A write past the end leaves a hole that reads back as zeros
+  ClientFid9P *fid = test_open_or_create(arena, client, str8_lit("sparse_file"), P9_OpenFlag_ReadWrite | P9_OpenFlag_Truncate, 0666);
+  if(fid == 0) { return 0; }
+
+  String8 tail   = str8_lit("tail");
+  u64 hole_size  = MB(1) + 123;
+  s64 written    = client9p_fid_pwrite(arena, fid, tail.str, tail.size, hole_size);
+  u64 total_size = hole_size + tail.size;
+  u8 *buf        = push_array(arena, u8, total_size);
+  MemorySet(buf, 0xff, total_size);
+  s64 n = client9p_fid_pread(arena, fid, buf, total_size, 0);
+  client9p_fid_close(arena, fid);
+  if(written != (s64)tail.size || n != (s64)total_size) { return 0; }
+
+  for(u64 i = 0; i < hole_size; i += 1)
+  {
+    if(buf[i] != 0) { return 0; }
+  }
+  if(!MemoryMatch(buf + hole_size, tail.str, tail.size)) { return 0; }
+  return test_stat_file(arena, client, str8_lit("sparse_file"), total_size);
+}
+
+internal b32
+test_truncate_then_grow(Arena *arena, Client9P *client)
+{
+  // Bytes cut off by a shrink must not come back when the file grows again
+  u64 size   = KB(12) + 7;
+  u64 kept   = 100;
+  u8 *data   = push_array(arena, u8, size);
+  MemorySet(data, 0xaa, size);
+  if(!test_write_read(arena, client, str8_lit("regrow_file"), str8(data, size))) { return 0; }
+  if(!test_wstat_truncate(arena, client, str8_lit("regrow_file"), kept))         { return 0; }
+  if(!test_wstat_truncate(arena, client, str8_lit("regrow_file"), size))         { return 0; }
+
+  ClientFid9P *fid = client9p_open(arena, client, str8_lit("regrow_file"), P9_OpenFlag_Read);
+  if(fid == 0) { return 0; }
+  u8 *buf = push_array(arena, u8, size);
+  s64 n   = client9p_fid_pread(arena, fid, buf, size, 0);
+  client9p_fid_close(arena, fid);
+  if(n != (s64)size) { return 0; }
+
+  for(u64 i = 0; i < size; i += 1)
+  {
+    if(buf[i] != (i < kept ? 0xaa : 0)) { return 0; }
+  }
+  return 1;
+}
+
+internal b32
+test_rename_contents(Arena *arena, Client9P *client)
+{
+  // A rename moves the contents and leaves nothing under the old name
+  String8 data = str8_lit("contents that follow a rename");
+  if(!test_write_read(arena, client, str8_lit("rename_src"), data))                  { return 0; }
+  if(!test_wstat_rename(arena, client, str8_lit("rename_src"), str8_lit("rename_dst"))) { return 0; }
+  if(client9p_stat(arena, client, str8_lit("rename_src")).name.size != 0)            { return 0; }
+
+  ClientFid9P *fid = client9p_open(arena, client, str8_lit("rename_dst"), P9_OpenFlag_Read);
+  if(fid == 0) { return 0; }
+  u8 *buf = push_array(arena, u8, data.size);
+  s64 n   = client9p_fid_pread(arena, fid, buf, data.size, 0);
+  client9p_fid_close(arena, fid);
+  if(n != (s64)data.size || !MemoryMatch(buf, data.str, data.size)) { return 0; }
+  return client9p_remove(arena, client, str8_lit("rename_dst"));
+}
+
+internal b32
+test_read_removed_open(Arena *arena, Client9P *client)
+{
+  // A fid opened before the file is removed keeps reading its contents
+  String8 data = str8_lit("still readable after remove");
+  if(!test_write_read(arena, client, str8_lit("removed_open"), data)) { return 0; }
+
+  ClientFid9P *fid = client9p_open(arena, client, str8_lit("removed_open"), P9_OpenFlag_Read);
+  if(fid == 0) { return 0; }
+  if(!client9p_remove(arena, client, str8_lit("removed_open")))
+  {
+    client9p_fid_close(arena, fid);
+    return 0;
+  }
+
+  u8 *buf = push_array(arena, u8, data.size);
+  s64 n   = client9p_fid_pread(arena, fid, buf, data.size, 0);
+  client9p_fid_close(arena, fid);
+  if(n != (s64)data.size || !MemoryMatch(buf, data.str, data.size)) { return 0; }
+  return client9p_stat(arena, client, str8_lit("removed_open")).name.size == 0;
+}
+
+internal b32
+test_write_visible_other_fid(Arena *arena, Client9P *client)
+{
+  // A small write is seen by another fid and by Tstat before the writer clunks
+  String8 data       = str8_lit("9 bytes!\n");
+  ClientFid9P *write = test_open_or_create(arena, client, str8_lit("shared_write"), P9_OpenFlag_Write | P9_OpenFlag_Truncate, 0666);
+  if(write == 0) { return 0; }
+  ClientFid9P *read = client9p_open(arena, client, str8_lit("shared_write"), P9_OpenFlag_Read);
+  if(read == 0)
+  {
+    client9p_fid_close(arena, write);
+    return 0;
+  }
+
+  s64 written = client9p_fid_pwrite(arena, write, data.str, data.size, 0);
+  u8 *buf     = push_array(arena, u8, data.size);
+  s64 n       = client9p_fid_pread(arena, read, buf, data.size, 0);
+  b32 result  = written == (s64)data.size && n == (s64)data.size && MemoryMatch(buf, data.str, data.size) &&
+                test_stat_file(arena, client, str8_lit("shared_write"), data.size);
+  client9p_fid_close(arena, read);
+  client9p_fid_close(arena, write);
+  return result;
+}
+
 internal b32 test_remove_nonexistent(Arena *arena, Client9P *client) { return client9p_remove(arena, client, str8_lit("nonexistent_remove_xyz")) == 0; }
 
 internal b32
@@ -518,6 +662,212 @@ test_create_existing(Arena *arena, Client9P *client)
   return fid == 0;
 }
 
+internal b32
+test_flush_idle(Arena *arena, Client9P *client)
+{
+  Message9P tx  = msg9p_zero();
+  tx.type       = Msg9P_Tflush;
+  tx.cancel_tag = P9_TAG_NONE - 1;
+  Message9P rx  = client9p_rpc(arena, client, tx);
+  if(rx.type != Msg9P_Rflush) { return 0; }
+
+  Dir9P dir = client9p_stat(arena, client, str8_zero());
+  return dir.qid.type & QidTypeFlag_Directory;
+}
+
+internal b32
+test_flush_walk(Arena *arena, Client9P *client)
+{
+  // Walks cancelled while still queued must not leave their new fids behind
+  u32 fids[32]      = {0};
+  u32 walk_tags[32] = {0};
+  b32 walked[32]    = {0};
+  u64 count         = ArrayCount(fids);
+  for(u64 i = 0; i < count; i += 1)
+  {
+    Message9P tx       = msg9p_zero();
+    tx.type            = Msg9P_Twalk;
+    tx.tag             = client9p_next_tag(client);
+    tx.fid             = client->root->fid;
+    tx.new_fid         = ins_atomic_u32_inc_eval(&client->next_fid) - 1;
+    tx.walk_name_count = 0;
+    fids[i]            = tx.new_fid;
+    walk_tags[i]       = tx.tag;
+    if(!client9p_send(arena, client, tx)) { return 0; }
+  }
+  for(u64 i = 0; i < count; i += 1)
+  {
+    Message9P tx  = msg9p_zero();
+    tx.type       = Msg9P_Tflush;
+    tx.tag        = client9p_next_tag(client);
+    tx.cancel_tag = walk_tags[i];
+    if(!client9p_send(arena, client, tx)) { return 0; }
+  }
+  for(u64 i = 0; i < count * 2; i += 1)
+  {
+    Message9P rx = client9p_receive(arena, client);
+    if(rx.type == 0) { return 0; }
+    if(rx.type != Msg9P_Rwalk) { continue; }
+    for(u64 j = 0; j < count; j += 1)
+    {
+      if(walk_tags[j] == rx.tag) { walked[j] = 1; }
+    }
+  }
+
+  // Every fid is free again once the successful walks are clunked
+  for(u64 i = 0; i < count; i += 1)
+  {
+    Message9P tx = msg9p_zero();
+    if(walked[i])
+    {
+      tx.type = Msg9P_Tclunk;
+      tx.fid  = fids[i];
+      if(client9p_rpc(arena, client, tx).type != Msg9P_Rclunk) { return 0; }
+    }
+    tx                 = msg9p_zero();
+    tx.type            = Msg9P_Twalk;
+    tx.fid             = client->root->fid;
+    tx.new_fid         = fids[i];
+    tx.walk_name_count = 0;
+    if(client9p_rpc(arena, client, tx).type != Msg9P_Rwalk) { return 0; }
+    tx      = msg9p_zero();
+    tx.type = Msg9P_Tclunk;
+    tx.fid  = fids[i];
+    if(client9p_rpc(arena, client, tx).type != Msg9P_Rclunk) { return 0; }
+  }
+  return 1;
+}
+
+internal b32
+test_readdir_concurrent_create(Arena *arena, Client9P *client)
+{
+  // Files created between pages of a listing must not shift later offsets:
+  // every original entry appears exactly once and none appears twice
+  u64 file_count = 2000;
+  if(!test_create_directory(arena, client, str8_lit("paged_dir"))) { return 0; }
+  for(u64 i = 0; i < file_count; i += 1)
+  {
+    if(!test_create_file(arena, client, str8f(arena, "paged_dir/page_%05llu", i))) { return 0; }
+  }
+
+  ClientFid9P *fid = client9p_open(arena, client, str8_lit("paged_dir"), P9_OpenFlag_Read);
+  if(fid == 0) { return 0; }
+
+  u64 new_max   = file_count;
+  u8 *seen      = push_array(arena, u8, file_count);
+  u8 *new_seen  = push_array(arena, u8, new_max);
+  u64 new_count = 0;
+  u64 page_size = KB(8);
+  u8 *page      = push_array(arena, u8, page_size);
+  b32 result    = 1;
+  u64 offset    = 0;
+  for(u64 read_idx = 0; result; read_idx += 1)
+  {
+    s64 n = client9p_fid_pread(arena, fid, page, page_size, offset);
+    if(n <= 0) { break; }
+    offset += n;
+
+    DirList9P list = client9p_dir_list_from_str8(arena, str8(page, n));
+    for(DirNode9P *node = list.first; node != 0; node = node->next)
+    {
+      String8 name = node->dir.name;
+      u8 *slot     = 0;
+      if(str8_match(str8_prefix(name, 5), str8_lit("page_"), 0))     { slot = &seen[u64_from_str8(str8_skip(name, 5), 10) % file_count]; }
+      else if(str8_match(str8_prefix(name, 4), str8_lit("new_"), 0)) { slot = &new_seen[u64_from_str8(str8_skip(name, 4), 10) % new_max]; }
+      if(slot == 0 || *slot) { result = 0; break; }
+      *slot = 1;
+    }
+
+    if(read_idx % 5 == 4 && new_count < new_max)
+    {
+      if(!test_create_file(arena, client, str8f(arena, "paged_dir/new_%05llu", new_count))) { result = 0; }
+      new_count += 1;
+    }
+  }
+  client9p_fid_close(arena, fid);
+
+  for(u64 i = 0; i < file_count && result; i += 1)
+  {
+    if(!seen[i]) { result = 0; }
+  }
+  return result;
+}
+
+internal b32
+test_dir_mtime_out_of_band(Arena *arena, Client9P *client)
+{
+  // A directory's cached stat must follow entries created outside 9pfs
+  ClientFid9P *dir_fid = client9p_create(arena, client, str8_lit("oob_dir"), P9_OpenFlag_Read, P9_ModeFlag_Directory | 0755);
+  if(dir_fid == 0) { return 0; }
+  client9p_fid_close(arena, dir_fid);
+
+  ClientFid9P *fid = client9p_fid_walk(arena, client->root, str8_lit("oob_dir"));
+  if(fid == 0) { return 0; }
+  // Everything but the mtime is left as is
+  Dir9P dir       = dir9p_zero();
+  dir.mode        = max_u32;
+  dir.length      = max_u64;
+  dir.access_time = max_u32;
+  dir.modify_time = 1000000;
+  b32 set         = client9p_fid_wstat(arena, fid, dir);
+  Dir9P before    = client9p_fid_stat(arena, fid);
+  if(!set || before.modify_time != 1000000) { client9p_fid_close(arena, fid); return 0; }
+
+  String8 child_path = str8f(arena, "%S/oob_dir/child", test_root_path);
+  int fd             = open((char *)child_path.str, O_CREAT | O_WRONLY, 0644);
+  if(fd < 0) { client9p_fid_close(arena, fid); return 0; }
+  close(fd);
+
+  // inotify delivers asynchronously, so give the server a moment
+  b32 changed = 0;
+  for(u64 attempt = 0; attempt < 50 && !changed; attempt += 1)
+  {
+    os_sleep_milliseconds(10);
+    Dir9P old_fid_dir = client9p_fid_stat(arena, fid);
+    Dir9P new_fid_dir = client9p_stat(arena, client, str8_lit("oob_dir"));
+    changed           = old_fid_dir.modify_time != before.modify_time && new_fid_dir.modify_time != before.modify_time;
+  }
+  client9p_fid_close(arena, fid);
+  return changed;
+}
+
+internal b32
+test_symlink_escape(Arena *arena, Client9P *client)
+{
+  // Symlinks leaving the export are refused, including ones swapped in
+  // after a fid was walked to a plain file or directory
+  String8 outside_path = str8f(arena, "%S.outside", test_root_path);
+  int fd               = open((char *)outside_path.str, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if(fd < 0) { return 0; }
+  close(fd);
+
+  String8 outside_name = str8_skip_last_slash(outside_path);
+  String8 abs_link     = str8f(arena, "%S/esc_abs", test_root_path);
+  String8 rel_link     = str8f(arena, "%S/esc_rel", test_root_path);
+  String8 rel_target   = str8f(arena, "../%S", outside_name);
+  b32 result           = symlink((char *)outside_path.str, (char *)abs_link.str) == 0 &&
+                         symlink((char *)rel_target.str, (char *)rel_link.str) == 0;
+  result = result && client9p_open(arena, client, str8_lit("esc_abs"), P9_OpenFlag_Read) == 0;
+  result = result && client9p_open(arena, client, str8_lit("esc_rel"), P9_OpenFlag_Read) == 0;
+
+  result = result && test_create_directory(arena, client, str8_lit("swap_dir")) && test_create_file(arena, client, str8_lit("swap_file"));
+  ClientFid9P *dir_fid  = client9p_fid_walk(arena, client->root, str8_lit("swap_dir"));
+  ClientFid9P *file_fid = client9p_fid_walk(arena, client->root, str8_lit("swap_file"));
+  result                = result && dir_fid != 0 && file_fid != 0;
+
+  String8 swap_dir  = str8f(arena, "%S/swap_dir", test_root_path);
+  String8 swap_file = str8f(arena, "%S/swap_file", test_root_path);
+  result = result && rmdir((char *)swap_dir.str) == 0 && symlink("/", (char *)swap_dir.str) == 0;
+  result = result && unlink((char *)swap_file.str) == 0 && symlink((char *)outside_path.str, (char *)swap_file.str) == 0;
+  result = result && !client9p_fid_open(arena, dir_fid, P9_OpenFlag_Read);
+  result = result && !client9p_fid_open(arena, file_fid, P9_OpenFlag_Read);
+
+  if(dir_fid != 0)  { client9p_fid_close(arena, dir_fid); }
+  if(file_fid != 0) { client9p_fid_close(arena, file_fid); }
+  unlink((char *)outside_path.str);
+  return result;
+}
+
 ////////////////////////////////
 //~ Test Runner
 
@@ -526,6 +876,7 @@ struct TestCase
 {
   String8 name;
   b32 (*func)(Arena *, Client9P *);
+  b32 needs_root;
 };
 
 internal void
@@ -576,6 +927,7 @@ run_tests(Arena *arena, String8 address)
     {str8_lit("deep_nesting"),       test_deep_nesting},
     {str8_lit("many_files"),         test_many_files},
     {str8_lit("readdir_many"),       test_readdir_many},
+    {str8_lit("small_msize"),        test_small_msize},
     {str8_lit("readdir_long_names"), test_readdir_long_names},
     {str8_lit("multiple_fids"),      test_multiple_fids},
     {str8_lit("walk_partial"),       test_walk_partial},
@@ -583,8 +935,18 @@ run_tests(Arena *arena, String8 address)
     {str8_lit("permissions"),        test_permissions},
     {str8_lit("qid_consistency"),    test_qid_consistency},
     {str8_lit("truncate_grow"),      test_truncate_grow},
+    {str8_lit("sparse_hole"),        test_sparse_hole},
+    {str8_lit("truncate_then_grow"), test_truncate_then_grow},
+    {str8_lit("rename_contents"),    test_rename_contents},
+    {str8_lit("read_removed_open"),  test_read_removed_open},
     {str8_lit("remove_nonexistent"), test_remove_nonexistent},
     {str8_lit("create_existing"),    test_create_existing},
+    {str8_lit("flush_idle"),         test_flush_idle},
+    {str8_lit("flush_walk"),         test_flush_walk},
+    {str8_lit("readdir_create"),     test_readdir_concurrent_create},
+    {str8_lit("write_other_fid"),    test_write_visible_other_fid},
+    {str8_lit("dir_mtime_oob"),      test_dir_mtime_out_of_band, 1},
+    {str8_lit("symlink_escape"),     test_symlink_escape, 1},
   };
 
   u64 test_count = ArrayCount(tests);
@@ -593,6 +955,12 @@ run_tests(Arena *arena, String8 address)
 
   for(u64 i = 0; i < test_count; i += 1)
   {
+    if(tests[i].needs_root && test_root_path.size == 0)
+    {
+      log_infof("SKIP: %S (needs --root)\n", tests[i].name);
+      continue;
+    }
+
     Temp scratch = scratch_begin(&arena, 1);
     b32 result = tests[i].func(scratch.arena, client);
     scratch_end(scratch);
@@ -627,11 +995,14 @@ entry_point(CmdLine *cmd_line)
   log_scope_begin();
 
   String8 address = (cmd_line->inputs.node_count > 0) ? cmd_line->inputs.first->string : str8_zero();
+  test_address    = address;
+  test_root_path  = cmd_line_string(cmd_line, str8_lit("root"));
 
   if(address.size == 0)
   {
-    log_error(str8_lit("usage: 9pfs-test <address>\n"
-                       "  <address>  Dial string (e.g., tcp!localhost!5640)\n"));
+    log_error(str8_lit("usage: 9pfs-test [--root=<dir>] <address>\n"
+                       "  --root=<dir>  Directory the server exports, for tests that change it out of band\n"
+                       "  <address>     Dial string (e.g., tcp!localhost!5640)\n"));
   }
   else { run_tests(scratch.arena, address); }
 
@@ -1,14 +1,95 @@
+#include <sys/epoll.h>
+
 #include "base/inc.h"
 #include "9p/inc.h"
 #include "base/inc.c"
 #include "9p/inc.c"
 
-global FsContext9P *fs_context       = 0;
-global WP_Pool     *worker_pool      = 0;
-global b32          require_auth     = 0;
-global String8      auth_daemon_addr = {0};
-global String8      auth_id          = {0};
+////////////////////////////////
+//~ Connection Types
+
+typedef struct Srv_IOThread Srv_IOThread;
+typedef struct Srv_Connection Srv_Connection;
+struct Srv_IOThread
+{
+  int epoll_fd;
+  Thread thread;
+  Srv_Connection *corked_first;
+};
+
+struct Srv_Connection
+{
+  Srv_Connection *next;
+  Srv_Connection *corked_next;
+  b32 corked_listed;
+  Arena *arena;
+  OS_Handle socket;
+  Server9P *server;
+  Srv_IOThread *io_thread;
+  u64 id;
+  u64 open_time;
+  u64 request_count;
+  u64 error_count;
+  u64 in_flight;
+  u64 read_bytes;
+  u64 write_bytes;
+  u64 response_write_count;
+};
 
+////////////////////////////////
+//~ Statistics Types
+
+#define SRV_OP_COUNT             ((Msg9P_Twstat - Msg9P_Tversion) / 2 + 1)
+#define SRV_LATENCY_BUCKET_COUNT 128
+#define SRV_BATCH_BUCKET_COUNT   9
+
+typedef struct Srv_OpStats Srv_OpStats;
+struct Srv_OpStats
+{
+  u64 count;
+  u64 error_count;
+  u64 byte_count;
+  u64 in_flight;
+  u64 latency_sum_us;
+  u64 latency_max_us;
+  u64 latency_buckets[SRV_LATENCY_BUCKET_COUNT];
+};
+
+read_only global String8 srv_op_names[SRV_OP_COUNT] =
+{
+  str8_lit_comp("Tversion"), str8_lit_comp("Tauth"),   str8_lit_comp("Tattach"), str8_lit_comp(""),
+  str8_lit_comp("Tflush"),   str8_lit_comp("Twalk"),   str8_lit_comp("Topen"),   str8_lit_comp("Tcreate"),
+  str8_lit_comp("Tread"),    str8_lit_comp("Twrite"),  str8_lit_comp("Tclunk"),  str8_lit_comp("Tremove"),
+  str8_lit_comp("Tstat"),    str8_lit_comp("Twstat"),
+};
+
+////////////////////////////////
+//~ Globals
+
+global FsContext9P    *fs_context         = 0;
+global WP_Pool        *worker_pool        = 0;
+global Srv_IOThread   *io_threads         = 0;
+global u64             io_thread_count    = 0;
+global u64             io_thread_next     = 0;
+global u32             msize_limit        = P9_MESSAGE_SIZE_CEILING;
+global u64             conn_memory_limit  = 0;
+global ServerBufferPool9P *buffer_pool    = 0;
+global b32             require_auth       = 0;
+global String8         auth_daemon_addr   = {0};
+global String8         auth_id            = {0};
+global Srv_OpStats     srv_op_stats[SRV_OP_COUNT];
+global u64             srv_batch_buckets[SRV_BATCH_BUCKET_COUNT];
+global u64             srv_batch_reply_count = 0;
+global Mutex           connection_mutex   = {0};
+global Srv_Connection *connection_first   = 0;
+global u64             connection_next_id = 0;
+global u64             connection_total   = 0;
+global u64             server_start_time  = 0;
+
+////////////////////////////////
+//~ Fid Auxiliary State
+
+// Caller holds server->mutex.
 internal FidAuxiliary9P *
 fid_aux_alloc(Server9P *server)
 {
@@ -16,6 +97,7 @@ fid_aux_alloc(Server9P *server)
   if(aux != 0) { server->fid_aux_free_list = aux->next; }
   else         { aux = push_array_no_zero(server->arena, FidAuxiliary9P, 1); }
   MemoryZeroStruct(aux);
+  aux->path_fd = -1;
   return aux;
 }
 
@@ -23,51 +105,497 @@ internal void
 fid_aux_release(Server9P *server, FidAuxiliary9P *aux)
 {
   if(aux == 0)          { return; }
-  if(aux->handle)       { fs9p_close(aux->handle); aux->handle = 0; }
-  if(aux->has_dir_iter) { fs9p_closedir(&aux->dir_iter); aux->has_dir_iter = 0; }
+  if(aux->path_fd >= 0) { close(aux->path_fd); aux->path_fd = -1; }
+  if(aux->handle)
+  {
+    // Fids dropped without a Tclunk still get their buffered writes
+    fs9p_write_flush(aux->handle, &aux->write_buffer);
+    if(aux->write_buffer.dirty && fs_context->sync_policy != SyncPolicy9P_None) { fs9p_sync(aux->handle); }
+    aux->write_buffer.dirty = 0;
+    fs9p_close(aux->handle);
+    aux->handle = 0;
+  }
+  if(aux->has_dir_iter) { fs9p_closedir(aux->dir_iter); aux->has_dir_iter = 0; }
   if(aux->auth_client)
   {
     close(aux->auth_client->fd);
     aux->auth_client  = 0;
     aux->auth_rpc_fid = 0;
   }
+  if(aux->auth_arena) { arena_release(aux->auth_arena); aux->auth_arena = 0; }
+  if(!MemoryIsZeroStruct(&aux->mutex)) { mutex_release(aux->mutex); MemoryZeroStruct(&aux->mutex); }
 
-  aux->next                 = server->fid_aux_free_list;
-  server->fid_aux_free_list = aux;
+  MutexScope(server->mutex)
+  {
+    aux->next                 = server->fid_aux_free_list;
+    server->fid_aux_free_list = aux;
+  }
 }
 
 internal FidAuxiliary9P *
 fid_aux_get(Server9P *server, ServerFid9P *fid)
 {
-  if(fid->auxiliary == 0) { fid->auxiliary = fid_aux_alloc(server); }
-  return (FidAuxiliary9P *)fid->auxiliary;
+  FidAuxiliary9P *aux = 0;
+  MutexScope(server->mutex)
+  {
+    if(fid->auxiliary == 0) { fid->auxiliary = fid_aux_alloc(server); }
+    aux = (FidAuxiliary9P *)fid->auxiliary;
+  }
+  return aux;
 }
 
-internal String8 fid_aux_get_path(FidAuxiliary9P *aux) { return str8(aux->path_buffer, aux->path_len); }
+internal Mutex
+fid_aux_mutex(Server9P *server, FidAuxiliary9P *aux)
+{
+  Mutex result = {0};
+  MutexScope(server->mutex)
+  {
+    if(MemoryIsZeroStruct(&aux->mutex)) { aux->mutex = mutex_alloc(); }
+    result = aux->mutex;
+  }
+  return result;
+}
 
 internal void
-fid_aux_set_path(FidAuxiliary9P *aux, String8 path)
+fid_aux_destroy(ServerFid9P *fid)
 {
-  Assert(path.size <= sizeof(aux->path_buffer));
-  MemoryCopy(aux->path_buffer, path.str, path.size);
-  aux->path_len = path.size;
+  fid_aux_release(fid->server, (FidAuxiliary9P *)fid->auxiliary);
+}
+
+// Readers copy a fid's walk fd under its mutex and writers swap it there, so
+// a Twalk that replaces it never closes a descriptor another request holds
+internal int
+fid_aux_dup_path_fd(Server9P *server, FidAuxiliary9P *aux)
+{
+  int result = -1;
+  MutexScope(fid_aux_mutex(server, aux))
+  {
+    if(aux->path_fd >= 0) { result = fcntl(aux->path_fd, F_DUPFD_CLOEXEC, 0); }
+  }
+  return result;
 }
 
 internal void
-fid_release_all(Server9P *server)
+fid_aux_set_path_fd(Server9P *server, FidAuxiliary9P *aux, int fd)
+{
+  int old_fd = -1;
+  MutexScope(fid_aux_mutex(server, aux))
+  {
+    old_fd       = aux->path_fd;
+    aux->path_fd = fd;
+  }
+  if(old_fd >= 0) { close(old_fd); }
+}
+
+// Writes any coalesced data back to the file, then syncs it if asked and
+// anything was written since the last sync.
+internal b32
+fid_aux_flush(Server9P *server, FidAuxiliary9P *aux, b32 sync)
+{
+  if(aux->handle == 0 || (aux->write_buffer.size == 0 && !(sync && aux->write_buffer.dirty))) { return 1; }
+
+  b32 result = 1;
+  MutexScope(fid_aux_mutex(server, aux))
+  {
+    result = fs9p_write_flush(aux->handle, &aux->write_buffer);
+    if(sync && aux->write_buffer.dirty)
+    {
+      result                  = fs9p_sync(aux->handle) && result;
+      aux->write_buffer.dirty = 0;
+    }
+  }
+  return result;
+}
+
+internal s64
+fid_aux_splice_fd(ServerFid9P *fid)
+{
+  if(fs_context->readonly) { return -1; }
+
+  FidAuxiliary9P *aux = 0;
+  FsHandle9P *handle  = 0;
+  MutexScope(fid->server->mutex)
+  {
+    aux = (FidAuxiliary9P *)fid->auxiliary;
+    if(aux != 0 && !aux->is_auth_fid) { handle = aux->handle; }
+  }
+  if(handle == 0) { return -1; }
+
+  // Buffered writes must land before the spliced payload they may overlap
+  s64 result = fs9p_write_fd(handle);
+  if(result >= 0 && !fid_aux_flush(fid->server, aux, 0)) { result = -1; }
+  return result;
+}
+
+// The handle and its path live in the fid's storage, so they are reclaimed
+// with the fid on Tclunk or Tremove.
+internal FsHandle9P *
+fid_aux_open(ServerFid9P *fid, String8 path, u32 mode)
+{
+  Temp scratch       = scratch_begin(0, 0);
+  FsHandle9P *handle = fs9p_open(scratch.arena, fs_context, path, mode);
+  FsHandle9P *result = 0;
+  if(handle != 0)
+  {
+    result        = (FsHandle9P *)server9p_fid_push(fid, sizeof(FsHandle9P));
+    u8 *path_copy = result != 0 ? (u8 *)server9p_fid_push(fid, handle->path.size) : 0;
+    if(path_copy != 0)
+    {
+      MemoryCopy(path_copy, handle->path.str, handle->path.size);
+      *result      = *handle;
+      result->path = str8(path_copy, handle->path.size);
+    }
+    else
+    {
+      fs9p_close(handle);
+      result = 0;
+    }
+  }
+  scratch_end(scratch);
+  return result;
+}
+
+// Requests on one fid may run concurrently with a Twalk or Twstat that
+// rewrites its path in place, so readers copy it under the fid's mutex.
+internal String8
+fid_aux_get_path(Server9P *server, FidAuxiliary9P *aux, Arena *arena)
 {
-  for(u32 i = 0; i < server->fid_capacity; i += 1)
+  String8 result = str8_zero();
+  MutexScope(fid_aux_mutex(server, aux)) { result = str8_copy(arena, aux->path); }
+  return result;
+}
+
+// Paths live in the fid's storage at their own length. A longer path than
+// the current allocation gets a new one twice the size, so a fid walked in
+// place does not grow its storage on every Twalk. An open directory iterator
+// refers to the old path, so renaming one always moves to a new allocation.
+internal b32
+fid_aux_set_path(ServerFid9P *fid, FidAuxiliary9P *aux, String8 path)
+{
+  b32 result = 1;
+  MutexScope(fid_aux_mutex(fid->server, aux))
   {
-    ServerFid9P *fid = &server->fid_storage[i];
-    if(fid->fid != 0)
+    if(path.size > aux->path_capacity || aux->has_dir_iter)
     {
-      fid_aux_release(server, (FidAuxiliary9P *)fid->auxiliary);
-      fid->fid = 0;
+      u64 capacity = Max(path.size, aux->path_capacity * 2);
+      u8 *str      = (u8 *)server9p_fid_push(fid, capacity);
+      if(str != 0)
+      {
+        aux->path.str      = str;
+        aux->path_capacity = capacity;
+      }
+      result = str != 0;
+    }
+    if(result)
+    {
+      // The root's empty path has no storage to copy into
+      if(path.size > 0) { MemoryCopy(aux->path.str, path.str, path.size); }
+      aux->path.size = path.size;
     }
   }
+  return result;
+}
 
-  MemorySet(server->fid_hash_table, max_u8, server->fid_hash_capacity * sizeof(u32));
-  server->fid_count = 0;
+// The iterator is only allocated once the fid is opened on a directory and
+// is reused if the fid's directory has to be reopened. It keeps a pointer to
+// the fid's path, so it is opened under the mutex that guards renames.
+internal b32
+fid_aux_opendir(ServerFid9P *fid, FidAuxiliary9P *aux)
+{
+  b32 result = 0;
+  MutexScope(fid_aux_mutex(fid->server, aux))
+  {
+    if(aux->has_dir_iter) { fs9p_closedir(aux->dir_iter); aux->has_dir_iter = 0; }
+    if(aux->dir_iter == 0) { aux->dir_iter = (DirIterator9P *)server9p_fid_push(fid, sizeof(DirIterator9P)); }
+    if(aux->dir_iter != 0) { aux->has_dir_iter = fs9p_opendir(fs_context, aux->path, aux->dir_iter); }
+    result = aux->has_dir_iter;
+  }
+  return result;
+}
+
+////////////////////////////////
+//~ Statistics
+
+internal u64
+srv_op_idx_from_type(u32 type)
+{
+  if(type < Msg9P_Tversion || type > Msg9P_Twstat || (type & 1)) { return 3; }
+  return (type - Msg9P_Tversion) / 2;
+}
+
+// Log-linear buckets: four linear steps per power of two of microseconds
+internal u64
+srv_latency_bucket_from_us(u64 us)
+{
+  if(us < 4) { return us; }
+  u64 msb    = 63 - __builtin_clzll(us);
+  u64 sub    = (us >> (msb - 2)) & 3;
+  u64 result = (msb - 1) * 4 + sub;
+  return Min(result, SRV_LATENCY_BUCKET_COUNT - 1);
+}
+
+internal u64
+srv_latency_us_from_bucket(u64 bucket)
+{
+  if(bucket < 4) { return bucket; }
+  u64 msb = bucket / 4 + 1;
+  u64 sub = bucket % 4;
+  return ((4 + sub + 1) << (msb - 2)) - 1;
+}
+
+internal void
+srv_stats_request_begin(Srv_Connection *connection, ServerRequest9P *request)
+{
+  Srv_OpStats *op = &srv_op_stats[srv_op_idx_from_type(request->in_msg.type)];
+  ins_atomic_u64_inc_eval(&op->in_flight);
+  ins_atomic_u64_inc_eval(&connection->in_flight);
+}
+
+internal void
+srv_stats_request_end(ServerRequest9P *request)
+{
+  Srv_Connection *connection = (Srv_Connection *)request->server->auxiliary;
+  Srv_OpStats *op            = &srv_op_stats[srv_op_idx_from_type(request->in_msg.type)];
+  u64 latency_us             = os_now_microseconds() - request->receive_time_us;
+  b32 is_error               = request->error.size > 0;
+  u64 byte_count             = 0;
+  if(!is_error && (request->in_msg.type == Msg9P_Tread || request->in_msg.type == Msg9P_Twrite)) { byte_count = request->out_msg.byte_count; }
+
+  ins_atomic_u64_inc_eval(&op->count);
+  ins_atomic_u64_dec_eval(&op->in_flight);
+  ins_atomic_u64_add_eval(&op->byte_count, byte_count);
+  ins_atomic_u64_add_eval(&op->latency_sum_us, latency_us);
+  ins_atomic_u64_inc_eval(&op->latency_buckets[srv_latency_bucket_from_us(latency_us)]);
+  for(u64 max = ins_atomic_u64_eval(&op->latency_max_us); latency_us > max;)
+  {
+    u64 prev = ins_atomic_u64_eval_cond_assign(&op->latency_max_us, latency_us, max);
+    if(prev == max) { break; }
+    max = prev;
+  }
+  if(is_error) { ins_atomic_u64_inc_eval(&op->error_count); }
+
+  ins_atomic_u64_inc_eval(&connection->request_count);
+  ins_atomic_u64_dec_eval(&connection->in_flight);
+  if(is_error)                                  { ins_atomic_u64_inc_eval(&connection->error_count); }
+  if(request->in_msg.type == Msg9P_Tread)       { ins_atomic_u64_add_eval(&connection->read_bytes, byte_count); }
+  else if(request->in_msg.type == Msg9P_Twrite) { ins_atomic_u64_add_eval(&connection->write_bytes, byte_count); }
+}
+
+// Replies per response write, in power-of-two buckets up to 256 and more
+internal void
+srv_stats_output(Server9P *server, u64 reply_count)
+{
+  Srv_Connection *connection = (Srv_Connection *)server->auxiliary;
+  u64 bucket                 = Min(63 - __builtin_clzll(reply_count), SRV_BATCH_BUCKET_COUNT - 1);
+  ins_atomic_u64_inc_eval(&srv_batch_buckets[bucket]);
+  ins_atomic_u64_add_eval(&srv_batch_reply_count, reply_count);
+  ins_atomic_u64_inc_eval(&connection->response_write_count);
+}
+
+internal u64
+srv_latency_quantile_us(u64 *buckets, u64 count, f64 quantile)
+{
+  u64 target = (u64)(quantile * (f64)count + 0.5);
+  u64 seen   = 0;
+  for(u64 i = 0; i < SRV_LATENCY_BUCKET_COUNT; i += 1)
+  {
+    seen += buckets[i];
+    if(seen >= target && seen > 0) { return srv_latency_us_from_bucket(i); }
+  }
+  return 0;
+}
+
+internal String8
+srv_stats_text(Arena *arena)
+{
+  String8List list = {0};
+  u64 now          = os_now_unix();
+
+  str8_list_pushf(arena, &list, "9pfs_uptime_seconds %llu\n", now - server_start_time);
+  str8_list_pushf(arena, &list, "9pfs_connections_total %llu\n", ins_atomic_u64_eval(&connection_total));
+
+  //- per-op counters and latency summaries
+  read_only local_persist f64 quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  for(u64 op_idx = 0; op_idx < SRV_OP_COUNT; op_idx += 1)
+  {
+    String8 name = srv_op_names[op_idx];
+    if(name.size == 0) { continue; }
+
+    // Buckets are copied first so the quantiles agree with the count they are read against
+    Srv_OpStats *op = &srv_op_stats[op_idx];
+    u64 buckets[SRV_LATENCY_BUCKET_COUNT];
+    u64 count = 0;
+    for(u64 i = 0; i < SRV_LATENCY_BUCKET_COUNT; i += 1)
+    {
+      buckets[i]  = ins_atomic_u64_eval(&op->latency_buckets[i]);
+      count      += buckets[i];
+    }
+
+    str8_list_pushf(arena, &list, "9pfs_op_count{op=\"%S\"} %llu\n", name, count);
+    str8_list_pushf(arena, &list, "9pfs_op_errors{op=\"%S\"} %llu\n", name, ins_atomic_u64_eval(&op->error_count));
+    str8_list_pushf(arena, &list, "9pfs_op_bytes{op=\"%S\"} %llu\n", name, ins_atomic_u64_eval(&op->byte_count));
+    str8_list_pushf(arena, &list, "9pfs_op_in_flight{op=\"%S\"} %llu\n", name, ins_atomic_u64_eval(&op->in_flight));
+    str8_list_pushf(arena, &list, "9pfs_op_latency_us_sum{op=\"%S\"} %llu\n", name, ins_atomic_u64_eval(&op->latency_sum_us));
+    u64 latency_max_us = ins_atomic_u64_eval(&op->latency_max_us);
+    for(u64 i = 0; i < ArrayCount(quantiles); i += 1)
+    {
+      u64 latency_us = Min(srv_latency_quantile_us(buckets, count, quantiles[i]), latency_max_us);
+      str8_list_pushf(arena, &list, "9pfs_op_latency_us{op=\"%S\",quantile=\"%g\"} %llu\n", name, quantiles[i], latency_us);
+    }
+    str8_list_pushf(arena, &list, "9pfs_op_latency_us_max{op=\"%S\"} %llu\n", name, latency_max_us);
+  }
+
+  //- response batching
+  u64 batch_write_count = 0;
+  for(u64 i = 0; i < SRV_BATCH_BUCKET_COUNT; i += 1)
+  {
+    u64 min_replies    = 1ull << i;
+    u64 max_replies    = (min_replies << 1) - 1;
+    u64 count          = ins_atomic_u64_eval(&srv_batch_buckets[i]);
+    batch_write_count += count;
+    if(i == SRV_BATCH_BUCKET_COUNT - 1) { str8_list_pushf(arena, &list, "9pfs_response_batches{replies=\"%llu+\"} %llu\n", min_replies, count); }
+    else if(min_replies == max_replies) { str8_list_pushf(arena, &list, "9pfs_response_batches{replies=\"%llu\"} %llu\n", min_replies, count); }
+    else                                { str8_list_pushf(arena, &list, "9pfs_response_batches{replies=\"%llu-%llu\"} %llu\n", min_replies, max_replies, count); }
+  }
+  str8_list_pushf(arena, &list, "9pfs_response_writes %llu\n", batch_write_count);
+  str8_list_pushf(arena, &list, "9pfs_response_replies %llu\n", ins_atomic_u64_eval(&srv_batch_reply_count));
+
+  //- metadata cache
+  MetaCache9P *meta_cache = fs_context->meta_cache;
+  if(meta_cache != 0)
+  {
+    str8_list_pushf(arena, &list, "9pfs_meta_cache_hits %llu\n", ins_atomic_u64_eval(&meta_cache->hit_count));
+    str8_list_pushf(arena, &list, "9pfs_meta_cache_misses %llu\n", ins_atomic_u64_eval(&meta_cache->miss_count));
+    MutexScopeR(meta_cache->rw_mutex)
+    {
+      str8_list_pushf(arena, &list, "9pfs_meta_cache_entries %llu\n", meta_cache->entry_count);
+      str8_list_pushf(arena, &list, "9pfs_meta_cache_bytes %llu\n", arena_pos(meta_cache->arena));
+      str8_list_pushf(arena, &list, "9pfs_meta_cache_invalidations %llu\n", meta_cache->invalidation_count);
+      str8_list_pushf(arena, &list, "9pfs_meta_cache_clears %llu\n", meta_cache->clear_count);
+    }
+  }
+
+  //- descriptor cache
+  FdCache9P *fd_cache = fs_context->fd_cache;
+  if(fd_cache != 0)
+  {
+    MutexScope(fd_cache->mutex)
+    {
+      str8_list_pushf(arena, &list, "9pfs_fd_cache_hits %llu\n", fd_cache->hit_count);
+      str8_list_pushf(arena, &list, "9pfs_fd_cache_misses %llu\n", fd_cache->miss_count);
+      str8_list_pushf(arena, &list, "9pfs_fd_cache_evictions %llu\n", fd_cache->eviction_count);
+      str8_list_pushf(arena, &list, "9pfs_fd_cache_entries %llu\n", fd_cache->entry_count);
+    }
+  }
+
+  //- content cache
+  ContentCache9P *content_cache = fs_context->content_cache;
+  if(content_cache != 0)
+  {
+    u64 entry_count = 0;
+    u64 byte_count  = 0;
+    for(u64 i = 0; i < CONTENT_CACHE_SHARD_COUNT; i += 1)
+    {
+      ContentCacheShard9P *shard = &content_cache->shards[i];
+      MutexScope(shard->mutex)
+      {
+        entry_count += shard->entry_count;
+        byte_count  += shard->bytes;
+      }
+    }
+    str8_list_pushf(arena, &list, "9pfs_content_cache_hits %llu\n", ins_atomic_u64_eval(&content_cache->hit_count));
+    str8_list_pushf(arena, &list, "9pfs_content_cache_misses %llu\n", ins_atomic_u64_eval(&content_cache->miss_count));
+    str8_list_pushf(arena, &list, "9pfs_content_cache_admissions %llu\n", ins_atomic_u64_eval(&content_cache->admit_count));
+    str8_list_pushf(arena, &list, "9pfs_content_cache_rejections %llu\n", ins_atomic_u64_eval(&content_cache->reject_count));
+    str8_list_pushf(arena, &list, "9pfs_content_cache_evictions %llu\n", ins_atomic_u64_eval(&content_cache->eviction_count));
+    str8_list_pushf(arena, &list, "9pfs_content_cache_reads %llu\n", ins_atomic_u64_eval(&content_cache->read_count));
+    str8_list_pushf(arena, &list, "9pfs_content_cache_entries %llu\n", entry_count);
+    str8_list_pushf(arena, &list, "9pfs_content_cache_bytes %llu\n", byte_count);
+  }
+
+  //- read-ahead
+  str8_list_pushf(arena, &list, "9pfs_readahead_hits %llu\n", ins_atomic_u64_eval(&fs_context->read_ahead_hit_count));
+  str8_list_pushf(arena, &list, "9pfs_readahead_misses %llu\n", ins_atomic_u64_eval(&fs_context->read_ahead_miss_count));
+  str8_list_pushf(arena, &list, "9pfs_readahead_bytes %llu\n", ins_atomic_u64_eval(&fs_context->read_ahead_bytes));
+
+  //- message buffer pool
+  if(buffer_pool != 0)
+  {
+    u64 idle_count       = 0;
+    u64 idle_bytes       = 0;
+    u64 arena_idle_count = 0;
+    MutexScope(buffer_pool->mutex)
+    {
+      idle_count       = buffer_pool->idle_count;
+      idle_bytes       = buffer_pool->idle_bytes;
+      arena_idle_count = buffer_pool->free_arena_count;
+    }
+    str8_list_pushf(arena, &list, "9pfs_buffer_pool_in_use %llu\n", ins_atomic_u64_eval(&buffer_pool->in_use_count));
+    str8_list_pushf(arena, &list, "9pfs_buffer_pool_in_use_bytes %llu\n", ins_atomic_u64_eval(&buffer_pool->in_use_bytes));
+    str8_list_pushf(arena, &list, "9pfs_buffer_pool_idle %llu\n", idle_count);
+    str8_list_pushf(arena, &list, "9pfs_buffer_pool_idle_bytes %llu\n", idle_bytes);
+    str8_list_pushf(arena, &list, "9pfs_buffer_pool_arenas_in_use %llu\n", ins_atomic_u64_eval(&buffer_pool->arena_in_use_count));
+    str8_list_pushf(arena, &list, "9pfs_buffer_pool_arenas_idle %llu\n", arena_idle_count);
+  }
+
+  //- per-connection counters
+  MutexScope(connection_mutex)
+  {
+    for(Srv_Connection *c = connection_first; c != 0; c = c->next)
+    {
+      str8_list_pushf(arena, &list, "9pfs_connection_age_seconds{id=\"%llu\"} %llu\n", c->id, now - c->open_time);
+      str8_list_pushf(arena, &list, "9pfs_connection_requests{id=\"%llu\"} %llu\n", c->id, ins_atomic_u64_eval(&c->request_count));
+      str8_list_pushf(arena, &list, "9pfs_connection_errors{id=\"%llu\"} %llu\n", c->id, ins_atomic_u64_eval(&c->error_count));
+      str8_list_pushf(arena, &list, "9pfs_connection_in_flight{id=\"%llu\"} %llu\n", c->id, ins_atomic_u64_eval(&c->in_flight));
+      str8_list_pushf(arena, &list, "9pfs_connection_read_bytes{id=\"%llu\"} %llu\n", c->id, ins_atomic_u64_eval(&c->read_bytes));
+      str8_list_pushf(arena, &list, "9pfs_connection_write_bytes{id=\"%llu\"} %llu\n", c->id, ins_atomic_u64_eval(&c->write_bytes));
+      str8_list_pushf(arena, &list, "9pfs_connection_recv_calls{id=\"%llu\"} %llu\n", c->id, ins_atomic_u64_eval(&c->server->input_reader.recv_count));
+      str8_list_pushf(arena, &list, "9pfs_connection_response_writes{id=\"%llu\"} %llu\n", c->id, ins_atomic_u64_eval(&c->response_write_count));
+      str8_list_pushf(arena, &list, "9pfs_connection_output_queued_bytes{id=\"%llu\"} %llu\n", c->id, server9p_output_queued(c->server));
+
+      // Only fids that have streamed are listed; the window is read racily
+      MutexScope(c->server->mutex)
+      {
+        str8_list_pushf(arena, &list, "9pfs_connection_memory_bytes{id=\"%llu\"} %llu\n", c->id, arena_pos(c->server->arena));
+        str8_list_pushf(arena, &list, "9pfs_connection_fid_storage_bytes{id=\"%llu\"} %llu\n", c->id, c->server->fid_storage_bytes);
+        str8_list_pushf(arena, &list, "9pfs_connection_memory_rejections{id=\"%llu\"} %llu\n", c->id, c->server->memory_rejection_count);
+        for(u32 i = 0; i < c->server->fid_hash_capacity; i += 1)
+        {
+          ServerFid9P *fid = c->server->fid_hash_table[i];
+          if(fid == 0 || fid == FID_HASH_TOMBSTONE || fid->auxiliary == 0) { continue; }
+          ReadAhead9P *read_ahead = &((FidAuxiliary9P *)fid->auxiliary)->read_ahead;
+          u64 hit_count           = ins_atomic_u64_eval(&read_ahead->hit_count);
+          u64 miss_count          = ins_atomic_u64_eval(&read_ahead->miss_count);
+          if(hit_count + miss_count == 0) { continue; }
+          str8_list_pushf(arena, &list, "9pfs_fid_readahead_hits{id=\"%llu\",fid=\"%u\"} %llu\n", c->id, fid->fid, hit_count);
+          str8_list_pushf(arena, &list, "9pfs_fid_readahead_misses{id=\"%llu\",fid=\"%u\"} %llu\n", c->id, fid->fid, miss_count);
+          str8_list_pushf(arena, &list, "9pfs_fid_readahead_window_bytes{id=\"%llu\",fid=\"%u\"} %llu\n", c->id, fid->fid, read_ahead->window);
+        }
+      }
+    }
+  }
+
+  return str8_list_join(arena, list, 0);
+}
+
+internal void
+srv_stats_connection_register(Srv_Connection *connection)
+{
+  connection->id        = ins_atomic_u64_inc_eval(&connection_next_id);
+  connection->open_time = os_now_unix();
+  ins_atomic_u64_inc_eval(&connection_total);
+  MutexScope(connection_mutex) { SLLStackPush(connection_first, connection); }
+}
+
+internal void
+srv_stats_connection_unregister(Srv_Connection *connection)
+{
+  MutexScope(connection_mutex)
+  {
+    Srv_Connection **c = &connection_first;
+    for(; *c != 0 && *c != connection; c = &(*c)->next) {}
+    if(*c != 0) { *c = connection->next; }
+  }
 }
 
 ////////////////////////////////
@@ -76,9 +604,11 @@ fid_release_all(Server9P *server)
 internal void
 srv_version(ServerRequest9P *request)
 {
-  request->out_msg.max_message_size = request->in_msg.max_message_size;
+  u32 max_message_size = server9p_negotiate_message_size(request->server, request->in_msg.max_message_size);
+  if(max_message_size == 0) { server9p_respond(request, str8_lit("msize too small")); return; }
+
+  request->out_msg.max_message_size = max_message_size;
   request->out_msg.protocol_version = request->in_msg.protocol_version;
-  request->server->max_message_size = request->in_msg.max_message_size;
   server9p_respond(request, str8_zero());
 }
 
@@ -87,30 +617,33 @@ srv_auth(ServerRequest9P *request)
 {
   if(!require_auth) { server9p_respond(request, str8_lit("authentication not required")); return; }
 
-  OS_Handle auth_handle = dial9p_connect(request->server->arena, auth_daemon_addr, str8_lit("unix"), str8_lit("9auth"));
+  FidAuxiliary9P *aux = fid_aux_get(request->server, request->fid);
+  if(aux->auth_arena == 0) { aux->auth_arena = arena_alloc(); }
+  Arena *auth_arena = aux->auth_arena;
+
+  OS_Handle auth_handle = dial9p_connect(auth_arena, auth_daemon_addr, str8_lit("unix"), str8_lit("9auth"));
   if(os_handle_match(auth_handle, os_handle_zero())) { server9p_respond(request, str8_lit("9auth unavailable")); return; }
 
   u64 auth_fd           = auth_handle.u64[0];
-  Client9P *auth_client = client9p_init(request->server->arena, auth_fd);
+  Client9P *auth_client = client9p_init(auth_arena, auth_fd);
   if(auth_client == 0) { os_file_close(auth_handle); server9p_respond(request, str8_lit("9auth connection failed")); return; }
 
-  ClientFid9P *auth_root = client9p_attach(request->server->arena, auth_client, P9_FID_NONE, request->in_msg.user_name, str8_lit("/"));
+  ClientFid9P *auth_root = client9p_attach(auth_arena, auth_client, P9_FID_NONE, request->in_msg.user_name, str8_lit("/"));
   if(auth_root == 0) { server9p_respond(request, str8_lit("9auth attach failed")); return; }
 
   auth_client->root = auth_root;
 
   String8 rpc_path     = str8_lit("rpc");
-  ClientFid9P *rpc_fid = client9p_open(request->server->arena, auth_client, rpc_path, OS_AccessFlag_Read | OS_AccessFlag_Write);
+  ClientFid9P *rpc_fid = client9p_open(auth_arena, auth_client, rpc_path, OS_AccessFlag_Read | OS_AccessFlag_Write);
   if(rpc_fid == 0) { server9p_respond(request, str8_lit("9auth rpc file not found")); return; }
 
   String8 start_cmd = str8f(request->scratch.arena, "start role=server user=%S auth-id=%S", request->in_msg.user_name, auth_id);
-  s64 write_result  = client9p_fid_pwrite(request->server->arena, rpc_fid, (void *)start_cmd.str, start_cmd.size, 0);
+  s64 write_result  = client9p_fid_pwrite(auth_arena, rpc_fid, (void *)start_cmd.str, start_cmd.size, 0);
   if(write_result != (s64)start_cmd.size) { server9p_respond(request, str8_lit("9auth start failed")); return; }
 
-  FidAuxiliary9P *aux = fid_aux_get(request->server, request->fid);
   aux->is_auth_fid    = 1;
   aux->auth_verified  = 0;
-  aux->auth_user      = str8_copy(request->server->arena, request->in_msg.user_name);
+  aux->auth_user      = str8_copy(auth_arena, request->in_msg.user_name);
   aux->auth_client    = auth_client;
   aux->auth_rpc_fid   = rpc_fid;
 
@@ -128,7 +661,7 @@ srv_attach(ServerRequest9P *request)
   {
     if(request->in_msg.auth_fid == P9_FID_NONE) { server9p_respond(request, str8_lit("authentication required")); return; }
 
-    ServerFid9P *auth_fid = server9p_fid_lookup(request->server, request->in_msg.auth_fid);
+    ServerFid9P *auth_fid = request->auth_fid;
     if(auth_fid == 0) { server9p_respond(request, str8_lit("invalid auth fid")); return; }
 
     FidAuxiliary9P *auth_aux = fid_aux_get(request->server, auth_fid);
@@ -158,14 +691,29 @@ srv_walk(ServerRequest9P *request)
   if(request->in_msg.walk_name_count == 0)
   {
     FidAuxiliary9P *new_aux = fid_aux_get(request->server, request->new_fid);
-    fid_aux_set_path(new_aux, fid_aux_get_path(from_aux));
+    if(!fid_aux_set_path(request->new_fid, new_aux, fid_aux_get_path(request->server, from_aux, request->scratch.arena)))
+    {
+      if(request->new_fid != request->fid) { server9p_fid_remove(request->server, request->in_msg.new_fid); }
+      server9p_respond(request, str8_lit("out of memory"));
+      return;
+    }
+    if(request->new_fid != request->fid) { fid_aux_set_path_fd(request->server, new_aux, fid_aux_dup_path_fd(request->server, from_aux)); }
     request->new_fid->qid = request->fid->qid;
     request->out_msg.walk_qid_count = 0;
     server9p_respond(request, str8_zero());
     return;
   }
 
-  String8 current_path = fid_aux_get_path(from_aux);
+  String8 current_path = fid_aux_get_path(request->server, from_aux, request->scratch.arena);
+
+  // Disk walks hold an O_PATH fd per element so the kernel enforces the root;
+  // intermediate elements only need their qid
+  b32 use_fds    = fs_context->root_fd >= 0;
+  int current_fd = use_fds ? fid_aux_dup_path_fd(request->server, from_aux) : -1;
+  b32 owns_fd    = current_fd >= 0;
+  String8 error  = str8_zero();
+  u64 walk_count = 0;
+  if(use_fds && current_fd < 0 && current_path.size == 0) { current_fd = fs_context->root_fd; }
 
   for(u64 i = 0; i < request->in_msg.walk_name_count; i += 1)
   {
@@ -174,56 +722,59 @@ srv_walk(ServerRequest9P *request)
     if(str8_match(name, str8_lit("."), 0))
     {
       request->out_msg.walk_qids[i] = (i == 0) ? request->fid->qid : request->out_msg.walk_qids[i - 1];
+      walk_count = i + 1;
       continue;
     }
 
-    PathResolution9P res = fs9p_resolve_path(request->scratch.arena, fs_context, current_path, name);
-
-    if(!res.valid)
+    if(use_fds)
     {
-      if(i == 0)
-      {
-        if(request->new_fid != request->fid)
-        {
-          server9p_fid_remove(request->server, request->in_msg.new_fid);
-        }
-        server9p_respond(request, res.error);
-        return;
-      }
-      else
-      {
-        request->out_msg.walk_qid_count = i;
-        server9p_respond(request, str8_zero());
-        return;
-      }
+      PathResolution9P res = fs9p_walk(request->scratch.arena, fs_context, current_fd, current_path, name);
+      if(!res.valid) { error = res.error; break; }
+
+      if(owns_fd) { close(current_fd); }
+      current_fd                    = res.fd;
+      owns_fd                       = 1;
+      request->out_msg.walk_qids[i] = res.qid;
+      current_path                  = res.absolute_path;
     }
-
-    Dir9P stat = fs9p_stat(request->scratch.arena, fs_context, res.absolute_path);
-    if(stat.name.size == 0)
+    else
     {
-      if(i == 0)
-      {
-        if(request->new_fid != request->fid)
-        {
-          server9p_fid_remove(request->server, request->in_msg.new_fid);
-        }
-        server9p_respond(request, str8_lit("file not found"));
-        return;
-      }
-      else
-      {
-        request->out_msg.walk_qid_count = i;
-        server9p_respond(request, str8_zero());
-        return;
-      }
+      PathResolution9P res = fs9p_resolve_path(request->scratch.arena, fs_context, current_path, name);
+      if(!res.valid) { error = res.error; break; }
+
+      Dir9P stat = fs9p_stat(request->scratch.arena, fs_context, res.absolute_path);
+      if(stat.name.size == 0) { error = str8_lit("file not found"); break; }
+
+      request->out_msg.walk_qids[i] = stat.qid;
+      current_path                  = res.absolute_path;
     }
+    walk_count = i + 1;
+  }
 
-    request->out_msg.walk_qids[i] = stat.qid;
-    current_path = res.absolute_path;
+  //- a walk that fails on its first element is an error; later failures return the partial qids
+  if(walk_count < request->in_msg.walk_name_count)
+  {
+    if(owns_fd) { close(current_fd); }
+    if(walk_count == 0)
+    {
+      if(request->new_fid != request->fid) { server9p_fid_remove(request->server, request->in_msg.new_fid); }
+      server9p_respond(request, error);
+      return;
+    }
+    request->out_msg.walk_qid_count = walk_count;
+    server9p_respond(request, str8_zero());
+    return;
   }
 
   FidAuxiliary9P *new_aux = fid_aux_get(request->server, request->new_fid);
-  fid_aux_set_path(new_aux, current_path);
+  if(!fid_aux_set_path(request->new_fid, new_aux, current_path))
+  {
+    if(owns_fd) { close(current_fd); }
+    if(request->new_fid != request->fid) { server9p_fid_remove(request->server, request->in_msg.new_fid); }
+    server9p_respond(request, str8_lit("out of memory"));
+    return;
+  }
+  if(owns_fd) { fid_aux_set_path_fd(request->server, new_aux, current_fd); }
   request->new_fid->qid = request->out_msg.walk_qids[request->in_msg.walk_name_count - 1];
   request->out_msg.walk_qid_count = request->in_msg.walk_name_count;
   server9p_respond(request, str8_zero());
@@ -237,7 +788,7 @@ srv_open(ServerRequest9P *request)
   u32 access_mode = request->in_msg.open_mode & 3;
   if(fs_context->readonly && access_mode != P9_OpenFlag_Read) { server9p_respond(request, str8_lit("read-only filesystem")); return; }
 
-  FsHandle9P *handle = fs9p_open(request->server->arena, fs_context, fid_aux_get_path(aux), request->in_msg.open_mode);
+  FsHandle9P *handle = fid_aux_open(request->fid, fid_aux_get_path(request->server, aux, request->scratch.arena), request->in_msg.open_mode);
   if(handle == 0 || (handle->fd < 0 && !handle->is_directory && handle->tmp_node == 0))
   {
     server9p_respond(request, str8_lit("cannot open file"));
@@ -247,7 +798,7 @@ srv_open(ServerRequest9P *request)
   aux->handle    = handle;
   aux->open_mode = request->in_msg.open_mode;
 
-  if(handle->is_directory) { aux->has_dir_iter = fs9p_opendir(fs_context, fid_aux_get_path(aux), &aux->dir_iter); }
+  if(handle->is_directory) { fid_aux_opendir(request->fid, aux); }
 
   request->out_msg.qid          = request->fid->qid;
   request->out_msg.io_unit_size = request->server->max_message_size - P9_MESSAGE_HEADER_SIZE;
@@ -260,7 +811,7 @@ srv_create(ServerRequest9P *request)
   FidAuxiliary9P *aux = fid_aux_get(request->server, request->fid);
   if(fs_context->readonly) { server9p_respond(request, str8_lit("read-only filesystem")); return; }
 
-  String8 new_path = fs9p_path_join(request->scratch.arena, fid_aux_get_path(aux), request->in_msg.name);
+  String8 new_path = fs9p_path_join(request->scratch.arena, fid_aux_get_path(request->server, aux, request->scratch.arena), request->in_msg.name);
   if(!fs9p_path_is_safe(request->in_msg.name)) { server9p_respond(request, str8_lit("unsafe filename")); return; }
   if(!fs9p_create(fs_context, new_path, request->in_msg.permissions, request->in_msg.open_mode))
   {
@@ -271,15 +822,19 @@ srv_create(ServerRequest9P *request)
   Dir9P stat = fs9p_stat(request->scratch.arena, fs_context, new_path);
   if(stat.name.size == 0) { server9p_respond(request, str8_lit("failed to create")); return; }
 
-  fid_aux_set_path(aux, new_path);
+  if(!fid_aux_set_path(request->fid, aux, new_path)) { server9p_respond(request, str8_lit("out of memory")); return; }
   request->fid->qid = stat.qid;
 
-  FsHandle9P *handle = fs9p_open(request->server->arena, fs_context, new_path, request->in_msg.open_mode);
+  // The fid now names the new file, so its walk fd must stop naming the parent
+  int path_fd = fs_context->root_fd >= 0 ? fs9p_openat_beneath(fs_context->root_fd, new_path, O_PATH) : -1;
+  fid_aux_set_path_fd(request->server, aux, path_fd);
+
+  FsHandle9P *handle = fid_aux_open(request->fid, new_path, request->in_msg.open_mode);
   if(handle)
   {
     aux->handle    = handle;
     aux->open_mode = request->in_msg.open_mode;
-    if(handle->is_directory) { aux->has_dir_iter = fs9p_opendir(fs_context, new_path, &aux->dir_iter); }
+    if(handle->is_directory) { fid_aux_opendir(request->fid, aux); }
   }
 
   request->out_msg.qid          = stat.qid;
@@ -292,6 +847,9 @@ srv_read(ServerRequest9P *request)
 {
   FidAuxiliary9P *aux = fid_aux_get(request->server, request->fid);
 
+  // Replies never exceed the negotiated msize, whatever count was asked for
+  request->in_msg.byte_count = Min(request->in_msg.byte_count, request->server->max_message_size - P9_MESSAGE_HEADER_SIZE);
+
   if(aux->is_auth_fid)
   {
     if(aux->auth_rpc_fid == 0)
@@ -312,7 +870,7 @@ srv_read(ServerRequest9P *request)
     }
 
     u8 *buffer = push_array(request->scratch.arena, u8, request->in_msg.byte_count);
-    s64 n      = client9p_fid_pread(request->server->arena, aux->auth_rpc_fid, buffer, request->in_msg.byte_count, request->in_msg.file_offset);
+    s64 n      = client9p_fid_pread(aux->auth_arena, aux->auth_rpc_fid, buffer, request->in_msg.byte_count, request->in_msg.file_offset);
     if(n < 0)
     {
       server9p_respond(request, str8_lit("auth read failed"));
@@ -327,16 +885,24 @@ srv_read(ServerRequest9P *request)
 
   if(request->fid->qid.type & QidTypeFlag_Directory)
   {
-    if(!aux->has_dir_iter) { aux->has_dir_iter = fs9p_opendir(fs_context, fid_aux_get_path(aux), &aux->dir_iter); }
-    if(!aux->has_dir_iter)
+    // Pipelined reads of one directory fid share its iterator
+    String8 dir_data = str8_zero();
+    b32 has_dir_iter = 0;
+    MutexScope(fid_aux_mutex(request->server, aux))
+    {
+      has_dir_iter = aux->has_dir_iter || fid_aux_opendir(request->fid, aux);
+      if(has_dir_iter)
+      {
+        dir_data = fs9p_readdir(request->scratch.arena, fs_context, aux->dir_iter, request->in_msg.file_offset,
+                                request->in_msg.byte_count);
+      }
+    }
+    if(!has_dir_iter)
     {
       server9p_respond(request, str8_lit("cannot read directory"));
       return;
     }
 
-    String8 dir_data = fs9p_readdir(request->scratch.arena, request->server->arena, fs_context, &aux->dir_iter,
-                                    &aux->cached_dir_entries, request->in_msg.file_offset, request->in_msg.byte_count);
-
     request->out_msg.payload_data = dir_data;
     request->out_msg.byte_count   = dir_data.size;
     server9p_respond(request, str8_zero());
@@ -349,6 +915,31 @@ srv_read(ServerRequest9P *request)
     return;
   }
 
+  if(!fid_aux_flush(request->server, aux, 0)) { server9p_respond(request, str8_lit("write failed")); return; }
+
+  // Sequential streams get the next window of the file queued in the page
+  // cache ahead of the reads that will want it
+  if(aux->handle->fd >= 0 && aux->handle->content_entry == 0 && fs_context->read_ahead_max > 0)
+  {
+    Rng1U64 advise = {0};
+    b32 first      = 0;
+    MutexScope(fid_aux_mutex(request->server, aux))
+    {
+      first  = (aux->read_ahead.advised_end == 0);
+      advise = fs9p_read_ahead_plan(fs_context, &aux->read_ahead, request->in_msg.file_offset, request->in_msg.byte_count);
+    }
+    fs9p_read_ahead_issue(aux->handle, advise, first);
+  }
+
+  // Disk files skip the user-space copy; ArenaTemp nodes and special files
+  // still go through the buffered read below
+  Rng1U64 range = {0};
+  if(fs9p_read_range(aux->handle, request->in_msg.file_offset, request->in_msg.byte_count, &range))
+  {
+    server9p_respond_read_file(request, aux->handle->fd, range);
+    return;
+  }
+
   String8 data = fs9p_read(request->scratch.arena, aux->handle, request->in_msg.file_offset, request->in_msg.byte_count);
 
   request->out_msg.payload_data = data;
@@ -361,15 +952,24 @@ srv_write(ServerRequest9P *request)
 {
   FidAuxiliary9P *aux = fid_aux_get(request->server, request->fid);
 
+  // Large payloads wait in a pipe filled by the I/O thread; they move into
+  // the file from here, or back into the request when there is no file to take them
+  s64 splice_fd = -1;
+  if(request->spliced)
+  {
+    splice_fd = fid_aux_splice_fd(request->fid);
+    if(splice_fd < 0 && !server9p_request_read_payload(request)) { server9p_respond(request, str8_lit("write failed")); return; }
+  }
+
   if(aux->is_auth_fid)
   {
     if(aux->auth_rpc_fid == 0) { server9p_respond(request, str8_lit("auth fid not initialized")); return; }
 
-    s64 n = client9p_fid_pwrite(request->server->arena, aux->auth_rpc_fid, (void *)request->in_msg.payload_data.str,
+    s64 n = client9p_fid_pwrite(aux->auth_arena, aux->auth_rpc_fid, (void *)request->in_msg.payload_data.str,
                                 request->in_msg.payload_data.size, request->in_msg.file_offset);
     if(n != (s64)request->in_msg.payload_data.size) { server9p_respond(request, str8_lit("auth write failed")); return; }
 
-    s64 response_len = client9p_fid_pread(request->server->arena, aux->auth_rpc_fid, aux->auth_response_buffer, sizeof(aux->auth_response_buffer), 0);
+    s64 response_len = client9p_fid_pread(aux->auth_arena, aux->auth_rpc_fid, aux->auth_response_buffer, sizeof(aux->auth_response_buffer), 0);
     if(response_len > 0)
     {
       aux->auth_response_len   = response_len;
@@ -386,7 +986,34 @@ srv_write(ServerRequest9P *request)
   if(fs_context->readonly)                                                    { server9p_respond(request, str8_lit("read-only filesystem")); return; }
   if(aux->handle == 0 || (aux->handle->fd < 0 && aux->handle->tmp_node == 0)) { server9p_respond(request, str8_lit("file not open")); return; }
 
-  u64 bytes_written = fs9p_write(aux->handle, request->in_msg.file_offset, request->in_msg.payload_data);
+  if(splice_fd >= 0)
+  {
+    u64 spliced_count = server9p_request_splice_payload(request, (int)splice_fd);
+    fs9p_meta_cache_invalidate(fs_context->meta_cache, aux->handle->path);
+    fs9p_content_cache_invalidate(fs_context->content_cache, aux->handle->dev, aux->handle->ino);
+    if(spliced_count == 0 && request->in_msg.byte_count > 0)                      { server9p_respond(request, str8_lit("write failed")); return; }
+    if(fs_context->sync_policy == SyncPolicy9P_Always && !fs9p_sync(aux->handle)) { server9p_respond(request, str8_lit("write failed")); return; }
+    if(fs_context->sync_policy == SyncPolicy9P_Clunk)                             { aux->write_buffer.dirty = 1; }
+    request->out_msg.byte_count = spliced_count;
+    server9p_respond(request, str8_zero());
+    return;
+  }
+
+  // With --coalesce-writes, small writes to regular files are held per fid
+  // until a gap, a full buffer, Tread, Tstat, Twstat or Tclunk writes them
+  // back; without room under the connection's memory limit the write goes
+  // straight through
+  u64 bytes_written = 0;
+  MutexScope(fid_aux_mutex(request->server, aux))
+  {
+    if(fs_context->coalesce_writes && aux->write_buffer.capacity == 0 && aux->handle->is_regular && fs_context->sync_policy != SyncPolicy9P_Always)
+    {
+      aux->write_buffer.data     = (u8 *)server9p_fid_push(request->fid, WRITE_COALESCE_SIZE);
+      aux->write_buffer.capacity = aux->write_buffer.data != 0 ? WRITE_COALESCE_SIZE : 0;
+    }
+    bytes_written = fs9p_write_buffered(aux->handle, &aux->write_buffer, request->in_msg.file_offset, request->in_msg.payload_data);
+  }
+  if(bytes_written == 0 && request->in_msg.payload_data.size > 0) { server9p_respond(request, str8_lit("write failed")); return; }
 
   request->out_msg.byte_count = bytes_written;
   server9p_respond(request, str8_zero());
@@ -395,10 +1022,11 @@ srv_write(ServerRequest9P *request)
 internal void
 srv_clunk(ServerRequest9P *request)
 {
+  // The fid is gone either way; a failed write-back or sync is still reported
   FidAuxiliary9P *aux = fid_aux_get(request->server, request->fid);
-  fid_aux_release(request->server, aux);
+  b32 flushed         = fid_aux_flush(request->server, aux, fs_context->sync_policy != SyncPolicy9P_None);
   server9p_fid_remove(request->server, request->in_msg.fid);
-  server9p_respond(request, str8_zero());
+  server9p_respond(request, flushed ? str8_zero() : str8_lit("write failed"));
 }
 
 internal void
@@ -407,8 +1035,7 @@ srv_remove(ServerRequest9P *request)
   FidAuxiliary9P *aux = fid_aux_get(request->server, request->fid);
   if(fs_context->readonly) { server9p_respond(request, str8_lit("read-only filesystem")); return; }
 
-  fs9p_remove(fs_context, fid_aux_get_path(aux));
-  fid_aux_release(request->server, aux);
+  fs9p_remove(fs_context, fid_aux_get_path(request->server, aux, request->scratch.arena));
   server9p_fid_remove(request->server, request->in_msg.fid);
   server9p_respond(request, str8_zero());
 }
@@ -417,7 +1044,9 @@ internal void
 srv_stat(ServerRequest9P *request)
 {
   FidAuxiliary9P *aux = fid_aux_get(request->server, request->fid);
-  Dir9P stat          = fs9p_stat(request->scratch.arena, fs_context, fid_aux_get_path(aux));
+  if(!fid_aux_flush(request->server, aux, 0)) { server9p_respond(request, str8_lit("write failed")); return; }
+
+  Dir9P stat = fs9p_stat(request->scratch.arena, fs_context, fid_aux_get_path(request->server, aux, request->scratch.arena));
   if(stat.name.size == 0) { server9p_respond(request, str8_lit("cannot stat file")); return; }
 
   request->out_msg.stat_data = str8_from_dir9p(request->scratch.arena, stat);
@@ -432,17 +1061,20 @@ srv_wstat(ServerRequest9P *request)
   FidAuxiliary9P *aux = fid_aux_get(request->server, request->fid);
   if(request->in_msg.stat_data.size == 0) { server9p_respond(request, str8_lit("invalid stat data")); return; }
 
-  Dir9P stat = dir9p_from_str8(request->scratch.arena, request->in_msg.stat_data);
-  if(!fs9p_wstat(fs_context, fid_aux_get_path(aux), &stat)) { server9p_respond(request, str8_lit("wstat failed")); return; }
+  if(!fid_aux_flush(request->server, aux, 0)) { server9p_respond(request, str8_lit("write failed")); return; }
+
+  Dir9P stat   = dir9p_view_from_str8(request->in_msg.stat_data);
+  String8 path = fid_aux_get_path(request->server, aux, request->scratch.arena);
+  if(!fs9p_wstat(fs_context, path, &stat)) { server9p_respond(request, str8_lit("wstat failed")); return; }
 
   if(stat.name.size > 0)
   {
-    String8 current_basename = fs9p_basename(request->scratch.arena, fid_aux_get_path(aux));
+    String8 current_basename = fs9p_basename(request->scratch.arena, path);
     if(!str8_match(stat.name, current_basename, 0))
     {
-      String8 parent_path = fs9p_dirname(request->scratch.arena, fid_aux_get_path(aux));
+      String8 parent_path = fs9p_dirname(request->scratch.arena, path);
       String8 new_path    = fs9p_path_join(request->scratch.arena, parent_path, stat.name);
-      fid_aux_set_path(aux, new_path);
+      if(!fid_aux_set_path(request->fid, aux, new_path)) { server9p_respond(request, str8_lit("out of memory")); return; }
     }
   }
 
@@ -453,64 +1085,268 @@ srv_wstat(ServerRequest9P *request)
 //~ Server Loop
 
 internal void
-handle_connection(OS_Handle connection_socket)
+srv_dispatch(ServerRequest9P *request)
 {
-  Temp scratch            = scratch_begin(0, 0);
-  Arena *connection_arena = arena_alloc();
-  Log *log                = log_alloc();
-  log_select(log);
-  log_scope_begin();
-
-  u64 connection_fd = connection_socket.u64[0];
-  log_info(str8_lit("9pfs: connection established\n"));
-
-  Server9P *server = server9p_alloc(connection_arena, connection_fd, connection_fd);
-  if(server == 0)
+  // Requests cancelled by Tflush before a worker picked them up never touch the filesystem
+  u32 type = request->in_msg.type;
+  if(server9p_request_is_flushed(request) && type != Msg9P_Tclunk && type != Msg9P_Tremove)
   {
-    log_error(str8_lit("9pfs: failed to allocate server\n"));
-    os_file_close(connection_socket);
-    arena_release(connection_arena);
+    // Fids set up for the cancelled request were never handed to the client
+    switch(type)
+    {
+    case Msg9P_Tauth:   { server9p_fid_remove(request->server, request->in_msg.auth_fid); }break;
+    case Msg9P_Tattach: { server9p_fid_remove(request->server, request->in_msg.fid); }break;
+    case Msg9P_Twalk:
+    {
+      if(request->new_fid != request->fid) { server9p_fid_remove(request->server, request->in_msg.new_fid); }
+    }break;
+    default: break;
+    }
+    server9p_respond(request, str8_lit("interrupted"));
     return;
   }
 
+  switch(type)
+  {
+  case Msg9P_Tauth:    { srv_auth(request); }break;
+  case Msg9P_Tattach:  { srv_attach(request); }break;
+  case Msg9P_Twalk:    { srv_walk(request); }break;
+  case Msg9P_Topen:    { srv_open(request); }break;
+  case Msg9P_Tcreate:  { srv_create(request); }break;
+  case Msg9P_Tread:    { srv_read(request); }break;
+  case Msg9P_Twrite:   { srv_write(request); }break;
+  case Msg9P_Tclunk:   { srv_clunk(request); }break;
+  case Msg9P_Tremove:  { srv_remove(request); }break;
+  case Msg9P_Tstat:    { srv_stat(request); }break;
+  case Msg9P_Twstat:   { srv_wstat(request); }break;
+  default:             { server9p_respond(request, str8_lit("unsupported operation")); }break;
+  }
+}
+
+internal void
+srv_dispatch_task(void *params)
+{
+  ServerRequest9P *request = *(ServerRequest9P **)params;
+  server9p_output_uncork(request->server);
+  srv_dispatch(request);
+}
+
+internal void
+srv_connection_close_task(void *params)
+{
+  Srv_Connection *connection = *(Srv_Connection **)params;
+  Server9P *server           = connection->server;
+
+  // Requests from this connection were queued ahead of this task, so waiting here cannot starve them
+  server9p_wait_idle(server);
+  // Unregistered first so the stats dump never walks a released fid table
+  srv_stats_connection_unregister(connection);
+  server9p_fid_remove_all(server);
+  server9p_release(server);
+  os_file_close(connection->socket);
+  arena_release(connection->arena);
+
+  fprintf(stdout, "9pfs: connection closed\n");
+  fflush(stdout);
+}
+
+// Sockets are non-blocking so no thread ever waits on a client that stops
+// reading; replies the socket will not take wait in the server's queue until
+// EPOLLOUT, and a connection stops being read while its queue is over the limit
+internal u32
+srv_connection_events(u64 queued_size)
+{
+  u32 result = 0;
+  if(queued_size <= SERVER_OUTPUT_QUEUE_LIMIT) { result |= EPOLLIN | EPOLLRDHUP; }
+  if(queued_size > 0)                          { result |= EPOLLOUT; }
+  return result;
+}
+
+// Runs with the connection's write mutex held, so interest changes apply in queue order
+internal void
+srv_connection_output_queue(Server9P *server)
+{
+  Srv_Connection *connection = (Srv_Connection *)server->auxiliary;
+  struct epoll_event event   = {0};
+  event.events               = srv_connection_events(server->output_queue_size);
+  event.data.ptr             = connection;
+  epoll_ctl(connection->io_thread->epoll_fd, EPOLL_CTL_MOD, (int)connection->socket.u64[0], &event);
+}
+
+internal void
+srv_connection_read(Srv_Connection *connection)
+{
+  // Replies stay corked while this connection has requests waiting for a
+  // worker; the last one to start, or the end of this read, flushes them
+  Server9P *server = connection->server;
+  server9p_output_cork(server);
   for(;;)
   {
-    ServerRequest9P *request = server9p_get_request(server);
+    if(server9p_output_queued(server) > SERVER_OUTPUT_QUEUE_LIMIT) { break; }
+    ServerRequest9P *request = server9p_try_get_request(server);
     if(request == 0)            { break; }
+    srv_stats_request_begin(connection, request);
     if(request->error.size > 0) { server9p_respond(request, request->error); continue; }
 
     switch(request->in_msg.type)
     {
     case Msg9P_Tversion: { srv_version(request); }break;
-    case Msg9P_Tauth:    { srv_auth(request); }break;
-    case Msg9P_Tattach:  { srv_attach(request); }break;
-    case Msg9P_Twalk:    { srv_walk(request); }break;
-    case Msg9P_Topen:    { srv_open(request); }break;
-    case Msg9P_Tcreate:  { srv_create(request); }break;
-    case Msg9P_Tread:    { srv_read(request); }break;
-    case Msg9P_Twrite:   { srv_write(request); }break;
-    case Msg9P_Tclunk:   { srv_clunk(request); }break;
-    case Msg9P_Tremove:  { srv_remove(request); }break;
-    case Msg9P_Tstat:    { srv_stat(request); }break;
-    case Msg9P_Twstat:   { srv_wstat(request); }break;
-    default:             { server9p_respond(request, str8_lit("unsupported operation")); }break;
-    }
-  }
-
-  fid_release_all(server);
-  os_file_close(connection_socket);
-  log_info(str8_lit("9pfs: connection closed\n"));
-  log_scope_flush(scratch.arena);
-  log_release(log);
-  arena_release(connection_arena);
-  scratch_end(scratch);
+    case Msg9P_Tflush:   { server9p_flush(request); }break;
+    default:
+    {
+      server9p_output_cork(server);
+      wp_submit(worker_pool, srv_dispatch_task, &request, sizeof(request));
+    }break;
+    }
+  }
+  server9p_output_uncork(server);
+}
+
+// Connections whose requests are still waiting for a worker stay corked, and
+// with every worker busy no reply arrives to notice that a batch has aged,
+// so the I/O thread that corked them flushes expired batches itself
+internal void
+srv_io_thread_flush_corked(Srv_IOThread *io_thread, Srv_Connection *closing)
+{
+  for(Srv_Connection **ptr = &io_thread->corked_first; *ptr != 0;)
+  {
+    Srv_Connection *connection = *ptr;
+    if(connection != closing) { server9p_output_flush_expired(connection->server); }
+    if(connection == closing || !server9p_output_corked(connection->server))
+    {
+      *ptr                      = connection->corked_next;
+      connection->corked_listed = 0;
+    }
+    else
+    {
+      ptr = &connection->corked_next;
+    }
+  }
 }
 
 internal void
-handle_connection_task(void *params)
+srv_io_thread_entry_point(void *ptr)
 {
-  OS_Handle connection = *(OS_Handle *)params;
-  handle_connection(connection);
+  Srv_IOThread *io_thread = (Srv_IOThread *)ptr;
+  struct epoll_event events[64];
+
+  // I/O threads only buffer and decode requests; handlers run on the worker pool
+  for(;;)
+  {
+    int timeout_ms  = io_thread->corked_first != 0 ? SERVER_OUTPUT_BATCH_DELAY_US / 1000 : -1;
+    int event_count = epoll_wait(io_thread->epoll_fd, events, ArrayCount(events), timeout_ms);
+    if(event_count < 0)
+    {
+      if(errno == EINTR) { continue; }
+      break;
+    }
+
+    for(int i = 0; i < event_count; i += 1)
+    {
+      // Reading follows every drain so messages already buffered resume once the backlog clears
+      Srv_Connection *connection = (Srv_Connection *)events[i].data.ptr;
+      if(events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) { server9p_output_drain(connection->server); }
+      srv_connection_read(connection);
+      if(connection->server->input_closed)
+      {
+        // Its workers uncork it on their own, and the close task frees it
+        if(connection->corked_listed) { srv_io_thread_flush_corked(io_thread, connection); }
+        epoll_ctl(io_thread->epoll_fd, EPOLL_CTL_DEL, (int)connection->socket.u64[0], 0);
+        wp_submit(worker_pool, srv_connection_close_task, &connection, sizeof(connection));
+      }
+      else if(!connection->corked_listed && server9p_output_corked(connection->server))
+      {
+        connection->corked_next   = io_thread->corked_first;
+        io_thread->corked_first   = connection;
+        connection->corked_listed = 1;
+      }
+    }
+    if(io_thread->corked_first != 0) { srv_io_thread_flush_corked(io_thread, 0); }
+  }
+}
+
+internal b32
+srv_connection_open(OS_Handle connection_socket)
+{
+  Arena *arena               = arena_alloc();
+  Srv_Connection *connection = push_array(arena, Srv_Connection, 1);
+  connection->arena          = arena;
+  connection->socket         = connection_socket;
+  connection->server         = server9p_alloc(arena, connection_socket.u64[0], connection_socket.u64[0]);
+  connection->server->fid_destroy            = fid_aux_destroy;
+  connection->server->splice_writes          = !fs_context->readonly && fs_context->backend == StorageBackend9P_Disk;
+  connection->server->max_message_size_limit = msize_limit;
+  connection->server->memory_limit           = conn_memory_limit;
+  connection->server->buffer_pool            = buffer_pool;
+  connection->server->on_respond             = srv_stats_request_end;
+  connection->server->on_output              = srv_stats_output;
+  connection->server->on_output_queue        = srv_connection_output_queue;
+  connection->server->auxiliary              = connection;
+  connection->io_thread                      = &io_threads[(ins_atomic_u64_inc_eval(&io_thread_next) - 1) % io_thread_count];
+  srv_stats_connection_register(connection);
+
+  int flags                = fcntl((int)connection_socket.u64[0], F_GETFL);
+  struct epoll_event event = {0};
+  event.events             = srv_connection_events(0);
+  event.data.ptr           = connection;
+  if(flags < 0 || fcntl((int)connection_socket.u64[0], F_SETFL, flags | O_NONBLOCK) < 0 ||
+     epoll_ctl(connection->io_thread->epoll_fd, EPOLL_CTL_ADD, (int)connection_socket.u64[0], &event) < 0)
+  {
+    srv_stats_connection_unregister(connection);
+    server9p_release(connection->server);
+    os_file_close(connection_socket);
+    arena_release(arena);
+    return 0;
+  }
+  return 1;
+}
+
+internal void
+srv_accept_loop(OS_Handle listen_socket)
+{
+  for(;;)
+  {
+    OS_Handle connection_socket = os_socket_accept(listen_socket);
+    if(os_handle_match(connection_socket, os_handle_zero())) { fprintf(stderr, "9pfs: failed to accept connection\n"); fflush(stderr); continue; }
+
+    if(!srv_connection_open(connection_socket)) { fprintf(stderr, "9pfs: failed to register connection\n"); fflush(stderr); continue; }
+
+    fprintf(stdout, "9pfs: accepted connection\n");
+    fflush(stdout);
+  }
+}
+
+internal void
+srv_accept_thread_entry_point(void *ptr)
+{
+  OS_Handle listen_socket = {{(u64)ptr}};
+  srv_accept_loop(listen_socket);
+}
+
+internal void
+srv_stats_thread_entry_point(void *ptr)
+{
+  OS_Handle listen_socket = {{(u64)ptr}};
+
+  // Each connection receives one snapshot of the counters and is closed
+  for(;;)
+  {
+    OS_Handle stats_socket = os_socket_accept(listen_socket);
+    if(os_handle_match(stats_socket, os_handle_zero())) { continue; }
+
+    Temp scratch = scratch_begin(0, 0);
+    String8 text = srv_stats_text(scratch.arena);
+    int fd       = (int)stats_socket.u64[0];
+    for(u64 written = 0; written < text.size;)
+    {
+      ssize_t write_result = write(fd, text.str + written, text.size - written);
+      if(write_result > 0)                        { written += write_result; }
+      else if(write_result < 0 && errno == EINTR) { continue; }
+      else                                        { break; }
+    }
+    scratch_end(scratch);
+    os_file_close(stats_socket);
+  }
 }
 
 ////////////////////////////////
@@ -525,6 +1361,9 @@ entry_point(CmdLine *cmd_line)
   String8 root_path       = (root_path_arg.size > 0) ? root_path_arg : str8_lit(".");
   String8 address         = (cmd_line->inputs.node_count > 0) ? cmd_line->inputs.first->string : str8_zero();
   b32 readonly            = cmd_line_has_flag(cmd_line, str8_lit("readonly"));
+  b32 memory              = cmd_line_has_flag(cmd_line, str8_lit("memory"));
+  io_ring_enabled         = cmd_line_has_flag(cmd_line, str8_lit("io-uring"));
+  b32 coalesce_writes     = cmd_line_has_flag(cmd_line, str8_lit("coalesce-writes"));
   String8 auth_daemon_arg = cmd_line_string(cmd_line, str8_lit("auth-daemon"));
   auth_daemon_addr        = (auth_daemon_arg.size > 0) ? auth_daemon_arg : str8_lit("unix!/run/9auth/socket");
   String8 auth_id_arg     = cmd_line_string(cmd_line, str8_lit("auth-id"));
@@ -532,57 +1371,151 @@ entry_point(CmdLine *cmd_line)
   require_auth            = auth_id_arg.size > 0;
   String8 threads_str     = cmd_line_string(cmd_line, str8_lit("threads"));
   u64 worker_count        = (threads_str.size > 0) ? u64_from_str8(threads_str, 10) : 0;
-
-  if(address.size == 0)
+  String8 io_threads_str  = cmd_line_string(cmd_line, str8_lit("io-threads"));
+  io_thread_count         = (io_threads_str.size > 0) ? u64_from_str8(io_threads_str, 10) : 0;
+  String8 acceptors_str   = cmd_line_string(cmd_line, str8_lit("acceptors"));
+  u64 acceptor_count      = (acceptors_str.size > 0) ? u64_from_str8(acceptors_str, 10) : 1;
+  String8 msize_str       = cmd_line_string(cmd_line, str8_lit("msize"));
+  u64 msize_arg           = (msize_str.size > 0) ? u64_from_str8(msize_str, 10) : P9_MESSAGE_SIZE_CEILING;
+  msize_limit             = (u32)Clamp(P9_MESSAGE_SIZE_MIN, msize_arg, P9_MESSAGE_SIZE_MAX);
+  String8 conn_memory_str = cmd_line_string(cmd_line, str8_lit("conn-memory"));
+  conn_memory_limit       = MB((conn_memory_str.size > 0) ? u64_from_str8(conn_memory_str, 10) : 256);
+  String8 buffer_pool_str = cmd_line_string(cmd_line, str8_lit("buffer-pool"));
+  u64 buffer_pool_mib     = (buffer_pool_str.size > 0) ? u64_from_str8(buffer_pool_str, 10) : 64;
+  String8 stats_address   = cmd_line_string(cmd_line, str8_lit("stats"));
+  String8 meta_cache_str  = cmd_line_string(cmd_line, str8_lit("meta-cache"));
+  u64 meta_cache_mib      = (meta_cache_str.size > 0) ? u64_from_str8(meta_cache_str, 10) : 64;
+  String8 readdir_par_str = cmd_line_string(cmd_line, str8_lit("readdir-parallel"));
+  u64 readdir_parallel    = (readdir_par_str.size > 0) ? u64_from_str8(readdir_par_str, 10) : 0;
+  String8 readahead_str   = cmd_line_string(cmd_line, str8_lit("readahead"));
+  u64 readahead_mib       = (readahead_str.size > 0) ? u64_from_str8(readahead_str, 10) : READ_AHEAD_WINDOW_DEFAULT / MB(1);
+  String8 fd_cache_str    = cmd_line_string(cmd_line, str8_lit("fd-cache"));
+  u64 fd_cache_capacity   = (fd_cache_str.size > 0) ? u64_from_str8(fd_cache_str, 10) : FD_CACHE_CAPACITY_DEFAULT;
+  String8 content_str     = cmd_line_string(cmd_line, str8_lit("content-cache"));
+  u64 content_cache_mib   = (content_str.size > 0) ? u64_from_str8(content_str, 10) : 32;
+  String8 sync_str        = cmd_line_string(cmd_line, str8_lit("sync"));
+  SyncPolicy9P sync       = SyncPolicy9P_None;
+  b32 sync_valid          = 1;
+  if(sync_str.size == 0 || str8_match(sync_str, str8_lit("none"), 0)) { sync = SyncPolicy9P_None; }
+  else if(str8_match(sync_str, str8_lit("clunk"), 0))                 { sync = SyncPolicy9P_Clunk; }
+  else if(str8_match(sync_str, str8_lit("always"), 0))                { sync = SyncPolicy9P_Always; }
+  else                                                                 { sync_valid = 0; }
+
+  if(address.size == 0 || !sync_valid)
   {
     fprintf(stderr, "usage: 9pfs [options] <address>\n"
                     "options:\n"
                     "  --root=<path>         Root directory to serve (default: current directory)\n"
                     "  --readonly            Serve in read-only mode\n"
+                    "  --memory              Serve an empty in-memory tree instead of --root\n"
                     "  --auth-daemon=<addr>  Auth daemon address (default: unix!/run/9auth/socket)\n"
                     "  --auth-id=<id>        Server identity for auth (enables auth when present)\n"
                     "  --threads=<n>         Number of worker threads (default: max(4, cores/4))\n"
+                    "  --io-threads=<n>      Number of socket I/O threads (default: clamp(1, cores/8, 4))\n"
+                    "  --acceptors=<n>       Number of SO_REUSEPORT accept sockets for tcp (default: 1)\n"
+                    "  --msize=<bytes>       Largest negotiated message size (default: 8 MiB + 24, max: 16 MiB + 24)\n"
+                    "  --conn-memory=<MiB>   Memory ceiling per connection, 0 disables (default: 256)\n"
+                    "  --buffer-pool=<MiB>   Idle message buffers kept for all connections, 0 disables pooling (default: 64)\n"
+                    "  --stats=<addr>        Dial string that serves a text snapshot of counters and latencies\n"
+                    "  --meta-cache=<MiB>    Shared stat cache budget, 0 disables (default: 64)\n"
+                    "  --readdir-parallel=<n> Spread directory stats over workers, one per n entries (default: 0, off)\n"
+                    "  --readahead=<MiB>     Largest read-ahead window per sequential fid, 0 disables (default: 32)\n"
+                    "  --fd-cache=<n>        Idle read-only descriptors kept open across clunks, 0 disables (default: 256)\n"
+                    "  --content-cache=<MiB> Memory for hot files of 64 KiB or less, 0 disables (default: 32)\n"
+                    "  --sync=<policy>       fdatasync written files: none, clunk or always (default: none)\n"
+                    "  --coalesce-writes     Hold small writes per fid until the fid reads, stats or clunks\n"
+                    "  --io-uring            Batch directory stats and synced writes through per-thread io_uring rings\n"
                     "arguments:\n"
                     "  <address>             Dial string (e.g., tcp!host!port)\n");
     fflush(stderr);
   }
   else
   {
-    fs_context = fs9p_context_alloc(arena, root_path, str8_zero(), readonly, StorageBackend9P_Disk);
+    StorageBackend9P backend = memory ? StorageBackend9P_ArenaTemp : StorageBackend9P_Disk;
+    fs_context               = fs9p_context_alloc(arena, root_path, str8_zero(), readonly, backend);
+    connection_mutex         = mutex_alloc();
+    server_start_time        = os_now_unix();
+    if(meta_cache_mib > 0 && !memory)    { fs_context->meta_cache = fs9p_meta_cache_alloc(arena, root_path, MB(meta_cache_mib)); }
+    if(fd_cache_capacity > 0 && !memory) { fs_context->fd_cache = fs9p_fd_cache_alloc(arena, fd_cache_capacity); }
+    if(content_cache_mib > 0 && !memory) { fs_context->content_cache = fs9p_content_cache_alloc(arena, MB(content_cache_mib)); }
+    if(buffer_pool_mib > 0)              { buffer_pool = server9p_buffer_pool_alloc(arena, MB(buffer_pool_mib)); }
+    if(memory)                           { root_path = str8_lit("(memory)"); }
+    fs_context->read_ahead_max  = MB(readahead_mib);
+    fs_context->sync_policy     = sync;
+    fs_context->coalesce_writes = coalesce_writes;
+
+    // Several tcp listeners on one port let the kernel spread accepts across threads
+    Dial9PAddress dial_address = dial9p_parse(arena, address, str8_lit("tcp"), str8_lit("9pfs"));
+    if(dial_address.protocol != Dial9PProtocol_TCP) { acceptor_count = 1; }
+    acceptor_count             = Max(1, acceptor_count);
+    OS_Handle *listen_sockets  = push_array(arena, OS_Handle, acceptor_count);
+    b32 listening              = 1;
+    for(u64 i = 0; i < acceptor_count && listening; i += 1)
+    {
+      if(acceptor_count > 1) { listen_sockets[i] = dial9p_listen_reuseport(address, str8_lit("tcp"), str8_lit("9pfs")); }
+      else                   { listen_sockets[i] = dial9p_listen(address, str8_lit("tcp"), str8_lit("9pfs")); }
+      listening = !os_handle_match(listen_sockets[i], os_handle_zero());
+    }
 
-    OS_Handle listen_socket = dial9p_listen(address, str8_lit("tcp"), str8_lit("9pfs"));
-    if(os_handle_match(listen_socket, os_handle_zero()))
+    if(!listening)
     {
       fprintf(stderr, "9pfs: failed to listen on address '%.*s'\n", (int)address.size, address.str);
       fflush(stderr);
     }
     else
     {
+      if(io_ring_enabled && io_ring_from_thread() == 0)
+      {
+        fprintf(stderr, "9pfs: io_uring unavailable, using plain syscalls\n");
+        io_ring_enabled = 0;
+      }
       fprintf(stdout, "9pfs: serving '%.*s' on %.*s%s\n", (int)root_path.size, root_path.str, (int)address.size,
               address.str, readonly ? " (read-only)" : "");
       fflush(stdout);
 
-      if(worker_count == 0)
-      {
-        u64 logical_cores = os_get_system_info()->logical_processor_count;
-        worker_count      = Max(4, logical_cores / 4);
-      }
+      u64 logical_cores = os_get_system_info()->logical_processor_count;
+      if(worker_count == 0)    { worker_count    = Max(4, logical_cores / 4); }
+      if(io_thread_count == 0) { io_thread_count = Clamp(1, logical_cores / 8, 4); }
 
       worker_pool = wp_pool_alloc(arena, worker_count);
+      if(readdir_parallel > 0)
+      {
+        fs_context->stat_pool         = worker_pool;
+        fs_context->stat_parallel_min = readdir_parallel;
+      }
+      io_threads  = push_array(arena, Srv_IOThread, io_thread_count);
+      for(u64 i = 0; i < io_thread_count; i += 1)
+      {
+        io_threads[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        AssertAlways(io_threads[i].epoll_fd >= 0);
+        io_threads[i].thread   = thread_launch(srv_io_thread_entry_point, &io_threads[i]);
+      }
 
-      fprintf(stdout, "9pfs: launched %lu worker threads\n", (unsigned long)worker_count);
+      fprintf(stdout, "9pfs: launched %lu worker threads, %lu I/O threads, %lu acceptors\n", (unsigned long)worker_count,
+              (unsigned long)io_thread_count, (unsigned long)acceptor_count);
       fflush(stdout);
 
-      for(;;)
+      if(stats_address.size > 0)
       {
-        OS_Handle connection_socket = os_socket_accept(listen_socket);
-        if(os_handle_match(connection_socket, os_handle_zero())) { fprintf(stderr, "9pfs: failed to accept connection\n"); fflush(stderr); continue; }
-
-        fprintf(stdout, "9pfs: accepted connection\n");
-        fflush(stdout);
+        OS_Handle stats_socket = dial9p_listen(stats_address, str8_lit("tcp"), str8_lit("9pfs-stats"));
+        if(os_handle_match(stats_socket, os_handle_zero()))
+        {
+          fprintf(stderr, "9pfs: failed to listen for stats on '%.*s'\n", (int)stats_address.size, stats_address.str);
+          fflush(stderr);
+        }
+        else
+        {
+          Thread stats_thread = thread_launch(srv_stats_thread_entry_point, (void *)stats_socket.u64[0]);
+          thread_detach(stats_thread);
+        }
+      }
 
-        wp_submit(worker_pool, handle_connection_task, &connection_socket, sizeof(connection_socket));
+      for(u64 i = 1; i < acceptor_count; i += 1)
+      {
+        Thread acceptor_thread = thread_launch(srv_accept_thread_entry_point, (void *)listen_sockets[i].u64[0]);
+        thread_detach(acceptor_thread);
       }
+      srv_accept_loop(listen_sockets[0]);
     }
   }
 
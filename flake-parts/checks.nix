@@ -3,47 +3,52 @@
     pkgs,
     self',
     ...
-  }: {
+  }: let
+    mk9pfsTestCheck = name: serverArgs: testArgs: let
+      server = self'.packages."9pfs-debug";
+      testClient = self'.packages."9pfs-test-debug";
+    in
+      pkgs.runCommand name {
+        buildInputs = [server testClient pkgs.coreutils];
+      } ''
+        set -e
+
+        testdir=$(mktemp -d)
+        trap "rm -rf $testdir" EXIT
+
+        test_port=19999
+        test_addr="tcp!localhost!$test_port"
+
+        ${server}/bin/9pfs --root=$testdir ${serverArgs} $test_addr &
+        server_pid=$!
+        trap "kill $server_pid 2>/dev/null || true; rm -rf $testdir" EXIT
+        sleep 2
+
+        ${testClient}/bin/9pfs-test ${testArgs} $test_addr > test_output.txt 2>&1 || true
+        cat test_output.txt
+
+        failed_count=$(grep -oP '\d+(?= failed)' test_output.txt || echo "0")
+        passed_count=$(grep -oP '\d+(?= passed)' test_output.txt || echo "0")
+
+        if [ "$failed_count" != "0" ]; then
+          echo "[ERROR] $failed_count tests failed"
+          exit 1
+        fi
+
+        if [ "$passed_count" = "0" ]; then
+          echo "[ERROR] no tests ran"
+          exit 1
+        fi
+
+        echo "[$passed_count tests passed]"
+        touch $out
+      '';
+  in {
     checks = {
-      "9pfs-test" = let
-        server = self'.packages."9pfs-debug";
-        testClient = self'.packages."9pfs-test-debug";
-      in
-        pkgs.runCommand "9pfs-test-check" {
-          buildInputs = [server testClient pkgs.coreutils];
-        } ''
-          set -e
-
-          testdir=$(mktemp -d)
-          trap "rm -rf $testdir" EXIT
-
-          test_port=19999
-          test_addr="tcp!localhost!$test_port"
-
-          ${server}/bin/9pfs --root=$testdir $test_addr &
-          server_pid=$!
-          trap "kill $server_pid 2>/dev/null || true; rm -rf $testdir" EXIT
-          sleep 2
-
-          ${testClient}/bin/9pfs-test $test_addr > test_output.txt 2>&1 || true
-          cat test_output.txt
-
-          failed_count=$(grep -oP '\d+(?= failed)' test_output.txt || echo "0")
-          passed_count=$(grep -oP '\d+(?= passed)' test_output.txt || echo "0")
-
-          if [ "$failed_count" != "0" ]; then
-            echo "[ERROR] $failed_count tests failed"
-            exit 1
-          fi
-
-          if [ "$passed_count" = "0" ]; then
-            echo "[ERROR] no tests ran"
-            exit 1
-          fi
+      "9pfs-test" = mk9pfsTestCheck "9pfs-test-check" "" "--root=$testdir";
 
-          echo "[$passed_count tests passed]"
-          touch $out
-        '';
+      # The in-memory backend shares no storage code with the disk one
+      "9pfs-test-memory" = mk9pfsTestCheck "9pfs-test-memory-check" "--memory" "";
 
       "9auth-test" = let
         authAgent = self'.packages."9auth-debug";
@@ -101,6 +106,26 @@
           echo "[$passed_count tests passed]"
           touch $out
         '';
+
+      "9pfs-bench-codec" = let
+        bench = self'.packages."9pfs-bench";
+      in
+        pkgs.runCommand "9pfs-bench-codec-check" {
+          buildInputs = [bench pkgs.coreutils];
+        } ''
+          set -e
+
+          ${bench}/bin/9pfs-bench --filter=codec > bench_output.txt 2>&1
+          cat bench_output.txt
+
+          if grep -q 'FAIL' bench_output.txt; then
+            echo "[ERROR] codec benchmark failed"
+            exit 1
+          fi
+
+          mkdir -p $out
+          cp bench_output.txt $out/codec.txt
+        '';
     };
   };
 }
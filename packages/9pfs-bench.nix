@@ -0,0 +1,15 @@
+{
+  perSystem = {
+    lib,
+    pkgs,
+    ...
+  }: let
+    cmdPackage = import ../flake-parts/cmd-package.nix {inherit lib pkgs;};
+  in {
+    packages = cmdPackage.mkCmdPackage {
+      pname = "9pfs-bench";
+      description = "9P server and codec microbenchmarks";
+      version = "0.1.0";
+    };
+  };
+}
@@ -4,6 +4,7 @@
     ./9auth-test.nix
     ./9mount.nix
     ./9pfs.nix
+    ./9pfs-bench.nix
     ./9pfs-test.nix
     ./9p.nix
     ./authd.nix